@@ -27,6 +27,13 @@
 namespace nuwen {
     inline vuc_t   arith(const vuc_t& v);
     inline vuc_t unarith(const vuc_t& v);
+
+    inline vuc_t   arith(view::byte_view v);
+    inline vuc_t unarith(view::byte_view v);
+
+    // These append to dest. v must not alias dest. If an exception is thrown, dest is left unchanged.
+    inline void   arith_into(view::byte_view v, vuc_t& dest);
+    inline void unarith_into(view::byte_view v, vuc_t& dest);
 }
 
 namespace pham {
@@ -163,12 +170,12 @@ namespace pham {
                 m_acm.update(sym);
             }
 
-            nuwen::vuc_t finalize() {
+            void finalize(nuwen::vuc_t& dest) {
                 ++m_fbits;
 
                 bit_plus_follow(m_low >= FIRST_QTR);
 
-                return m_out.vuc();
+                m_out.vuc_into(dest);
             }
 
         private:
@@ -190,7 +197,7 @@ namespace pham {
 
         class decoder : public boost::noncopyable {
         public:
-            decoder(const nuwen::vuc_ci_t start, const nuwen::vuc_ci_t finish)
+            decoder(const nuwen::uc_t * const start, const nuwen::uc_t * const finish)
                 : m_curr(start), m_shift(7), m_end(finish), m_value(0), m_low(0), m_high(TOP_VALUE), m_acm() {
 
                 for (nuwen::ul_t i = 0; i < CODE_VALUE_BITS; ++i) {
@@ -252,41 +259,66 @@ namespace pham {
                 }
             }
 
-            nuwen::vuc_ci_t m_curr;
-            nuwen::uc_t     m_shift;
-            nuwen::vuc_ci_t m_end;
-            nuwen::ul_t     m_value;
-            nuwen::ul_t     m_low;
-            nuwen::ul_t     m_high;
-            model           m_acm;
+            const nuwen::uc_t *       m_curr;
+            nuwen::uc_t               m_shift;
+            const nuwen::uc_t * const m_end;
+            nuwen::ul_t               m_value;
+            nuwen::ul_t               m_low;
+            nuwen::ul_t               m_high;
+            model                     m_acm;
         };
     }
 }
 
 inline nuwen::vuc_t nuwen::arith(const vuc_t& v) {
+    return arith(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::unarith(const vuc_t& v) {
+    return unarith(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::arith(const view::byte_view v) {
+    vuc_t ret;
+
+    arith_into(v, ret);
+
+    return ret;
+}
+
+inline nuwen::vuc_t nuwen::unarith(const view::byte_view v) {
+    vuc_t ret;
+
+    unarith_into(v, ret);
+
+    return ret;
+}
+
+inline void nuwen::arith_into(const view::byte_view v, vuc_t& dest) {
     pham::arith::encoder ae;
 
-    for (vuc_ci_t i = v.begin(); i != v.end(); ++i) {
+    for (view::byte_view::const_iterator i = v.begin(); i != v.end(); ++i) {
         ae.encode(*i);
     }
 
     ae.encode(pham::arith::SENTINEL);
 
-    return ae.finalize();
+    ae.finalize(dest);
 }
 
-inline nuwen::vuc_t nuwen::unarith(const vuc_t& v) {
+inline void nuwen::unarith_into(const view::byte_view v, vuc_t& dest) {
     pham::arith::decoder ad(v.begin(), v.end());
 
-    vuc_t ret;
+    pham::append_guard guard(dest);
 
     while (true) {
         const pham::arith::symbol_t decoded = ad.decode();
 
         if (decoded != pham::arith::SENTINEL) {
-            ret.push_back(static_cast<uc_t>(decoded));
+            dest.push_back(static_cast<uc_t>(decoded));
         } else {
-            return ret;
+            guard.dismiss();
+            return;
         }
     }
 }
@@ -0,0 +1,289 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#ifndef PHAM_BENCH_HH
+#define PHAM_BENCH_HH
+
+#include "compiler.hh"
+
+#ifdef NUWEN_PLATFORM_MSVC
+    #pragma once
+#endif
+
+#include "clock.hh"
+#include "memory.hh"
+#include "random.hh"
+#include "typedef.hh"
+
+#include "external_begin.hh"
+    #include <algorithm>
+    #include <stdexcept>
+    #include <string>
+    #include <vector>
+    #include <boost/format.hpp>
+    #include <boost/utility.hpp>
+#include "external_end.hh"
+
+namespace nuwen {
+    namespace bench {
+        typedef vuc_t (*codec_t)(const vuc_t&);
+
+        // These are deterministic for a given twister seed, so results can be compared across releases.
+        inline vuc_t random_corpus(random::twister& t, vuc_s_t n);
+        inline vuc_t text_corpus(random::twister& t, vuc_s_t n);
+        inline vuc_t repetitive_corpus(random::twister& t, vuc_s_t n);
+        inline vuc_t zero_corpus(random::twister& t, vuc_s_t n);
+
+        struct result {
+            std::string codec;
+            std::string corpus;
+            ull_t       original_bytes;
+            ull_t       encoded_bytes;
+            double      encode_seconds; // Fastest repetition.
+            double      decode_seconds; // Fastest repetition. Zero when there is no decoder.
+            ull_t       encode_peak_bytes; // Largest repetition. See pham::bench::peak_meter.
+            ull_t       decode_peak_bytes;
+        };
+
+        class harness : public boost::noncopyable {
+        public:
+            inline harness(int warmups, int repetitions);
+
+            // decode may be NULL (e.g. for hashes). Otherwise, round trips are verified.
+            inline result run(const std::string& codec, codec_t encode, codec_t decode,
+                const std::string& corpus, const vuc_t& v) const;
+
+        private:
+            const int m_warmups;
+            const int m_repetitions;
+        };
+
+        // Tab-separated, one result per line, with a commented header.
+        inline std::string tsv_header();
+        inline std::string tsv_from_result(const result& r);
+    }
+}
+
+namespace pham {
+    namespace bench {
+        // Measures how much physical memory a codec call adds at its peak, over what the process used when it began.
+        // Where the peak can't be reset, only growth beyond the process's earlier peak is seen.
+        class peak_meter {
+        public:
+            peak_meter() : m_before(0) {
+                nuwen::reset_peak_resident_bytes();
+                m_before = nuwen::peak_resident_bytes();
+            }
+
+            nuwen::ull_t bytes() const {
+                const nuwen::ull_t after = nuwen::peak_resident_bytes();
+
+                return after > m_before ? after - m_before : 0;
+            }
+
+        private:
+            nuwen::ull_t m_before;
+        };
+
+        inline double mb_per_second(const nuwen::ull_t bytes, const double seconds) {
+            return seconds > 0 ? static_cast<double>(bytes) / seconds / 1048576 : 0;
+        }
+
+        inline nuwen::uc_t random_letter(nuwen::random::twister& t) {
+            // Roughly English letter frequencies: early letters are much more likely.
+            const double r = t.random_double_0_1();
+
+            return static_cast<nuwen::uc_t>("etaoinshrdlcumwfgypbvkjxqz"[static_cast<int>(r * r * 25.99)]);
+        }
+    }
+}
+
+inline nuwen::vuc_t nuwen::bench::random_corpus(random::twister& t, const vuc_s_t n) {
+    vuc_t v(n);
+
+    for (vuc_i_t i = v.begin(); i != v.end(); ++i) {
+        *i = t.random_uc();
+    }
+
+    return v;
+}
+
+inline nuwen::vuc_t nuwen::bench::text_corpus(random::twister& t, const vuc_s_t n) {
+    // Words are drawn from a fixed vocabulary with a heavily skewed distribution.
+    const int VOCABULARY_SIZE = 2048;
+
+    std::vector<vuc_t> words(VOCABULARY_SIZE);
+
+    for (std::vector<vuc_t>::iterator i = words.begin(); i != words.end(); ++i) {
+        const ul_t len = 1 + t.random_ul() % 9;
+
+        for (ul_t k = 0; k < len; ++k) {
+            i->push_back(pham::bench::random_letter(t));
+        }
+    }
+
+    vuc_t v;
+    v.reserve(n + 16);
+
+    vuc_s_t line = 0;
+
+    while (v.size() < n) {
+        const double r = t.random_double_0_1();
+
+        const vuc_t& word = words[static_cast<vuc_s_t>(r * r * r * (VOCABULARY_SIZE - 1))];
+
+        v.insert(v.end(), word.begin(), word.end());
+        line += word.size();
+
+        switch (t.random_ul() % 16) {
+            case 0:  v.push_back('.'); break;
+            case 1:  v.push_back(','); break;
+            default: break;
+        }
+
+        if (line > 70) {
+            v.push_back('\n');
+            line = 0;
+        } else {
+            v.push_back(' ');
+            ++line;
+        }
+    }
+
+    v.resize(n);
+
+    return v;
+}
+
+inline nuwen::vuc_t nuwen::bench::repetitive_corpus(random::twister& t, const vuc_s_t n) {
+    // A random 1 KB block, repeated with about 1% of the bytes mutated in each copy.
+    const vuc_t block = random_corpus(t, 1024);
+
+    vuc_t v(n);
+
+    for (vuc_s_t i = 0; i < n; ++i) {
+        v[i] = t.random_ul() % 100 == 0 ? t.random_uc() : block[i % block.size()];
+    }
+
+    return v;
+}
+
+inline nuwen::vuc_t nuwen::bench::zero_corpus(random::twister& t, const vuc_s_t n) {
+    // About 7/8 zeros, with runs of random bytes in between.
+    vuc_t v(n, 0x00);
+
+    for (vuc_s_t i = 0; i < n; ) {
+        const vuc_s_t run = 1 + t.random_ul() % 64;
+
+        if (t.random_ul() % 8 == 0) {
+            for (vuc_s_t k = 0; k < run && i < n; ++k, ++i) {
+                v[i] = t.random_uc();
+            }
+        } else {
+            i += run;
+        }
+    }
+
+    return v;
+}
+
+inline nuwen::bench::harness::harness(const int warmups, const int repetitions)
+    : m_warmups(warmups), m_repetitions(repetitions) {
+
+    if (warmups < 0) {
+        throw std::logic_error("LOGIC ERROR: nuwen::bench::harness::harness() - Invalid warmups.");
+    }
+
+    if (repetitions < 1) {
+        throw std::logic_error("LOGIC ERROR: nuwen::bench::harness::harness() - Invalid repetitions.");
+    }
+}
+
+inline nuwen::bench::result nuwen::bench::harness::run(const std::string& codec, const codec_t encode,
+    const codec_t decode, const std::string& corpus, const vuc_t& v) const {
+
+    using namespace std;
+    using namespace nuwen::chrono;
+
+    if (encode == NULL) {
+        throw logic_error("LOGIC ERROR: nuwen::bench::harness::run() - encode is NULL.");
+    }
+
+    result r;
+
+    r.codec          = codec;
+    r.corpus         = corpus;
+    r.original_bytes = v.size();
+    r.encoded_bytes  = 0;
+    r.encode_seconds = 0;
+    r.decode_seconds = 0;
+
+    r.encode_peak_bytes = 0;
+    r.decode_peak_bytes = 0;
+
+    for (int i = 0; i < m_warmups + m_repetitions; ++i) {
+        const bool measured = i >= m_warmups;
+        const bool first = i == m_warmups;
+
+        const pham::bench::peak_meter encode_meter;
+
+        watch w;
+
+        const vuc_t encoded = encode(v);
+
+        const double encode_seconds = w.seconds();
+
+        const ull_t encode_peak_bytes = encode_meter.bytes();
+
+        if (measured) {
+            r.encoded_bytes     = encoded.size();
+            r.encode_seconds    = first ? encode_seconds : min(r.encode_seconds, encode_seconds);
+            r.encode_peak_bytes = max(r.encode_peak_bytes, encode_peak_bytes);
+        }
+
+        if (decode) {
+            const pham::bench::peak_meter decode_meter;
+
+            w.reset();
+
+            const vuc_t decoded = decode(encoded);
+
+            const double decode_seconds = w.seconds();
+
+            const ull_t decode_peak_bytes = decode_meter.bytes();
+
+            if (decoded != v) {
+                throw runtime_error(str(boost::format(
+                    "RUNTIME ERROR: nuwen::bench::harness::run() - %1% mangled %2%.") % codec % corpus));
+            }
+
+            if (measured) {
+                r.decode_seconds    = first ? decode_seconds : min(r.decode_seconds, decode_seconds);
+                r.decode_peak_bytes = max(r.decode_peak_bytes, decode_peak_bytes);
+            }
+        }
+    }
+
+    return r;
+}
+
+inline std::string nuwen::bench::tsv_header() {
+    return "#codec\tcorpus\tbytes\tencoded\tratio\tencode_mb_s\tdecode_mb_s\tencode_peak_bytes\tdecode_peak_bytes";
+}
+
+inline std::string nuwen::bench::tsv_from_result(const result& r) {
+    using namespace pham::bench;
+
+    const double ratio = r.encoded_bytes == 0 ? 0
+        : static_cast<double>(r.original_bytes) / static_cast<double>(r.encoded_bytes);
+
+    return str(boost::format("%1%\t%2%\t%3%\t%4%\t%5$.4f\t%6$.2f\t%7$.2f\t%8%\t%9%")
+        % r.codec % r.corpus % r.original_bytes % r.encoded_bytes % ratio
+        % mb_per_second(r.original_bytes, r.encode_seconds)
+        % mb_per_second(r.original_bytes, r.decode_seconds)
+        % r.encode_peak_bytes % r.decode_peak_bytes);
+}
+
+#endif // Idempotency
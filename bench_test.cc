@@ -0,0 +1,135 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#include "arith.hh"
+#include "bench.hh"
+#include "bwt.hh"
+#include "bzip2.hh"
+#include "compiler.hh"
+#include "huff.hh"
+#include "mtf.hh"
+#include "random.hh"
+#include "sha256.hh"
+#include "typedef.hh"
+#include "zle.hh"
+#include "zlib.hh"
+
+#include "external_begin.hh"
+    #include <cstdlib>
+    #include <exception>
+    #include <iostream>
+    #include <ostream>
+    #include <string>
+    #include <boost/lexical_cast.hpp>
+#include "external_end.hh"
+
+using namespace std;
+using namespace boost;
+using namespace nuwen;
+using namespace nuwen::bench;
+using namespace nuwen::random;
+
+vuc_t mtf2_copy(const vuc_t& v) {
+    vuc_t ret(v);
+    mtf2(ret);
+    return ret;
+}
+
+vuc_t unmtf2_copy(const vuc_t& v) {
+    vuc_t ret(v);
+    unmtf2(ret);
+    return ret;
+}
+
+vuc_t zlib_default(const vuc_t& v) {
+    return zlib(v);
+}
+
+vuc_t bmza(const vuc_t& v) {
+    vuc_t t = bwt(v);
+    mtf2(t);
+    return arith(zle(t));
+}
+
+vuc_t unbmza(const vuc_t& v) {
+    vuc_t t = unzle(unarith(v));
+    unmtf2(t);
+    return unbwt(t);
+}
+
+vuc_t bmzh(const vuc_t& v) {
+    vuc_t t = bwt(v);
+    mtf2(t);
+    return huff(zle(t));
+}
+
+vuc_t unbmzh(const vuc_t& v) {
+    vuc_t t = unzle(puff(v));
+    unmtf2(t);
+    return unbwt(t);
+}
+
+struct codec_entry {
+    const char * name;
+    codec_t      encode;
+    codec_t      decode;
+};
+
+const codec_entry codecs[] = {
+    { "bwt",                bwt,          unbwt       },
+    { "mtf2",               mtf2_copy,    unmtf2_copy },
+    { "zle",                zle,          unzle       },
+    { "arith",              arith,        unarith     },
+    { "huff",               huff,         puff        },
+    { "zlib",               zlib_default, unzlib      },
+    { "bzip2",              bzip2,        unbzip2     },
+    { "sha256",             sha256,       NULL        },
+    { "bwt+mtf2+zle+arith", bmza,         unbmza      },
+    { "bwt+mtf2+zle+huff",  bmzh,         unbmzh      }
+};
+
+struct corpus_entry {
+    const char * name;
+    vuc_t (*make)(twister&, vuc_s_t);
+};
+
+const corpus_entry corpora[] = {
+    { "random",     random_corpus     },
+    { "text",       text_corpus       },
+    { "repetitive", repetitive_corpus },
+    { "zeros",      zero_corpus       }
+};
+
+int main(int argc, char * argv[]) {
+    if (argc > 4) {
+        cout << "USAGE: bench_test [kilobytes [repetitions [warmups]]]" << endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        const vuc_s_t kilobytes   = argc > 1 ? lexical_cast<vuc_s_t>(argv[1]) : 1024;
+        const int     repetitions = argc > 2 ? lexical_cast<int>(argv[2]) : 3;
+        const int     warmups     = argc > 3 ? lexical_cast<int>(argv[3]) : 1;
+
+        const harness h(warmups, repetitions);
+
+        cout << "# libnuwen " NUWEN_VERSION ", " NUWEN_COMPILER_NAME " " NUWEN_COMPILER_VERSION << endl;
+        cout << "# kilobytes=" << kilobytes << " repetitions=" << repetitions << " warmups=" << warmups << endl;
+        cout << tsv_header() << endl;
+
+        for (size_t i = 0; i < sizeof corpora / sizeof corpora[0]; ++i) {
+            twister t(1729);
+
+            const vuc_t v = corpora[i].make(t, kilobytes * 1024);
+
+            for (size_t k = 0; k < sizeof codecs / sizeof codecs[0]; ++k) {
+                cout << tsv_from_result(h.run(codecs[k].name, codecs[k].encode, codecs[k].decode, corpora[i].name, v)) << endl;
+            }
+        }
+    } catch (const std::exception& e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+}
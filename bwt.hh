@@ -29,6 +29,13 @@
 namespace nuwen {
     inline vuc_t bwt(const vuc_t& v);
     inline vuc_t unbwt(const vuc_t& v);
+
+    inline vuc_t bwt(view::byte_view v);
+    inline vuc_t unbwt(view::byte_view v);
+
+    // These append to dest. v must not alias dest. If an exception is thrown, dest is left unchanged.
+    inline void   bwt_into(view::byte_view v, vuc_t& dest);
+    inline void unbwt_into(view::byte_view v, vuc_t& dest);
 }
 
 // Uncomment to enable internal logic checks that should never fire.
@@ -55,7 +62,7 @@ namespace pham {
 
         class wrapped_text : public boost::noncopyable {
         public:
-            explicit wrapped_text(const nuwen::vuc_t& v) : m_v(v), m_infinity(static_cast<index_t>(v.size())) { }
+            explicit wrapped_text(const nuwen::view::byte_view v) : m_v(v), m_infinity(static_cast<index_t>(v.size())) { }
 
             index_t infinity() const { return m_infinity; }
 
@@ -70,8 +77,8 @@ namespace pham {
             }
 
         private:
-            const nuwen::vuc_t& m_v;
-            const index_t       m_infinity;
+            const nuwen::view::byte_view m_v;
+            const index_t                m_infinity;
         };
 
 
@@ -265,7 +272,7 @@ namespace pham {
 
         class tree : public boost::noncopyable {
         public:
-            explicit tree(const nuwen::vuc_t& v)
+            explicit tree(const nuwen::view::byte_view v)
                 : m_hybrid_alloc(v.size()), m_leaf_alloc(v.size() + 1), m_negative_alloc(SIGMA), m_root(), m_bottom(), m_text(v) {
 
                 m_root.m_link = &m_bottom;
@@ -439,9 +446,10 @@ namespace pham {
 
         class bwt_helper {
         public:
-            bwt_helper(const nuwen::vuc_t& src, nuwen::vuc_t& dest)
-                : m_src(src.begin()), m_n(src.size()), m_dest(dest.begin() + 8), m_dest_orig(m_dest),
-                m_primarydest(dest.begin()), m_sentineldest(dest.begin() + 4) { }
+            // dest must have room for src.size() + 9 bytes.
+            bwt_helper(const nuwen::view::byte_view src, const nuwen::vuc_i_t dest)
+                : m_src(src.begin()), m_n(src.size()), m_dest(dest + 8), m_dest_orig(m_dest),
+                m_primarydest(dest), m_sentineldest(dest + 4) { }
 
             void operator()(const nuwen::ul_t len) {
                 if (len < m_n) {
@@ -458,64 +466,92 @@ namespace pham {
             }
 
         private:
-            nuwen::vuc_ci_t m_src;
-            nuwen::vuc_s_t  m_n;
-            nuwen::vuc_i_t  m_dest;
-            nuwen::vuc_ci_t m_dest_orig;
-            nuwen::vuc_i_t  m_primarydest;
-            nuwen::vuc_i_t  m_sentineldest;
+            const nuwen::uc_t * m_src;
+            nuwen::vuc_s_t      m_n;
+            nuwen::vuc_i_t      m_dest;
+            nuwen::vuc_ci_t     m_dest_orig;
+            nuwen::vuc_i_t      m_primarydest;
+            nuwen::vuc_i_t      m_sentineldest;
         };
     }
 }
 
 inline nuwen::vuc_t nuwen::bwt(const vuc_t& v) {
+    return bwt(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::unbwt(const vuc_t& v) {
+    return unbwt(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::bwt(const view::byte_view v) {
+    vuc_t ret;
+
+    bwt_into(v, ret);
+
+    return ret;
+}
+
+inline nuwen::vuc_t nuwen::unbwt(const view::byte_view v) {
+    vuc_t ret;
+
+    unbwt_into(v, ret);
+
+    return ret;
+}
+
+inline void nuwen::bwt_into(const view::byte_view v, vuc_t& dest) {
     using namespace std;
     using namespace pham::ukk;
 
     if (v.size() < MIN_ALLOWED_SIZE) {
-        throw logic_error("LOGIC ERROR: nuwen::bwt() - v is too small.");
+        throw logic_error("LOGIC ERROR: nuwen::bwt_into() - v is too small.");
     }
 
     if (v.size() > MAX_ALLOWED_SIZE) {
-        throw runtime_error("RUNTIME ERROR: nuwen::bwt() - v is too big.");
+        throw runtime_error("RUNTIME ERROR: nuwen::bwt_into() - v is too big.");
     }
 
-    vuc_t ret(v.size() + 9);
-
     tree st(v);
 
-    st.dfs(bwt_helper(v, ret));
+    pham::append_guard guard(dest);
 
-    return ret;
+    const vuc_s_t used = dest.size();
+
+    dest.resize(used + v.size() + 9);
+
+    st.dfs(bwt_helper(v, dest.begin() + used));
+
+    guard.dismiss();
 }
 
-inline nuwen::vuc_t nuwen::unbwt(const vuc_t& v) {
+inline void nuwen::unbwt_into(const view::byte_view v, vuc_t& dest) {
     using namespace std;
     using namespace pham::ukk;
 
     if (v.size() < 9 + MIN_ALLOWED_SIZE) {
-        throw runtime_error("RUNTIME ERROR: nuwen::unbwt() - v is too small.");
+        throw runtime_error("RUNTIME ERROR: nuwen::unbwt_into() - v is too small.");
     }
 
     if (v.size() > 9 + MAX_ALLOWED_SIZE) {
-        throw runtime_error("RUNTIME ERROR: nuwen::unbwt() - v is too big.");
+        throw runtime_error("RUNTIME ERROR: nuwen::unbwt_into() - v is too big.");
     }
 
     const ul_t primaryindex = ul_from_vuc(v, 0);
     const ul_t sentinelindex = ul_from_vuc(v, 4);
-    const vuc_ci_t src = v.begin() + 8;
+    const uc_t * const src = v.begin() + 8;
     const vuc_s_t n = v.size() - 8;
 
     if (primaryindex >= n) {
-        throw runtime_error("RUNTIME ERROR: nuwen::unbwt() - Invalid primary index.");
+        throw runtime_error("RUNTIME ERROR: nuwen::unbwt_into() - Invalid primary index.");
     }
 
     if (sentinelindex >= n) {
-        throw runtime_error("RUNTIME ERROR: nuwen::unbwt() - Invalid sentinel index.");
+        throw runtime_error("RUNTIME ERROR: nuwen::unbwt_into() - Invalid sentinel index.");
     }
 
     if (src[static_cast<index_t>(sentinelindex)] != FILLER) {
-        throw runtime_error("RUNTIME ERROR: nuwen::unbwt() - Sentinel index doesn't contain filler.");
+        throw runtime_error("RUNTIME ERROR: nuwen::unbwt_into() - Sentinel index doesn't contain filler.");
     }
 
     vul_t freqs(SIGMA, 0); // Fenwick's K
@@ -537,22 +573,24 @@ inline nuwen::vuc_t nuwen::unbwt(const vuc_t& v) {
         links[i] = mapping[static_cast<vul_s_t>(i == sentinelindex ? SENTINEL : src[static_cast<index_t>(i)])]++;
     }
 
-    vuc_t ret(n);
+    pham::append_guard guard(dest);
+
+    dest.resize(dest.size() + n);
 
     ul_t index = primaryindex;
 
-    for (vuc_ri_t i = ret.rbegin(); i != ret.rend(); ++i) {
+    for (vuc_ri_t i = dest.rbegin(); i != dest.rbegin() + static_cast<vuc_d_t>(n); ++i) {
         index = links[index];
         *i = src[static_cast<index_t>(index)];
     }
 
-    if (ret.back() != FILLER) {
-        throw runtime_error("RUNTIME ERROR: nuwen::unbwt() - ret's last byte isn't filler.");
+    if (dest.back() != FILLER) {
+        throw runtime_error("RUNTIME ERROR: nuwen::unbwt_into() - The last byte isn't filler.");
     }
 
-    ret.pop_back();
+    dest.pop_back();
 
-    return ret;
+    guard.dismiss();
 }
 
 #undef PHAM_BWT_LOGIC_CHECKS
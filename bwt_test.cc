@@ -73,7 +73,7 @@ vuc_t instrumented_bwt(const vuc_t& v) {
 
         ukkonen_time = total.seconds();
 
-        st.dfs(bwt_helper(v, dest));
+        st.dfs(bwt_helper(v, dest.begin()));
 
         dfs_time = total.seconds() - ukkonen_time;
 
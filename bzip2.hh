@@ -12,11 +12,15 @@
     #pragma once
 #endif
 
-#include "gluon.hh"
+#include "file.hh"
 #include "typedef.hh"
+#include "vector.hh"
 
 #include "external_begin.hh"
+    #include <algorithm>
     #include <stdexcept>
+    #include <vector>
+    #include <boost/scoped_ptr.hpp>
     #include <boost/utility.hpp>
     #include <bzlib.h>
 #include "external_end.hh"
@@ -24,12 +28,49 @@
 namespace nuwen {
     inline vuc_t   bzip2(const vuc_t& v);
     inline vuc_t unbzip2(const vuc_t& v);
+
+    inline vuc_t   bzip2(view::byte_view v);
+    inline vuc_t unbzip2(view::byte_view v);
+
+    // These append to dest. v must not alias dest. If an exception is thrown, dest is left unchanged.
+    // Like bunzip2, the decompressors accept several concatenated streams.
+    inline void   bzip2_into(view::byte_view v, vuc_t& dest);
+    inline void unbzip2_into(view::byte_view v, vuc_t& dest);
+
+    // expected is the decompressed size, if known. Output goes directly into a single allocation
+    // of that size. If expected is wrong, decompression still succeeds, but may reallocate.
+    // expected is never trusted beyond the most that v could decompress to.
+    inline vuc_t unbzip2(view::byte_view v, vuc_s_t expected);
+    inline void  unbzip2_into(view::byte_view v, vuc_t& dest, vuc_s_t expected);
+
+    // The framed format is the big-endian 8-byte decompressed size, followed by the bzip2 stream.
+    inline vuc_t   bzip2_framed(view::byte_view v);
+    inline vuc_t unbzip2_framed(view::byte_view v);
 }
 
 namespace pham {
     namespace bz2 {
         struct stream : public boost::noncopyable {
-            explicit stream(const nuwen::vuc_t& v) {
+            stream(const int block_size_100k, const int work_factor) : m_compress(true) {
+                init_common();
+
+                if (BZ2_bzCompressInit(&m_stream, block_size_100k, 0, work_factor) != BZ_OK) {
+                    throw std::runtime_error("RUNTIME ERROR: pham::bz2::stream::stream() - BZ2_bzCompressInit() failed.");
+                }
+            }
+
+            explicit stream(const nuwen::view::byte_view v) : m_compress(false) {
+                init_common();
+
+                if (BZ2_bzDecompressInit(&m_stream, 0, 0) != BZ_OK) {
+                    throw std::runtime_error("RUNTIME ERROR: pham::bz2::stream::stream() - BZ2_bzDecompressInit() failed.");
+                }
+
+                m_stream.next_in = reinterpret_cast<char *>(const_cast<nuwen::uc_t *>(v.data()));
+                m_stream.avail_in = v.size();
+            }
+
+            void init_common() {
                 m_stream.next_in        = NULL;
                 m_stream.avail_in       = 0;
                 m_stream.total_in_lo32  = 0;
@@ -42,82 +83,449 @@ namespace pham {
                 m_stream.bzalloc        = NULL;
                 m_stream.bzfree         = NULL;
                 m_stream.opaque         = NULL;
-
-                if (BZ2_bzDecompressInit(&m_stream, 0, 0) != BZ_OK) {
-                    throw std::runtime_error("RUNTIME ERROR: pham::bz2::stream::stream() - BZ2_bzDecompressInit() failed.");
-                }
-
-                m_stream.next_in = reinterpret_cast<char *>(const_cast<nuwen::uc_t *>(&v[0]));
-                m_stream.avail_in = v.size();
             }
 
             ~stream() {
-                (void) BZ2_bzDecompressEnd(&m_stream);
+                if (m_compress) {
+                    (void) BZ2_bzCompressEnd(&m_stream);
+                } else {
+                    (void) BZ2_bzDecompressEnd(&m_stream);
+                }
             }
 
             bz_stream m_stream;
+            bool      m_compress;
+        };
+
+        // avail_in and avail_out are 32-bit, so longer input is handed over in pieces.
+        const nuwen::vuc_s_t MAX_PIECE_SIZE = 1073741824;
+
+        // The most expansive block, 45,899,235 zeros, compresses to 32 bytes, so a size hint beyond this is wrong.
+        inline nuwen::ull_t max_decompressed_size(const nuwen::vuc_s_t compressed_size) {
+            return 1434352ULL * compressed_size;
+        }
+
+        // As in unzlib_into(), output blocks grow with the output up to BLOCK_SIZE.
+        inline nuwen::vuc_s_t block_size(const nuwen::vuc_s_t produced, const nuwen::vuc_s_t pending) {
+            const nuwen::vuc_s_t MIN_BLOCK_SIZE = 4096;
+            const nuwen::vuc_s_t BLOCK_SIZE = 1048576;
+
+            return std::min(BLOCK_SIZE, std::max(MIN_BLOCK_SIZE, produced + pending));
+        }
+
+        inline bool begins_stream(const nuwen::view::byte_view v) {
+            return v.size() >= 4 && v[0] == 'B' && v[1] == 'Z' && v[2] == 'h' && v[3] >= '1' && v[3] <= '9';
+        }
+
+        // Decompresses the stream at the beginning of v, appending to dest, and returns the number of bytes consumed.
+        // Output blocks grow with the output beyond dest[base]. expected is the size of the first block, or 0.
+        inline nuwen::vuc_s_t decompress_stream(const nuwen::view::byte_view v, nuwen::vuc_t& dest,
+            const nuwen::vuc_s_t base, const nuwen::vuc_s_t expected) {
+
+            using namespace nuwen;
+
+            stream s(v);
+
+            const vuc_s_t original = dest.size();
+
+            while (true) {
+                const vuc_s_t used = dest.size();
+
+                const vuc_s_t n = used == original && expected != 0 ? expected : block_size(used - base, v.size());
+
+                dest.resize(used + n);
+
+                s.m_stream.next_out = reinterpret_cast<char *>(&dest[used]);
+                s.m_stream.avail_out = static_cast<unsigned int>(n); // POISON_OK
+
+                const int error = BZ2_bzDecompress(&s.m_stream);
+
+                dest.resize(used + n - s.m_stream.avail_out);
+
+                if (error == BZ_OK) {
+                    if (s.m_stream.avail_out != 0) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::bz2::decompress_stream() - Compressed data ended prematurely.");
+                    }
+                } else if (error == BZ_STREAM_END) {
+                    return v.size() - s.m_stream.avail_in;
+                } else {
+                    throw std::runtime_error("RUNTIME ERROR: pham::bz2::decompress_stream() - BZ2_bzDecompress() failed.");
+                }
+            }
+        }
+    }
+}
+
+namespace nuwen {
+    namespace stream {
+        // Accepts input in pieces, emitting standard bzip2 output in pieces.
+        class bzip2_compressor : public boost::noncopyable {
+        public:
+            // block_size_100k is from 1 to 9, as in bzip2 -1 through bzip2 -9.
+            inline explicit bzip2_compressor(int block_size_100k = 9);
+
+            // These append whatever output is ready to dest. If one throws,
+            // dest is left unchanged, but the compressor can only be destroyed.
+            inline void compress(view::byte_view v, vuc_t& dest);
+
+            // Ends the current block, so that everything compressed so far can be decompressed from
+            // the output so far. Small blocks compress poorly, so this should be called sparingly.
+            inline void flush(vuc_t& dest);
+
+            // Ends the stream. Afterwards, compress(), flush(), and finish() throw.
+            inline void finish(vuc_t& dest);
+
+            inline bool finished() const;
+
+        private:
+            inline void run(view::byte_view v, int action, vuc_t& dest);
+
+            pham::bz2::stream m_s;
+            bool              m_finished;
+        };
+
+        // Like bunzip2, this accepts several concatenated streams.
+        class bzip2_decompressor : public boost::noncopyable {
+        public:
+            inline bzip2_decompressor();
+
+            // Appends whatever output is ready to dest. If this throws,
+            // dest is left unchanged, but the decompressor can only be destroyed.
+            inline void decompress(view::byte_view v, vuc_t& dest);
+
+            // Whether the input so far ends with the end of a stream.
+            inline bool finished() const;
+
+            // Throws if the input so far doesn't end with the end of a stream.
+            inline void finish() const;
+
+        private:
+            boost::scoped_ptr<pham::bz2::stream> m_s; // Replaced for each stream.
+            bool                                 m_finished;
         };
+
+        // These read in at most chunk_size pieces, so memory use is bounded
+        // by chunk_size and the compression ratio, instead of the files' sizes.
+        inline void   bzip2_file(file::input_file& in, file::output_file& out, vuc_s_t chunk_size = 1048576);
+        inline void unbzip2_file(file::input_file& in, file::output_file& out, vuc_s_t chunk_size = 1048576);
     }
 }
 
 inline nuwen::vuc_t nuwen::bzip2(const vuc_t& v) {
+    return bzip2(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::unbzip2(const vuc_t& v) {
+    return unbzip2(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::bzip2(const view::byte_view v) {
+    vuc_t dest;
+
+    bzip2_into(v, dest);
+
+    return dest;
+}
+
+inline nuwen::vuc_t nuwen::unbzip2(const view::byte_view v) {
+    vuc_t dest;
+
+    unbzip2_into(v, dest);
+
+    return dest;
+}
+
+inline void nuwen::bzip2_into(const view::byte_view v, vuc_t& dest) {
     unsigned int destlen = v.size() + v.size() / 100 + 600; // POISON_OK
 
-    vuc_t dest(destlen);
+    pham::append_guard guard(dest);
+
+    const vuc_s_t used = dest.size();
+
+    dest.resize(used + destlen);
 
     char dummy = 0;
 
-    char * const source = v.empty() ? &dummy : reinterpret_cast<char *>(const_cast<uc_t *>(&v[0]));
+    char * const source = v.empty() ? &dummy : reinterpret_cast<char *>(const_cast<uc_t *>(v.data()));
 
-    const int error = BZ2_bzBuffToBuffCompress(reinterpret_cast<char *>(&dest[0]), &destlen, source, v.size(), 9, 0, 0);
+    const int error = BZ2_bzBuffToBuffCompress(reinterpret_cast<char *>(&dest[used]), &destlen, source, v.size(), 9, 0, 0);
 
     if (error != BZ_OK) {
-        throw std::runtime_error("RUNTIME ERROR: nuwen::bzip2() - BZ2_bzBuffToBuffCompress() failed.");
+        throw std::runtime_error("RUNTIME ERROR: nuwen::bzip2_into() - BZ2_bzBuffToBuffCompress() failed.");
     }
 
-    dest.resize(destlen);
+    dest.resize(used + destlen);
+
+    guard.dismiss();
+}
+
+inline void nuwen::unbzip2_into(const view::byte_view v, vuc_t& dest) {
+    unbzip2_into(v, dest, 0);
+}
+
+inline nuwen::vuc_t nuwen::unbzip2(const view::byte_view v, const vuc_s_t expected) {
+    vuc_t dest;
+
+    unbzip2_into(v, dest, expected);
+
     return dest;
 }
 
-inline nuwen::vuc_t nuwen::unbzip2(const vuc_t& v) {
+inline void nuwen::unbzip2_into(const view::byte_view v, vuc_t& dest, const vuc_s_t expected) {
     if (v.empty()) {
-        throw std::logic_error("LOGIC ERROR: nuwen::unbzip2() - v is empty.");
+        throw std::logic_error("LOGIC ERROR: nuwen::unbzip2_into() - v is empty.");
     }
 
-    pham::bz2::stream s(v);
+    pham::append_guard guard(dest);
 
-    const vuc_s_t BLOCK_SIZE = 1048576;
+    // One more byte than expected lets the first BZ2_bzDecompress() see the end of the stream.
+    // A forged expected can't allocate more than v could possibly decompress to.
+    const vuc_s_t MAX_FIRST_BLOCK_SIZE = 1073741824;
 
-    vuc_t temp(BLOCK_SIZE);
+    const vuc_s_t first_block = static_cast<vuc_s_t>(std::min(static_cast<ull_t>(expected),
+        std::min(pham::bz2::max_decompressed_size(v.size()), static_cast<ull_t>(MAX_FIRST_BLOCK_SIZE))));
 
-    vuc_t dest;
+    vuc_s_t pos = 0;
 
-    while (true) {
-        s.m_stream.next_out = reinterpret_cast<char *>(&temp[0]);
-        s.m_stream.avail_out = BLOCK_SIZE;
+    do {
+        const vuc_s_t first = pos == 0 && expected != 0 ? 1 + first_block : 0;
+
+        pos += pham::bz2::decompress_stream(v.sub(pos, v.size() - pos), dest, guard.original_size(), first);
+    } while (pos != v.size() && pham::bz2::begins_stream(v.sub(pos, v.size() - pos)));
+
+    if (pos != v.size()) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::unbzip2_into() - Some bytes were not consumed.");
+    }
+
+    guard.dismiss();
+}
 
-        const int error = BZ2_bzDecompress(&s.m_stream);
+inline nuwen::vuc_t nuwen::bzip2_framed(const view::byte_view v) {
+    vuc_t dest = vuc_from_ull(v.size());
 
-        if (error == BZ_OK) {
-            if (s.m_stream.avail_out != 0) {
-                throw std::runtime_error("RUNTIME ERROR: nuwen::unbzip2() - Compressed data ended prematurely.");
+    bzip2_into(v, dest);
+
+    return dest;
+}
+
+inline nuwen::vuc_t nuwen::unbzip2_framed(const view::byte_view v) {
+    if (v.size() < 8) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::unbzip2_framed() - Insufficient data to decompress.");
+    }
+
+    const ull_t size = ull_from_vuc(v);
+
+    if (size != static_cast<vuc_s_t>(size) || size > pham::bz2::max_decompressed_size(v.size() - 8)) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::unbzip2_framed() - Invalid size.");
+    }
+
+    const vuc_t dest = unbzip2(v.sub(8, v.size() - 8), static_cast<vuc_s_t>(size));
+
+    if (dest.size() != size) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::unbzip2_framed() - Wrong size.");
+    }
+
+    return dest;
+}
+
+inline nuwen::stream::bzip2_compressor::bzip2_compressor(const int block_size_100k)
+    : m_s(block_size_100k, 0), m_finished(false) { }
+
+inline void nuwen::stream::bzip2_compressor::compress(const view::byte_view v, vuc_t& dest) {
+    run(v, BZ_RUN, dest);
+}
+
+inline void nuwen::stream::bzip2_compressor::flush(vuc_t& dest) {
+    run(view::byte_view(), BZ_FLUSH, dest);
+}
+
+inline void nuwen::stream::bzip2_compressor::finish(vuc_t& dest) {
+    run(view::byte_view(), BZ_FINISH, dest);
+
+    m_finished = true;
+}
+
+inline bool nuwen::stream::bzip2_compressor::finished() const {
+    return m_finished;
+}
+
+inline void nuwen::stream::bzip2_compressor::run(const view::byte_view v, const int action, vuc_t& dest) {
+    using namespace std;
+    using pham::bz2::MAX_PIECE_SIZE;
+
+    if (m_finished) {
+        throw logic_error("LOGIC ERROR: nuwen::stream::bzip2_compressor::run() - The stream is finished.");
+    }
+
+    pham::append_guard guard(dest);
+
+    bz_stream& z = m_s.m_stream;
+
+    const uc_t * p = v.data();
+    vuc_s_t left = v.size();
+
+    do {
+        const vuc_s_t piece = min(left, MAX_PIECE_SIZE);
+
+        z.next_in = reinterpret_cast<char *>(const_cast<uc_t *>(p));
+        z.avail_in = static_cast<unsigned int>(piece); // POISON_OK
+
+        const int a = piece == left ? action : BZ_RUN;
+
+        // BZ2_bzCompress() reports BZ_PARAM_ERROR when it has nothing to do.
+        while (a != BZ_RUN || z.avail_in != 0) {
+            const vuc_s_t used = dest.size();
+            const vuc_s_t n = pham::bz2::block_size(used - guard.original_size(), z.avail_in);
+
+            dest.resize(used + n);
+
+            z.next_out = reinterpret_cast<char *>(&dest[used]);
+            z.avail_out = static_cast<unsigned int>(n); // POISON_OK
+
+            const int error = BZ2_bzCompress(&z, a);
+
+            dest.resize(used + n - z.avail_out);
+
+            // Flushing and finishing are complete when BZ2_bzCompress() returns to running and ends the stream.
+            if ((error == BZ_RUN_OK && a == BZ_FLUSH) || (error == BZ_STREAM_END && a == BZ_FINISH)) {
+                break;
+            }
+
+            if (error != (a == BZ_RUN ? BZ_RUN_OK : a == BZ_FLUSH ? BZ_FLUSH_OK : BZ_FINISH_OK)) {
+                throw runtime_error("RUNTIME ERROR: nuwen::stream::bzip2_compressor::run() - BZ2_bzCompress() failed.");
+            }
+        }
+
+        p += piece;
+        left -= piece;
+    } while (left != 0);
+
+    guard.dismiss();
+}
+
+inline nuwen::stream::bzip2_decompressor::bzip2_decompressor()
+    : m_s(new pham::bz2::stream(view::byte_view())), m_finished(false) { }
+
+inline void nuwen::stream::bzip2_decompressor::decompress(const view::byte_view v, vuc_t& dest) {
+    using namespace std;
+    using pham::bz2::MAX_PIECE_SIZE;
+
+    pham::append_guard guard(dest);
+
+    const uc_t * p = v.data();
+    vuc_s_t left = v.size();
+
+    while (left != 0) {
+        // Another stream follows.
+        if (m_finished) {
+            m_s.reset(new pham::bz2::stream(view::byte_view()));
+            m_finished = false;
+        }
+
+        bz_stream& z = m_s->m_stream;
+
+        const vuc_s_t piece = min(left, MAX_PIECE_SIZE);
+
+        z.next_in = reinterpret_cast<char *>(const_cast<uc_t *>(p));
+        z.avail_in = static_cast<unsigned int>(piece); // POISON_OK
+
+        while (true) {
+            const vuc_s_t used = dest.size();
+            const vuc_s_t n = pham::bz2::block_size(used - guard.original_size(), z.avail_in);
+
+            dest.resize(used + n);
+
+            z.next_out = reinterpret_cast<char *>(&dest[used]);
+            z.avail_out = static_cast<unsigned int>(n); // POISON_OK
+
+            const int error = BZ2_bzDecompress(&z);
+
+            dest.resize(used + n - z.avail_out);
+
+            if (error == BZ_STREAM_END) {
+                m_finished = true;
+                break;
             }
 
-            dest += cat(temp);
-        } else if (error == BZ_STREAM_END) {
-            if (s.m_stream.avail_in != 0) {
-                throw std::runtime_error("RUNTIME ERROR: nuwen::unbzip2() - Some bytes were not consumed.");
+            if (error != BZ_OK) {
+                throw runtime_error("RUNTIME ERROR: nuwen::stream::bzip2_decompressor::decompress() - BZ2_bzDecompress() failed.");
             }
 
-            temp.resize(BLOCK_SIZE - s.m_stream.avail_out);
+            // With room left over, BZ2_bzDecompress() needs more input.
+            if (z.avail_in == 0 && z.avail_out != 0) {
+                break;
+            }
+        }
+
+        const vuc_s_t consumed = piece - z.avail_in;
+
+        p += consumed;
+        left -= consumed;
+    }
+
+    guard.dismiss();
+}
 
-            dest += cat(temp);
+inline bool nuwen::stream::bzip2_decompressor::finished() const {
+    return m_finished;
+}
+
+inline void nuwen::stream::bzip2_decompressor::finish() const {
+    if (!m_finished) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::stream::bzip2_decompressor::finish() - Compressed data ended prematurely.");
+    }
+}
+
+inline void nuwen::stream::bzip2_file(file::input_file& in, file::output_file& out, const vuc_s_t chunk_size) {
+    bzip2_compressor c;
 
-            return dest;
-        } else {
-            throw std::runtime_error("RUNTIME ERROR: nuwen::unbzip2() - BZ2_bzDecompress() failed.");
+    vuc_t dest;
+
+    while (true) {
+        const vuc_t v = in.read_at_most(chunk_size);
+
+        if (v.empty()) {
+            break;
+        }
+
+        dest.clear();
+
+        c.compress(v, dest);
+
+        if (!dest.empty()) {
+            out.write(dest);
+        }
+    }
+
+    dest.clear();
+
+    c.finish(dest);
+
+    out.write(dest);
+}
+
+inline void nuwen::stream::unbzip2_file(file::input_file& in, file::output_file& out, const vuc_s_t chunk_size) {
+    bzip2_decompressor d;
+
+    vuc_t dest;
+
+    while (true) {
+        const vuc_t v = in.read_at_most(chunk_size);
+
+        if (v.empty()) {
+            break;
+        }
+
+        dest.clear();
+
+        d.decompress(v, dest);
+
+        if (!dest.empty()) {
+            out.write(dest);
         }
     }
+
+    d.finish();
 }
 
 #endif // Idempotency
@@ -6,13 +6,16 @@
 #include "bzip2.hh"
 #include "clock.hh"
 #include "file.hh"
+#include "gluon.hh"
 #include "test.hh"
 #include "typedef.hh"
 #include "vector.hh"
 
 #include "external_begin.hh"
+    #include <algorithm>
     #include <iostream>
     #include <ostream>
+    #include <stdexcept>
     #include <string>
 #include "external_end.hh"
 
@@ -21,6 +24,9 @@ using namespace nuwen;
 using namespace nuwen::chrono;
 using namespace nuwen::file;
 
+const string TEST_FILE("foobar.tmp");
+const string TEST_FILE_2("foobar2.tmp");
+
 bool test_helper(const vuc_t& orig, const vuc_t& correct) {
     return bzip2(orig) == correct && unbzip2(correct) == orig;
 }
@@ -35,6 +41,180 @@ bool test_basic() {
             "0490802000220346210030B041E4B21F3F1772453850908E9A7706"));
 }
 
+bool test_into() {
+    const vuc_t orig = vuc_from_hex("48656C6C6F2C20776F726C6421");
+    const vuc_t prefix = vuc_from_hex("CAFE");
+
+    vuc_t compressed(prefix);
+    bzip2_into(orig, compressed);
+
+    vuc_t decompressed(prefix);
+    unbzip2_into(view::byte_view(compressed).sub(2, compressed.size() - 2), decompressed);
+
+    vuc_t failed(prefix);
+
+    try {
+        unbzip2_into(vuc_from_hex("425A6839"), failed);
+        return false;
+    } catch (const runtime_error&) { }
+
+    return compressed == vec(cat(prefix)(bzip2(orig))) && decompressed == vec(cat(prefix)(orig)) && failed == prefix;
+}
+
+bool test_expected(const vuc_t& orig) {
+    const vuc_t compressed = bzip2(orig);
+
+    const vuc_t exact = unbzip2(compressed, orig.size());
+
+    const vuc_t framed = bzip2_framed(orig);
+
+    vuc_t corrupted(framed);
+    ++corrupted[7];
+
+    try {
+        (void) unbzip2_framed(corrupted);
+        return false;
+    } catch (const runtime_error&) { }
+
+    return exact == orig && exact.capacity() <= orig.size() + 1
+        && unbzip2(compressed, orig.size() / 3) == orig
+        && unbzip2(compressed, orig.size() * 3) == orig
+        && unbzip2_framed(framed) == orig;
+}
+
+bool test_forged(const vuc_t& orig) {
+    const vuc_t compressed = bzip2(orig);
+
+    // A header claiming far more than the compressed data can hold must not be trusted for allocation.
+    vuc_t forged = vec(cat(vuc_from_ull(1073741824))(compressed));
+
+    try {
+        (void) unbzip2_framed(forged);
+        return false;
+    } catch (const runtime_error&) { }
+
+    forged = vec(cat(vuc_from_ull(orig.size() + 1))(compressed));
+
+    try {
+        (void) unbzip2_framed(forged);
+        return false;
+    } catch (const runtime_error&) { }
+
+    vuc_t dest;
+
+    unbzip2_into(compressed, dest, 1073741824);
+
+    return dest == orig && dest.capacity() < 268435456;
+}
+
+bool test_stream(const vuc_t& orig) {
+    stream::bzip2_compressor c;
+
+    vuc_t compressed;
+
+    for (vuc_s_t i = 0; i < orig.size(); i += 1000) {
+        c.compress(view::byte_view(orig).sub(i, min<vuc_s_t>(1000, orig.size() - i)), compressed);
+    }
+
+    c.finish(compressed);
+
+    stream::bzip2_compressor flushed;
+
+    vuc_t twice;
+
+    flushed.compress(orig, twice);
+    flushed.flush(twice);
+    flushed.compress(orig, twice);
+    flushed.finish(twice);
+
+    // Concatenated streams, fed in small pieces.
+    const vuc_t both = vec(cat(compressed)(compressed));
+
+    stream::bzip2_decompressor d;
+
+    vuc_t decompressed;
+
+    for (vuc_s_t i = 0; i < both.size(); i += 777) {
+        d.decompress(view::byte_view(both).sub(i, min<vuc_s_t>(777, both.size() - i)), decompressed);
+    }
+
+    d.finish();
+
+    return c.finished() && compressed == bzip2(orig)
+        && unbzip2(twice) == vec(cat(orig)(orig))
+        && decompressed == vec(cat(orig)(orig));
+}
+
+bool test_stream_errors() {
+    const vuc_t compressed = bzip2(vuc_from_hex("48656C6C6F2C20776F726C6421"));
+
+    stream::bzip2_decompressor d;
+
+    vuc_t decompressed;
+
+    d.decompress(view::byte_view(compressed).sub(0, compressed.size() - 1), decompressed);
+
+    bool premature = false;
+
+    try {
+        d.finish();
+    } catch (const runtime_error&) {
+        premature = true;
+    }
+
+    d.decompress(view::byte_view(compressed).sub(compressed.size() - 1, 1), decompressed);
+    d.finish();
+
+    try {
+        d.decompress(vuc_from_hex("CAFEBABE"), decompressed);
+        return false;
+    } catch (const runtime_error&) { }
+
+    stream::bzip2_compressor c;
+
+    vuc_t out;
+
+    c.finish(out);
+
+    try {
+        c.compress(compressed, out);
+        return false;
+    } catch (const logic_error&) { }
+
+    return premature && decompressed == vuc_from_hex("48656C6C6F2C20776F726C6421") && unbzip2(out).empty();
+}
+
+bool test_file(const vuc_t& orig) {
+    write_file(orig, TEST_FILE, overwrite);
+
+    {
+        input_file in(TEST_FILE);
+        output_file out(TEST_FILE_2, overwrite);
+
+        stream::bzip2_file(in, out, 10000);
+
+        out.close();
+    }
+
+    const vuc_t compressed = read_file(TEST_FILE_2);
+
+    {
+        input_file in(TEST_FILE_2);
+        output_file out(TEST_FILE, overwrite);
+
+        stream::unbzip2_file(in, out, 333);
+
+        out.close();
+    }
+
+    const vuc_t decompressed = read_file(TEST_FILE);
+
+    remove_file(TEST_FILE);
+    remove_file(TEST_FILE_2);
+
+    return compressed == bzip2(orig) && decompressed == orig;
+}
+
 bool test_extended(const string& filename) {
     const vuc_t orig = read_file(filename);
 
@@ -66,6 +246,12 @@ int main(int argc, char * argv[]) {
         NUWEN_TEST("bzip2-1", test_empty())
         NUWEN_TEST("bzip2-2", test_basic())
         NUWEN_TEST("bzip2-3", test_extended(argv[1]))
+        NUWEN_TEST("bzip2-4", test_into())
+        NUWEN_TEST("bzip2-5", test_expected(vuc_t(1, 'x')) && test_expected(read_file(argv[1])))
+        NUWEN_TEST("bzip2-6", test_stream(vuc_t()) && test_stream(read_file(argv[1])))
+        NUWEN_TEST("bzip2-7", test_stream_errors())
+        NUWEN_TEST("bzip2-8", test_file(read_file(argv[1])))
+        NUWEN_TEST("bzip2-9", test_forged(vuc_t(1, 'x')) && test_forged(vuc_t(1000, 'x')))
     } else {
         cout << "USAGE: bzip2_test <filename>" << endl;
     }
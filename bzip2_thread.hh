@@ -0,0 +1,340 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#ifndef PHAM_BZIP2_THREAD_HH
+#define PHAM_BZIP2_THREAD_HH
+
+#include "compiler.hh"
+
+#ifdef NUWEN_PLATFORM_MSVC
+    #pragma once
+#endif
+
+#include "bzip2.hh"
+#include "thread.hh"
+#include "typedef.hh"
+#include "vector.hh"
+
+#include "external_begin.hh"
+    #include <algorithm>
+    #include <exception>
+    #include <stdexcept>
+    #include <vector>
+#include "external_end.hh"
+
+// These require Boost.Thread. bzip2.hh alone doesn't.
+
+namespace nuwen {
+    // Splits v into chunks of chunk_size bytes, which are compressed concurrently on p. As with pbzip2,
+    // the result is the chunks' streams, concatenated. bunzip2 accepts this, and unbzip2() etc. do too.
+    inline vuc_t bzip2_parallel(view::byte_view v, thread::pool& p, vuc_s_t chunk_size = 900000);
+    inline void  bzip2_parallel_into(view::byte_view v, vuc_t& dest, thread::pool& p, vuc_s_t chunk_size = 900000);
+
+    // Finds every block of every stream in v, which are decompressed concurrently on p. This works
+    // for any bzip2 data, but only data with several blocks or streams is decompressed in parallel.
+    inline vuc_t unbzip2_parallel(view::byte_view v, thread::pool& p);
+    inline void  unbzip2_parallel_into(view::byte_view v, vuc_t& dest, thread::pool& p);
+}
+
+namespace pham {
+    namespace bz2 {
+        class chunk_compressor {
+        public:
+            chunk_compressor(const nuwen::view::byte_view v, nuwen::vuc_t& out) : m_v(v), m_out(&out) { }
+
+            void operator()() const {
+                nuwen::bzip2_into(m_v, *m_out);
+            }
+
+        private:
+            nuwen::view::byte_view m_v;
+            nuwen::vuc_t *         m_out;
+        };
+
+        // Each block begins with BLOCK_MAGIC and its CRC. After the last block, END_MAGIC is followed
+        // by the stream's combined CRC and padding to a byte boundary. Otherwise, nothing is byte-aligned.
+        const nuwen::ull_t BLOCK_MAGIC = 0x314159265359ULL;
+        const nuwen::ull_t END_MAGIC   = 0x177245385090ULL;
+
+        inline nuwen::ull_t read_bits(const nuwen::view::byte_view v, const nuwen::ull_t pos, const int count) {
+            nuwen::ull_t ret = 0;
+
+            for (nuwen::ull_t i = pos; i < pos + count; ++i) {
+                ret = ret << 1 | (v[static_cast<nuwen::vuc_s_t>(i / 8)] >> (7 - i % 8) & 1);
+            }
+
+            return ret;
+        }
+
+        inline void write_bits(nuwen::vuc_t& v, nuwen::ull_t& bits, const nuwen::ull_t value, const int count) {
+            for (int i = count - 1; i >= 0; --i) {
+                if (bits % 8 == 0) {
+                    v.push_back(0);
+                }
+
+                v.back() = static_cast<nuwen::uc_t>(v.back() | (value >> i & 1) << (7 - bits % 8));
+
+                ++bits;
+            }
+        }
+
+        // Returns the bit positions where BLOCK_MAGIC and END_MAGIC begin. Compressed data can contain
+        // them by coincidence, so find_blocks() and decompression check what they find.
+        inline nuwen::vull_t find_magics(const nuwen::view::byte_view v) {
+            using namespace nuwen;
+
+            const ull_t MASK = (1ULL << 48) - 1;
+
+            vull_t ret;
+
+            ull_t reg = 0;
+
+            for (vuc_s_t i = 0; i < v.size(); ++i) {
+                for (int k = 7; k >= 0; --k) {
+                    reg = (reg << 1 | (v[i] >> k & 1)) & MASK;
+
+                    const ull_t end = 8ULL * i + 8 - k;
+
+                    if ((reg == BLOCK_MAGIC || reg == END_MAGIC) && end >= 48) {
+                        ret.push_back(end - 48);
+                    }
+                }
+            }
+
+            return ret;
+        }
+
+        struct block {
+            nuwen::ull_t first; // The bit position of BLOCK_MAGIC.
+            nuwen::ull_t last;  // The bit position after the block.
+            nuwen::uc_t  level; // From the stream's header.
+        };
+
+        // Returns false if v isn't entirely made of streams whose combined CRCs match their blocks' CRCs.
+        inline bool find_blocks(const nuwen::view::byte_view v, std::vector<block>& blocks) {
+            using namespace nuwen;
+
+            const vull_t magics = find_magics(v);
+
+            vull_ci_t m = magics.begin();
+
+            vuc_s_t pos = 0;
+
+            while (pos < v.size()) {
+                if (!begins_stream(v.sub(pos, v.size() - pos))) {
+                    return false;
+                }
+
+                ull_t bit = 8ULL * (pos + 4);
+                ul_t combined = 0;
+
+                while (true) {
+                    while (m != magics.end() && *m < bit) {
+                        ++m;
+                    }
+
+                    if (m == magics.end() || *m != bit || bit + 80 > 8ULL * v.size()) {
+                        return false;
+                    }
+
+                    const ul_t crc = static_cast<ul_t>(read_bits(v, bit + 48, 32));
+
+                    if (read_bits(v, bit, 48) == END_MAGIC) {
+                        if (crc != combined) {
+                            return false;
+                        }
+
+                        pos = static_cast<vuc_s_t>((bit + 80 + 7) / 8);
+
+                        break;
+                    }
+
+                    if (++m == magics.end()) {
+                        return false;
+                    }
+
+                    const block b = { bit, *m, v[pos + 3] };
+
+                    blocks.push_back(b);
+
+                    combined = static_cast<ul_t>((combined << 1 | combined >> 31) ^ crc);
+
+                    bit = *m;
+                }
+            }
+
+            return true;
+        }
+
+        // A single block, as a complete stream whose combined CRC is the block's CRC.
+        inline nuwen::vuc_t wrap_block(const nuwen::view::byte_view v, const block& b) {
+            using namespace nuwen;
+
+            const vuc_s_t first = static_cast<vuc_s_t>(b.first / 8);
+            const int shift = static_cast<int>(b.first % 8);
+            const vuc_s_t n = static_cast<vuc_s_t>((b.last - b.first + 7) / 8);
+
+            vuc_t ret;
+
+            ret.reserve(n + 16);
+
+            ret.push_back('B');
+            ret.push_back('Z');
+            ret.push_back('h');
+            ret.push_back(b.level);
+
+            for (vuc_s_t i = first; i < first + n; ++i) {
+                const uc_t next = i + 1 < v.size() ? v[i + 1] : 0;
+
+                ret.push_back(static_cast<uc_t>(v[i] << shift | next >> (8 - shift)));
+            }
+
+            ull_t bits = 32 + b.last - b.first;
+
+            // Clear the bits after the block.
+            if (bits % 8 != 0) {
+                ret.back() = static_cast<uc_t>(ret.back() & 0xFF << (8 - bits % 8));
+            }
+
+            write_bits(ret, bits, END_MAGIC, 48);
+            write_bits(ret, bits, read_bits(v, b.first + 48, 32), 32);
+
+            return ret;
+        }
+
+        class block_decompressor {
+        public:
+            block_decompressor(const nuwen::view::byte_view v, const block& b, nuwen::vuc_t& out, char& failed)
+                : m_v(v), m_block(b), m_out(&out), m_failed(&failed) { }
+
+            // A failure is left for unbzip2_parallel_into() to diagnose.
+            void operator()() const {
+                try {
+                    const nuwen::vuc_t wrapped = wrap_block(m_v, m_block);
+
+                    if (decompress_stream(wrapped, *m_out, 0, 0) != wrapped.size()) {
+                        *m_failed = 1;
+                    }
+                } catch (const std::exception&) {
+                    *m_failed = 1;
+                }
+            }
+
+        private:
+            nuwen::view::byte_view m_v;
+            block                  m_block;
+            nuwen::vuc_t *         m_out;
+            char *                 m_failed;
+        };
+    }
+}
+
+inline nuwen::vuc_t nuwen::bzip2_parallel(const view::byte_view v, thread::pool& p, const vuc_s_t chunk_size) {
+    vuc_t dest;
+
+    bzip2_parallel_into(v, dest, p, chunk_size);
+
+    return dest;
+}
+
+inline void nuwen::bzip2_parallel_into(const view::byte_view v, vuc_t& dest, thread::pool& p, const vuc_s_t chunk_size) {
+    using namespace std;
+
+    // BZ2_bzBuffToBuffCompress() takes 32-bit lengths.
+    if (chunk_size == 0 || chunk_size > 1073741824) {
+        throw logic_error("LOGIC ERROR: nuwen::bzip2_parallel_into() - Invalid chunk_size.");
+    }
+
+    const vuc_s_t chunks = v.empty() ? 1 : (v.size() - 1) / chunk_size + 1;
+
+    vector<vuc_t> outs(chunks);
+
+    {
+        thread::task_group g(p);
+
+        for (vuc_s_t i = 0; i < chunks; ++i) {
+            const vuc_s_t begin = i * chunk_size;
+
+            g.run(pham::bz2::chunk_compressor(v.sub(begin, min(v.size() - begin, chunk_size)), outs[i]));
+        }
+
+        g.wait();
+    }
+
+    pham::append_guard guard(dest);
+
+    vuc_s_t total = 0;
+
+    for (vuc_s_t i = 0; i < chunks; ++i) {
+        total += outs[i].size();
+    }
+
+    dest.reserve(dest.size() + total);
+
+    for (vuc_s_t i = 0; i < chunks; ++i) {
+        dest.insert(dest.end(), outs[i].begin(), outs[i].end());
+    }
+
+    guard.dismiss();
+}
+
+inline nuwen::vuc_t nuwen::unbzip2_parallel(const view::byte_view v, thread::pool& p) {
+    vuc_t dest;
+
+    unbzip2_parallel_into(v, dest, p);
+
+    return dest;
+}
+
+inline void nuwen::unbzip2_parallel_into(const view::byte_view v, vuc_t& dest, thread::pool& p) {
+    using namespace std;
+    using pham::bz2::block;
+
+    if (v.empty()) {
+        throw logic_error("LOGIC ERROR: nuwen::unbzip2_parallel_into() - v is empty.");
+    }
+
+    vector<block> blocks;
+
+    if (pham::bz2::find_blocks(v, blocks) && blocks.size() > 1) {
+        vector<vuc_t> outs(blocks.size());
+        vector<char> failed(blocks.size(), 0);
+
+        {
+            thread::task_group g(p);
+
+            for (vuc_s_t i = 0; i < blocks.size(); ++i) {
+                g.run(pham::bz2::block_decompressor(v, blocks[i], outs[i], failed[i]));
+            }
+
+            g.wait();
+        }
+
+        if (find(failed.begin(), failed.end(), 1) == failed.end()) {
+            pham::append_guard guard(dest);
+
+            vuc_s_t total = 0;
+
+            for (vuc_s_t i = 0; i < blocks.size(); ++i) {
+                total += outs[i].size();
+            }
+
+            dest.reserve(dest.size() + total);
+
+            for (vuc_s_t i = 0; i < blocks.size(); ++i) {
+                dest.insert(dest.end(), outs[i].begin(), outs[i].end());
+            }
+
+            guard.dismiss();
+
+            return;
+        }
+    }
+
+    // Whatever went wrong, unbzip2_into() either recovers or reports it.
+    unbzip2_into(v, dest);
+}
+
+#endif // Idempotency
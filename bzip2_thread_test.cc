@@ -0,0 +1,73 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#include "bzip2.hh"
+#include "bzip2_thread.hh"
+#include "file.hh"
+#include "test.hh"
+#include "thread.hh"
+#include "typedef.hh"
+#include "vector.hh"
+
+#include "external_begin.hh"
+    #include <algorithm>
+    #include <iostream>
+    #include <ostream>
+    #include <stdexcept>
+#include "external_end.hh"
+
+using namespace std;
+using namespace nuwen;
+using namespace nuwen::file;
+
+bool test_parallel(const vuc_t& orig) {
+    thread::pool& p = thread::default_pool();
+
+    const vuc_t small(orig.begin(), orig.begin() + min<vuc_s_t>(orig.size(), 1000));
+
+    // Several streams, and then a single stream with several blocks.
+    const vuc_t streams = bzip2_parallel(orig, p, 50000);
+
+    vuc_t big;
+
+    for (int i = 0; i < 5; ++i) {
+        big.insert(big.end(), orig.begin(), orig.end());
+        big.push_back(static_cast<uc_t>(i));
+    }
+
+    const vuc_t blocks = bzip2(big);
+
+    vuc_t garbage(streams);
+    garbage.push_back(0);
+
+    vuc_t corrupted(streams);
+    corrupted[corrupted.size() / 2] ^= 0x10;
+
+    try {
+        (void) unbzip2_parallel(garbage, p);
+        return false;
+    } catch (const runtime_error&) { }
+
+    try {
+        (void) unbzip2_parallel(corrupted, p);
+        return false;
+    } catch (const runtime_error&) { }
+
+    return bzip2_parallel(vuc_t(), p) == bzip2(vuc_t())
+        && bzip2_parallel(small, p) == bzip2(small)
+        && unbzip2_parallel(bzip2(vuc_t()), p).empty()
+        && unbzip2_parallel(bzip2(small), p) == small
+        && unbzip2(streams) == orig
+        && unbzip2_parallel(streams, p) == orig
+        && unbzip2_parallel(blocks, p) == big;
+}
+
+int main(int argc, char * argv[]) {
+    if (argc == 2) {
+        NUWEN_TEST("bzip2_thread1", test_parallel(read_file(argv[1])))
+    } else {
+        cout << "USAGE: bzip2_thread_test <filename>" << endl;
+    }
+}
@@ -14,19 +14,34 @@
 
 #include "gluon.hh"
 #include "typedef.hh"
+#include "vector.hh"
 
 #include "external_begin.hh"
+    #include <cstddef>
     #include <cstdio>
+    #include <limits>
     #include <stdexcept>
     #include <string>
     #include <boost/format.hpp>
     #include <boost/shared_ptr.hpp>
     #include <boost/utility.hpp>
+
+    #ifdef NUWEN_PLATFORM_WINDOWS
+        #include <windows.h>
+    #endif
+
+    #ifdef NUWEN_PLATFORM_UNIX
+        #include <fcntl.h>
+        #include <sys/mman.h>
+        #include <sys/stat.h>
+        #include <unistd.h>
+    #endif
 #include "external_end.hh"
 
 namespace pham {
     namespace file {
         class proto_file;
+        class proto_mapping;
     }
 }
 
@@ -67,6 +82,21 @@ namespace nuwen {
         private:
             boost::shared_ptr<pham::file::proto_file> m_p;
         };
+
+        // Maps a whole file into memory, read-only, so it can be read without copying.
+        // bytes() is valid until close() is called or the last copy is destroyed.
+        // A file larger than vuc_s_t can describe, 4 GB or more where it's 32-bit, throws.
+        class mapped_file {
+        public:
+            inline explicit mapped_file(const std::string& filename);
+
+            inline view::byte_view bytes() const;
+
+            inline void close();
+
+        private:
+            boost::shared_ptr<pham::file::proto_mapping> m_p;
+        };
     }
 }
 
@@ -129,6 +159,148 @@ namespace pham {
             const string m_name;
         };
 
+        class proto_mapping : public boost::noncopyable {
+        public:
+            explicit proto_mapping(const string& s) : m_p(NULL), m_size(0), m_name(s), m_open(true) {
+                #ifdef NUWEN_PLATFORM_WINDOWS
+                    const HANDLE file = CreateFileA(m_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+                    if (file == INVALID_HANDLE_VALUE) {
+                        throw_file_error("pham::file::proto_mapping::proto_mapping()", "CreateFileA() failed.", m_name);
+                    }
+
+                    LARGE_INTEGER size;
+
+                    if (GetFileSizeEx(file, &size) == 0) {
+                        CloseHandle(file);
+                        throw_file_error("pham::file::proto_mapping::proto_mapping()", "GetFileSizeEx() failed.", m_name);
+                    }
+
+                    set_size(static_cast<nuwen::ull_t>(size.QuadPart), file);
+
+                    // Empty files can't be mapped.
+                    if (m_size > 0) {
+                        const HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+                        if (mapping == NULL) {
+                            CloseHandle(file);
+                            throw_file_error("pham::file::proto_mapping::proto_mapping()", "CreateFileMapping() failed.", m_name);
+                        }
+
+                        m_p = static_cast<const nuwen::uc_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+                        CloseHandle(mapping);
+
+                        if (m_p == NULL) {
+                            CloseHandle(file);
+                            throw_file_error("pham::file::proto_mapping::proto_mapping()", "MapViewOfFile() failed.", m_name);
+                        }
+                    }
+
+                    CloseHandle(file);
+                #endif
+
+                #ifdef NUWEN_PLATFORM_UNIX
+                    const int fd = open(m_name.c_str(), O_RDONLY);
+
+                    if (fd == -1) {
+                        throw_file_error("pham::file::proto_mapping::proto_mapping()", "open() failed.", m_name);
+                    }
+
+                    struct stat st;
+
+                    if (fstat(fd, &st) != 0) {
+                        ::close(fd);
+                        throw_file_error("pham::file::proto_mapping::proto_mapping()", "fstat() failed.", m_name);
+                    }
+
+                    set_size(static_cast<nuwen::ull_t>(st.st_size), fd);
+
+                    // Empty files can't be mapped.
+                    if (m_size > 0) {
+                        void * const p = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                        // Obnoxiously, MAP_FAILED is a macro that contains an old-style cast.
+                        if (p == reinterpret_cast<void *>(static_cast<ptrdiff_t>(-1))) {
+                            ::close(fd);
+                            throw_file_error("pham::file::proto_mapping::proto_mapping()", "mmap() failed.", m_name);
+                        }
+
+                        m_p = static_cast<const nuwen::uc_t *>(p);
+                    }
+
+                    ::close(fd);
+                #endif
+            }
+
+            void close() {
+                if (!m_open) {
+                    throw_file_logic_error("pham::file::proto_mapping::close()", "Called twice.", m_name);
+                }
+
+                m_open = false;
+
+                if (!unmap()) {
+                    throw_file_error("pham::file::proto_mapping::close()", "Unmapping failed.", m_name);
+                }
+            }
+
+            ~proto_mapping() {
+                if (m_open) {
+                    unmap(); // Ignore errors.
+                }
+            }
+
+            nuwen::view::byte_view bytes() const {
+                if (!m_open) {
+                    throw_file_logic_error("pham::file::proto_mapping::bytes()", "File already closed.", m_name);
+                }
+
+                return nuwen::view::byte_view(m_p, m_size);
+            }
+
+        private:
+            template <typename Handle> void set_size(const nuwen::ull_t size, const Handle h) {
+                if (size > numeric_limits<nuwen::vuc_s_t>::max()) {
+                    #ifdef NUWEN_PLATFORM_WINDOWS
+                        CloseHandle(h);
+                    #endif
+
+                    #ifdef NUWEN_PLATFORM_UNIX
+                        ::close(h);
+                    #endif
+
+                    throw_file_error("pham::file::proto_mapping::proto_mapping()", "File too large to map.", m_name);
+                }
+
+                m_size = static_cast<nuwen::vuc_s_t>(size);
+            }
+
+            bool unmap() {
+                if (m_p == NULL) {
+                    return true;
+                }
+
+                const nuwen::uc_t * const p = m_p;
+
+                m_p = NULL;
+
+                #ifdef NUWEN_PLATFORM_WINDOWS
+                    return UnmapViewOfFile(p) != 0;
+                #endif
+
+                #ifdef NUWEN_PLATFORM_UNIX
+                    return munmap(const_cast<nuwen::uc_t *>(p), m_size) == 0;
+                #endif
+            }
+
+            const nuwen::uc_t * m_p;
+            nuwen::vuc_s_t      m_size;
+            const string        m_name;
+            bool                m_open;
+        };
+
         inline FILE * open_read_file(const string& filename) {
             FILE * const r = fopen(filename.c_str(), "rb");
 
@@ -261,4 +433,15 @@ inline void nuwen::file::output_file::close() {
     m_p->close();
 }
 
+inline nuwen::file::mapped_file::mapped_file(const std::string& filename)
+    : m_p(new pham::file::proto_mapping(filename)) { }
+
+inline nuwen::view::byte_view nuwen::file::mapped_file::bytes() const {
+    return m_p->bytes();
+}
+
+inline void nuwen::file::mapped_file::close() {
+    m_p->close();
+}
+
 #endif // Idempotency
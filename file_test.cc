@@ -12,6 +12,7 @@
 #include "external_begin.hh"
     #include <iostream>
     #include <ostream>
+    #include <stdexcept>
     #include <string>
 #include "external_end.hh"
 
@@ -101,6 +102,38 @@ bool test_speed(const string& filename) {
     return v == v2;
 }
 
+bool test_mapped() {
+    const vuc_t v(100000, 71);
+
+    write_file(v, TEST_FILE, overwrite);
+
+    mapped_file m(TEST_FILE);
+
+    const mapped_file copy(m);
+
+    const bool ret = m.bytes().vuc() == v && copy.bytes().size() == v.size();
+
+    m.close();
+
+    try {
+        (void) copy.bytes();
+        return false;
+    } catch (const logic_error&) { }
+
+    write_file(vuc_t(), TEST_FILE, overwrite);
+
+    const bool empty = mapped_file(TEST_FILE).bytes().empty();
+
+    remove_file(TEST_FILE);
+
+    try {
+        mapped_file missing(TEST_FILE);
+        return false;
+    } catch (const runtime_error&) { }
+
+    return ret && empty;
+}
+
 int main(int argc, char * argv[]) {
     NUWEN_TEST("file1", test_create())
     NUWEN_TEST("file2", test_overwrite())
@@ -111,4 +144,6 @@ int main(int argc, char * argv[]) {
     if (argc == 2) {
         NUWEN_TEST("file6", test_speed(argv[1]))
     }
+
+    NUWEN_TEST("file7", test_mapped())
 }
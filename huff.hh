@@ -18,7 +18,6 @@
     #include "clock.hh"
 #endif
 
-#include "gluon.hh"
 #include "typedef.hh"
 #include "vector.hh"
 
@@ -34,6 +33,13 @@
 namespace nuwen {
     inline vuc_t huff(const vuc_t& v);
     inline vuc_t puff(const vuc_t& v);
+
+    inline vuc_t huff(view::byte_view v);
+    inline vuc_t puff(view::byte_view v);
+
+    // These append to dest. v must not alias dest. If an exception is thrown, dest is left unchanged.
+    inline void huff_into(view::byte_view v, vuc_t& dest);
+    inline void puff_into(view::byte_view v, vuc_t& dest);
 }
 
 namespace pham {
@@ -90,10 +96,10 @@ namespace pham {
         };
 
 
-        inline vfreq_t frequencies(const nuwen::vuc_t& v) {
+        inline vfreq_t frequencies(const nuwen::view::byte_view v) {
             vfreq_t freqs(256, 0);
 
-            for (nuwen::vuc_ci_t i = v.begin(); i != v.end(); ++i) {
+            for (nuwen::view::byte_view::const_iterator i = v.begin(); i != v.end(); ++i) {
                 ++freqs[*i];
             }
 
@@ -221,7 +227,7 @@ namespace pham {
         }
 
 
-        inline nuwen::vuc_t huff_bits(const nuwen::vuc_t& v) {
+        inline nuwen::vuc_t huff_bits(const nuwen::view::byte_view v) {
             using namespace nuwen;
 
             const vfreq_t freqs       = frequencies(v);
@@ -230,7 +236,7 @@ namespace pham {
 
             pack::packed_bits encoded;
 
-            for (vuc_ci_t i = v.begin(); i != v.end(); ++i) {
+            for (view::byte_view::const_iterator i = v.begin(); i != v.end(); ++i) {
                 const uc_t byte   = *i;
                 const uc_t code   = codes[byte];
                       uc_t length = codelengths[byte];
@@ -246,10 +252,14 @@ namespace pham {
                 }
             }
 
-            return vec(cat(codelengths)(encoded.vuc()));
+            vuc_t ret(codelengths);
+
+            encoded.vuc_into(ret);
+
+            return ret;
         }
 
-        inline nuwen::vuc_t puff_bits(const nuwen::vuc_t& v) {
+        inline void puff_bits_into(const nuwen::view::byte_view v, nuwen::vuc_t& decompressed) {
             using namespace nuwen;
 
             const vuc_t codelengths(v.begin(), v.begin() + 256);
@@ -257,8 +267,6 @@ namespace pham {
 
             const byte_decoder decoder(codelengths, codes);
 
-            vuc_t decompressed;
-
             uc_t mrs8b = 0; // Most Recently Seen 8 Bits
             uc_t nbs   = 0; // Number Of Bits Seen
 
@@ -275,8 +283,22 @@ namespace pham {
                     nbs = 0;
                 }
             }
+        }
+
+        inline nuwen::vuc_t puff_bits(const nuwen::view::byte_view v) {
+            nuwen::vuc_t ret;
+
+            puff_bits_into(v, ret);
 
-            return decompressed;
+            return ret;
+        }
+
+        inline nuwen::vuc_t huff_bits(const nuwen::vuc_t& v) {
+            return huff_bits(nuwen::view::byte_view(v));
+        }
+
+        inline nuwen::vuc_t puff_bits(const nuwen::vuc_t& v) {
+            return puff_bits(nuwen::view::byte_view(v));
         }
 
 
@@ -329,7 +351,7 @@ namespace pham {
                 }
             }
 
-            void operator()(nuwen::vuc_ci_t byte, const nuwen::vuc_ci_t end) {
+            void operator()(const nuwen::uc_t * byte, const nuwen::uc_t * const end) {
                 for (; byte != end; ++byte) {
                     const entry * const p = &m_table[*byte][m_numbits];
                     m_numbits = p->new_numbits;
@@ -371,7 +393,7 @@ namespace pham {
             // These upper bounds are nice to know, but aren't actually helpful.
         };
 
-        inline nuwen::vuc_t huff_auto(const nuwen::vuc_t& v
+        inline void huff_auto_into(const nuwen::view::byte_view v, nuwen::vuc_t& dest
             #ifdef PHAM_AUTOMATON_TIMING
                 , double * const ctor_time = NULL
             #endif
@@ -384,15 +406,17 @@ namespace pham {
 
             const ull_t bits = std::inner_product(freqs.begin(), freqs.end(), codelengths.begin(), static_cast<ull_t>(0));
 
-            vuc_t ret(static_cast<vuc_s_t>(256 + bytes_from_bits(bits)), 0);
+            const vuc_s_t used = dest.size();
 
-            std::copy(codelengths.begin(), codelengths.end(), ret.begin());
+            dest.resize(used + static_cast<vuc_s_t>(256 + bytes_from_bits(bits)), 0);
+
+            std::copy(codelengths.begin(), codelengths.end(), dest.begin() + used);
 
             #ifdef PHAM_AUTOMATON_TIMING
                 const nuwen::chrono::watch w;
             #endif
 
-            huff_automaton automaton(codelengths, codes, ret.begin() + 256);
+            huff_automaton automaton(codelengths, codes, dest.begin() + used + 256);
 
             #ifdef PHAM_AUTOMATON_TIMING
                 if (ctor_time) {
@@ -401,6 +425,20 @@ namespace pham {
             #endif
 
             automaton(v.begin(), v.end());
+        }
+
+        inline nuwen::vuc_t huff_auto(const nuwen::view::byte_view v
+            #ifdef PHAM_AUTOMATON_TIMING
+                , double * const ctor_time = NULL
+            #endif
+        ) {
+            nuwen::vuc_t ret;
+
+            huff_auto_into(v, ret
+                #ifdef PHAM_AUTOMATON_TIMING
+                    , ctor_time
+                #endif
+            );
 
             return ret;
         }
@@ -541,7 +579,7 @@ namespace pham {
                 }
             }
 
-            void operator()(nuwen::vuc_ci_t byte, const nuwen::vuc_ci_t end) {
+            void operator()(const nuwen::uc_t * byte, const nuwen::uc_t * const end) {
                 for (; byte != end; ++byte) {
                     const entry * const p = &m_main_table[m_curr_node][*byte];
                     m_curr_node = p->dest_node;
@@ -565,7 +603,7 @@ namespace pham {
             }
         };
 
-        inline nuwen::vuc_t puff_auto(const nuwen::vuc_t& v
+        inline void puff_auto_into(const nuwen::view::byte_view v, nuwen::vuc_t& dest
             #ifdef PHAM_AUTOMATON_TIMING
                 , double * const ctor_time = NULL
             #endif
@@ -573,15 +611,13 @@ namespace pham {
             const nuwen::vuc_t codelengths(v.begin(), v.begin() + 256);
             const nuwen::vuc_t codes = make_codes(codelengths);
 
-            nuwen::vuc_t ret;
-
-            ret.reserve(v.size() * 2); // A reasonable heuristic.
+            dest.reserve(dest.size() + v.size() * 2); // A reasonable heuristic.
 
             #ifdef PHAM_AUTOMATON_TIMING
                 const nuwen::chrono::watch w;
             #endif
 
-            puff_automaton automaton(codelengths, codes, ret);
+            puff_automaton automaton(codelengths, codes, dest);
 
             #ifdef PHAM_AUTOMATON_TIMING
                 if (ctor_time) {
@@ -590,6 +626,20 @@ namespace pham {
             #endif
 
             automaton(v.begin() + 256, v.end());
+        }
+
+        inline nuwen::vuc_t puff_auto(const nuwen::view::byte_view v
+            #ifdef PHAM_AUTOMATON_TIMING
+                , double * const ctor_time = NULL
+            #endif
+        ) {
+            nuwen::vuc_t ret;
+
+            puff_auto_into(v, ret
+                #ifdef PHAM_AUTOMATON_TIMING
+                    , ctor_time
+                #endif
+            );
 
             return ret;
         }
@@ -597,17 +647,53 @@ namespace pham {
 }
 
 inline nuwen::vuc_t nuwen::huff(const vuc_t& v) {
-    // huff_automaton construction is so fast, we may as well always use it.
-    return pham::huff::huff_auto(v);
+    return huff(view::byte_view(v));
 }
 
 inline nuwen::vuc_t nuwen::puff(const vuc_t& v) {
+    return puff(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::huff(const view::byte_view v) {
+    vuc_t ret;
+
+    huff_into(v, ret);
+
+    return ret;
+}
+
+inline nuwen::vuc_t nuwen::puff(const view::byte_view v) {
+    vuc_t ret;
+
+    puff_into(v, ret);
+
+    return ret;
+}
+
+inline void nuwen::huff_into(const view::byte_view v, vuc_t& dest) {
+    pham::append_guard guard(dest);
+
+    // huff_automaton construction is so fast, we may as well always use it.
+    pham::huff::huff_auto_into(v, dest);
+
+    guard.dismiss();
+}
+
+inline void nuwen::puff_into(const view::byte_view v, vuc_t& dest) {
     if (v.size() < 256) {
-        throw std::runtime_error("RUNTIME ERROR: nuwen::puff() - Insufficient data to decompress.");
+        throw std::runtime_error("RUNTIME ERROR: nuwen::puff_into() - Insufficient data to decompress.");
     }
 
+    pham::append_guard guard(dest);
+
     // For compressed data smaller than 6 KB, bitwise decompression is faster.
-    return v.size() < 6144 ? pham::huff::puff_bits(v) : pham::huff::puff_auto(v);
+    if (v.size() < 6144) {
+        pham::huff::puff_bits_into(v, dest);
+    } else {
+        pham::huff::puff_auto_into(v, dest);
+    }
+
+    guard.dismiss();
 }
 
 #endif // Idempotency
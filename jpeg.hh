@@ -13,18 +13,157 @@
 #endif
 
 #include "typedef.hh"
+#include "vector.hh"
 
 #include "external_begin.hh"
+    #include <csetjmp>
     #include <stdexcept>
+    #include <vector>
     #include <boost/format.hpp>
+    #include <boost/function.hpp>
     #include <boost/tuple/tuple.hpp>
     #include <boost/utility.hpp>
     #include <jerror.h>
     #include <jpeglib.h>
 #include "external_end.hh"
 
+// libjpeg-turbo 1.5 added jpeg_crop_scanline() and jpeg_skip_scanlines().
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+    #define PHAM_JPEG_CROP
+#endif
+
+namespace pham {
+    namespace jpeg {
+        // pham::error_exit() saves libjpeg's message here, then longjmp()s to m_jump.
+        struct error_manager : public jpeg_error_mgr {
+            std::jmp_buf m_jump;
+            char         m_message[JMSG_LENGTH_MAX];
+        };
+    }
+}
+
 namespace nuwen {
     inline boost::tuple<ul_t, ul_t, vuc_t> decompress_jpeg_insecurely(const vuc_t& input, ul_t max_width = 2048, ul_t max_height = 2048);
+
+    // Decodes at 1/2, 1/4, or 1/8 scale when that's still at least target_width by target_height,
+    // picking the smallest such scale. libjpeg then skips most of the IDCT and color conversion work.
+    // The returned width and height are the scaled size. max_width and max_height limit the unscaled size.
+    inline boost::tuple<ul_t, ul_t, vuc_t> decompress_jpeg_scaled_insecurely(const vuc_t& input,
+        ul_t target_width, ul_t target_height, ul_t max_width = 2048, ul_t max_height = 2048);
+
+    // Columns [x, x + width) and rows [y, y + height) of an image.
+    // A width or height of 0 extends the region to the image's edge.
+    struct jpeg_region {
+        inline explicit jpeg_region(ul_t x_ = 0, ul_t y_ = 0, ul_t width_ = 0, ul_t height_ = 0);
+
+        ul_t x;
+        ul_t y;
+        ul_t width;
+        ul_t height;
+    };
+
+    // Given the first row and the number of rows, relative to the region, as soon as they've been decoded.
+    typedef boost::function<void (ul_t, ul_t)> jpeg_rows_callback;
+
+    // Decodes region into dest, with its row r at dest + r * stride, and returns the region's width and height.
+    // size is the number of bytes at dest, which is checked before decoding. With libjpeg-turbo 1.5 or later,
+    // rows outside the region are skipped, and columns outside it are mostly skipped.
+    inline boost::tuple<ul_t, ul_t> decompress_jpeg_into_insecurely(const vuc_t& input, uc_t * dest, vuc_s_t size,
+        vuc_s_t stride, const jpeg_region& region = jpeg_region(), const jpeg_rows_callback& callback = jpeg_rows_callback(),
+        ul_t max_width = 2048, ul_t max_height = 2048);
+
+    struct jpeg_info {
+        ul_t width;
+        ul_t height;
+        ul_t components;
+        bool progressive;
+
+        // The sizes that decoding at 1/1, 1/2, 1/4, and 1/8 scale produces.
+        ul_t scaled_widths[4];
+        ul_t scaled_heights[4];
+    };
+
+    // Reads only the headers, so it costs microseconds regardless of the image's size.
+    // max_width and max_height aren't enforced, and any number of components is accepted.
+    inline jpeg_info probe_jpeg_insecurely(const vuc_t& input);
+
+    // Keeps its libjpeg decompressor between images, instead of creating and destroying one for each.
+    // A decoder isn't thread-safe. thread_jpeg_decoder() in jpeg_thread.hh provides one per thread.
+    class jpeg_decoder : public boost::noncopyable {
+    public:
+        inline jpeg_decoder();
+        inline ~jpeg_decoder();
+
+        // These behave like decompress_jpeg_insecurely() and decompress_jpeg_scaled_insecurely().
+        inline boost::tuple<ul_t, ul_t, vuc_t> decompress_insecurely(const vuc_t& input,
+            ul_t max_width = 2048, ul_t max_height = 2048);
+
+        inline boost::tuple<ul_t, ul_t, vuc_t> decompress_scaled_insecurely(const vuc_t& input,
+            ul_t target_width, ul_t target_height, ul_t max_width = 2048, ul_t max_height = 2048);
+
+        inline jpeg_info probe_insecurely(const vuc_t& input);
+
+        // This behaves like decompress_jpeg_into_insecurely().
+        inline boost::tuple<ul_t, ul_t> decompress_into_insecurely(const vuc_t& input, uc_t * dest, vuc_s_t size,
+            vuc_s_t stride, const jpeg_region& region = jpeg_region(), const jpeg_rows_callback& callback = jpeg_rows_callback(),
+            ul_t max_width = 2048, ul_t max_height = 2048);
+
+    private:
+        // A target of 0 by 0 requests the full size.
+        inline boost::tuple<ul_t, ul_t, vuc_t> decompress(const vuc_t& input,
+            ul_t max_width, ul_t max_height, ul_t target_width, ul_t target_height);
+
+        // Points the source manager at input, then reads and checks the header.
+        inline void read_header(const vuc_t& input, ul_t max_width, ul_t max_height);
+
+        inline void start_reading(const vuc_t& input);
+
+        inline void check_warnings() const;
+
+        pham::jpeg::error_manager m_error_manager;
+        jpeg_decompress_struct    m_decompressor;
+        jpeg_source_mgr           m_source_manager;
+        vc_t                      m_warning_message;
+        vuc_t                     m_rows; // Scanlines that are wider than the region.
+    };
+
+    enum jpeg_dct_method {
+        accurate_dct, // libjpeg's JDCT_ISLOW.
+        fast_dct      // libjpeg's JDCT_IFAST, which is less accurate at high quality.
+    };
+
+    // Compresses width by height RGB pixels, beginning at pixels, with rows stride bytes apart.
+    // quality is from 0 to 100. Optimized Huffman tables are smaller, but take an extra pass to build.
+    // compress_jpeg_into() appends to dest. If it throws, dest is left unchanged.
+    inline void compress_jpeg_into(const uc_t * pixels, ul_t width, ul_t height, vuc_s_t stride, vuc_t& dest,
+        int quality = 75, jpeg_dct_method dct = accurate_dct, bool optimize_huffman = false);
+
+    // Compresses the width, height, and pixels returned by decompress_jpeg_insecurely() etc.
+    inline vuc_t compress_jpeg(const boost::tuple<ul_t, ul_t, vuc_t>& image,
+        int quality = 75, jpeg_dct_method dct = accurate_dct, bool optimize_huffman = false);
+
+    // Keeps its libjpeg compressor between images, like jpeg_decoder.
+    class jpeg_encoder : public boost::noncopyable {
+    public:
+        inline jpeg_encoder();
+        inline ~jpeg_encoder();
+
+        // These behave like compress_jpeg_into() and compress_jpeg().
+        inline void compress_into(const uc_t * pixels, ul_t width, ul_t height, vuc_s_t stride, vuc_t& dest,
+            int quality = 75, jpeg_dct_method dct = accurate_dct, bool optimize_huffman = false);
+
+        inline vuc_t compress(const boost::tuple<ul_t, ul_t, vuc_t>& image,
+            int quality = 75, jpeg_dct_method dct = accurate_dct, bool optimize_huffman = false);
+
+    private:
+        inline void set_defaults();
+
+        pham::jpeg::error_manager m_error_manager;
+        jpeg_compress_struct      m_compressor;
+        vc_t                      m_warning_message;
+        JHUFF_TBL                 m_dc_tables[NUM_HUFF_TBLS];
+        JHUFF_TBL                 m_ac_tables[NUM_HUFF_TBLS];
+    };
 }
 
 namespace pham {
@@ -35,6 +174,16 @@ namespace pham {
         }
     }
 
+    // libjpeg's default error_exit() calls exit(), and exceptions mustn't unwind through libjpeg's C frames.
+    // This saves the message and longjmp()s back to one of the pham::jpeg trampolines, which returns false.
+    inline void error_exit(jpeg_common_struct * const p) {
+        jpeg::error_manager& e = *static_cast<jpeg::error_manager *>(p->err);
+
+        e.format_message(p, e.m_message);
+
+        std::longjmp(e.m_jump, 1);
+    }
+
     inline void do_nothing(jpeg_decompress_struct *) { }
 
     const nuwen::uc_t fake_eoi_marker[] = { 0xFF, JPEG_EOI };
@@ -63,105 +212,727 @@ namespace pham {
     }
 
     namespace jpeg {
-        class decompressor_destroyer : public boost::noncopyable {
+        // Returns a decompressor to its idle state, even if decoding was interrupted.
+        class decompressor_aborter : public boost::noncopyable {
         public:
-            explicit decompressor_destroyer(jpeg_decompress_struct& d) : m_p(&d) { }
+            explicit decompressor_aborter(jpeg_decompress_struct& d) : m_p(&d) { }
 
-            ~decompressor_destroyer() {
-                jpeg_destroy_decompress(m_p);
+            ~decompressor_aborter() {
+                jpeg_abort_decompress(m_p);
             }
 
         private:
             jpeg_decompress_struct * const m_p;
         };
+
+        class compressor_aborter : public boost::noncopyable {
+        public:
+            explicit compressor_aborter(jpeg_compress_struct& c) : m_p(&c) { }
+
+            ~compressor_aborter() {
+                jpeg_abort_compress(m_p);
+            }
+
+        private:
+            jpeg_compress_struct * const m_p;
+        };
+
+        // Compressed data goes directly into a vuc_t, which grows as libjpeg fills it.
+        struct destination : public jpeg_destination_mgr {
+            nuwen::vuc_t * m_dest;
+        };
+
+        // Exceptions mustn't escape into libjpeg, so a failure to grow the vuc_t becomes a libjpeg error.
+        inline bool grow(jpeg_compress_struct * const p, nuwen::vuc_t& v, const nuwen::vuc_s_t n) {
+            bool ok = true;
+
+            try {
+                v.resize(n);
+            } catch (...) {
+                ok = false;
+            }
+
+            if (!ok) {
+                // Obnoxiously, ERREXIT1 is a macro that contains an old-style cast.
+                p->err->msg_code = JERR_OUT_OF_MEMORY;
+                p->err->msg_parm.i[0] = 0;
+                p->err->error_exit(reinterpret_cast<jpeg_common_struct *>(p));
+            }
+
+            return ok;
+        }
+
+        inline void init_destination(jpeg_compress_struct * const p) {
+            destination& d = *static_cast<destination *>(p->dest);
+
+            const nuwen::vuc_s_t used = d.m_dest->size();
+            const nuwen::vuc_s_t n = 4096 + static_cast<nuwen::vuc_s_t>(p->image_width) * p->image_height / 4;
+
+            grow(p, *d.m_dest, used + n);
+
+            d.next_output_byte = &(*d.m_dest)[used];
+            d.free_in_buffer = n;
+        }
+
+        // libjpeg considers the whole buffer full when this is called.
+        inline JPEG_boolean empty_output_buffer(jpeg_compress_struct * const p) {
+            destination& d = *static_cast<destination *>(p->dest);
+
+            const nuwen::vuc_s_t used = d.m_dest->size();
+
+            grow(p, *d.m_dest, 2 * used);
+
+            d.next_output_byte = &(*d.m_dest)[used];
+            d.free_in_buffer = used;
+
+            return JPEG_TRUE;
+        }
+
+        inline void term_destination(jpeg_compress_struct * const p) {
+            destination& d = *static_cast<destination *>(p->dest);
+
+            d.m_dest->resize(d.m_dest->size() - d.free_in_buffer);
+        }
+
+        // Returns the largest denominator whose scaled size is at least target_width by target_height.
+        inline unsigned int scale_denom(const nuwen::ul_t width, const nuwen::ul_t height, // POISON_OK
+            const nuwen::ul_t target_width, const nuwen::ul_t target_height) {
+
+            for (unsigned int denom = 8; denom > 1; denom /= 2) { // POISON_OK
+                // libjpeg rounds scaled sizes up.
+                if ((width + denom - 1) / denom >= target_width && (height + denom - 1) / denom >= target_height) {
+                    return denom;
+                }
+            }
+
+            return 1;
+        }
+
+        // decompress_into_insecurely() reads this many rows between callbacks.
+        const nuwen::ul_t BATCH_ROWS = 16;
+
+        template <typename T> std::jmp_buf& jump_buffer(T * const p) {
+            return static_cast<error_manager *>(p->err)->m_jump;
+        }
+
+        // These trampolines are the only callers of libjpeg functions that can fail. error_exit() may longjmp()
+        // out of libjpeg back to their setjmp(), so no object with a destructor lives in them.
+        // They return false when libjpeg fails, and check() then throws its message from ordinary C++ code.
+        inline bool try_create_decompress(jpeg_decompress_struct * const p) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            // Obnoxiously, jpeg_create_decompress is a macro that contains an old-style cast.
+            jpeg_CreateDecompress(p, JPEG_LIB_VERSION, sizeof *p);
+            return true;
+        }
+
+        inline bool try_read_header(jpeg_decompress_struct * const p) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            jpeg_read_header(p, JPEG_TRUE);
+            return true;
+        }
+
+        inline bool try_calc_output_dimensions(jpeg_decompress_struct * const p) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            jpeg_calc_output_dimensions(p);
+            return true;
+        }
+
+        inline bool try_start_decompress(jpeg_decompress_struct * const p) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            jpeg_start_decompress(p);
+            return true;
+        }
+
+#ifdef PHAM_JPEG_CROP
+        inline bool try_crop_scanline(jpeg_decompress_struct * const p, JDIMENSION& first_column, JDIMENSION& columns) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            jpeg_crop_scanline(p, &first_column, &columns);
+            return true;
+        }
+
+        inline bool try_skip_scanlines(jpeg_decompress_struct * const p, const JDIMENSION n, JDIMENSION& skipped) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            skipped = jpeg_skip_scanlines(p, n);
+            return true;
+        }
+#endif
+
+        inline bool try_read_scanlines(jpeg_decompress_struct * const p, JSAMPARRAY rows, const JDIMENSION n, JDIMENSION& read) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            read = jpeg_read_scanlines(p, rows, n);
+            return true;
+        }
+
+        inline bool try_finish_decompress(jpeg_decompress_struct * const p) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            jpeg_finish_decompress(p);
+            return true;
+        }
+
+        inline bool try_create_compress(jpeg_compress_struct * const p) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            // Obnoxiously, jpeg_create_compress is a macro that contains an old-style cast.
+            jpeg_CreateCompress(p, JPEG_LIB_VERSION, sizeof *p);
+            return true;
+        }
+
+        inline bool try_set_defaults(jpeg_compress_struct * const p) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            jpeg_set_defaults(p);
+            return true;
+        }
+
+        inline bool try_set_quality(jpeg_compress_struct * const p, const int quality) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            jpeg_set_quality(p, quality, JPEG_TRUE);
+            return true;
+        }
+
+        inline bool try_start_compress(jpeg_compress_struct * const p) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            jpeg_start_compress(p, JPEG_TRUE);
+            return true;
+        }
+
+        inline bool try_write_scanlines(jpeg_compress_struct * const p, JSAMPARRAY rows, const JDIMENSION n, JDIMENSION& written) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            written = jpeg_write_scanlines(p, rows, n);
+            return true;
+        }
+
+        inline bool try_finish_compress(jpeg_compress_struct * const p) {
+            if (setjmp(jump_buffer(p))) {
+                return false;
+            }
+
+            jpeg_finish_compress(p);
+            return true;
+        }
+
+        inline void check(const bool ok, const error_manager& e) {
+            if (!ok) {
+                throw std::runtime_error(str(boost::format(
+                    "RUNTIME ERROR: pham::jpeg::check() - libjpeg failed \"%1%\".") % e.m_message));
+            }
+        }
     }
 }
 
 inline boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t> nuwen::decompress_jpeg_insecurely(
     const vuc_t& input, const ul_t max_width, const ul_t max_height) {
 
+    jpeg_decoder d;
+
+    return d.decompress_insecurely(input, max_width, max_height);
+}
+
+inline boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t> nuwen::decompress_jpeg_scaled_insecurely(const vuc_t& input,
+    const ul_t target_width, const ul_t target_height, const ul_t max_width, const ul_t max_height) {
+
+    jpeg_decoder d;
+
+    return d.decompress_scaled_insecurely(input, target_width, target_height, max_width, max_height);
+}
+
+inline boost::tuple<nuwen::ul_t, nuwen::ul_t> nuwen::decompress_jpeg_into_insecurely(const vuc_t& input,
+    uc_t * const dest, const vuc_s_t size, const vuc_s_t stride, const jpeg_region& region,
+    const jpeg_rows_callback& callback, const ul_t max_width, const ul_t max_height) {
+
+    jpeg_decoder d;
+
+    return d.decompress_into_insecurely(input, dest, size, stride, region, callback, max_width, max_height);
+}
+
+inline nuwen::jpeg_info nuwen::probe_jpeg_insecurely(const vuc_t& input) {
+    jpeg_decoder d;
+
+    return d.probe_insecurely(input);
+}
+
+inline nuwen::jpeg_region::jpeg_region(const ul_t x_, const ul_t y_, const ul_t width_, const ul_t height_)
+    : x(x_), y(y_), width(width_), height(height_) { }
+
+inline nuwen::jpeg_decoder::jpeg_decoder() : m_warning_message(JMSG_LENGTH_MAX, 0), m_rows() {
+    using namespace pham;
+
+    m_decompressor.err = jpeg_std_error(&m_error_manager);
+    m_decompressor.err->error_exit = error_exit;
+    m_decompressor.err->output_message = output_message;
+
+    jpeg::check(jpeg::try_create_decompress(&m_decompressor), m_error_manager);
+
+    m_source_manager.next_input_byte   = NULL;
+    m_source_manager.bytes_in_buffer   = 0;
+    m_source_manager.init_source       = do_nothing;
+    m_source_manager.fill_input_buffer = fill_input_buffer;
+    m_source_manager.skip_input_data   = skip_input_data;
+    m_source_manager.resync_to_restart = jpeg_resync_to_restart; // Default method.
+    m_source_manager.term_source       = do_nothing;
+
+    m_decompressor.src = &m_source_manager;
+}
+
+inline nuwen::jpeg_decoder::~jpeg_decoder() {
+    jpeg_destroy_decompress(&m_decompressor);
+}
+
+inline boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t> nuwen::jpeg_decoder::decompress_insecurely(
+    const vuc_t& input, const ul_t max_width, const ul_t max_height) {
+
+    return decompress(input, max_width, max_height, 0, 0);
+}
+
+inline boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t> nuwen::jpeg_decoder::decompress_scaled_insecurely(
+    const vuc_t& input, const ul_t target_width, const ul_t target_height, const ul_t max_width, const ul_t max_height) {
+
+    if (target_width == 0 || target_height == 0) {
+        throw std::logic_error("LOGIC ERROR: nuwen::jpeg_decoder::decompress_scaled_insecurely() - Invalid target size.");
+    }
+
+    return decompress(input, max_width, max_height, target_width, target_height);
+}
+
+inline boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t> nuwen::jpeg_decoder::decompress(const vuc_t& input,
+    const ul_t max_width, const ul_t max_height, const ul_t target_width, const ul_t target_height) {
+
     using namespace std;
     using namespace boost;
-    using namespace pham;
     using namespace pham::jpeg;
 
-    if (input.empty()) {
-        throw runtime_error("RUNTIME ERROR: nuwen::decompress_jpeg_insecurely() - Empty input.");
+    decompressor_aborter aborter(m_decompressor);
+
+    read_header(input, max_width, max_height);
+
+    m_decompressor.scale_num = 1;
+    m_decompressor.scale_denom = target_width == 0 ? 1
+        : scale_denom(m_decompressor.image_width, m_decompressor.image_height, target_width, target_height);
+
+    check(try_start_decompress(&m_decompressor), m_error_manager);
+
+    const ul_t output_width  = m_decompressor.output_width;
+    const ul_t output_height = m_decompressor.output_height;
+    const ul_t row_size      = output_width * m_decompressor.output_components;
+
+    tuple<ul_t, ul_t, vuc_t> ret(output_width, output_height, vuc_t(static_cast<vuc_s_t>(row_size) * output_height, 0));
+
+    uc_t * scanptr = &ret.get<2>()[0];
+
+    while (m_decompressor.output_scanline < output_height) {
+        JDIMENSION k = 0;
+
+        check(try_read_scanlines(&m_decompressor, &scanptr, 1, k), m_error_manager);
+
+        if (k != 1) {
+            throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::decompress() - jpeg_read_scanlines() failed.");
+        }
+
+        scanptr += row_size;
+    }
+
+    check(try_finish_decompress(&m_decompressor), m_error_manager);
+
+    check_warnings();
+
+    return ret;
+}
+
+inline boost::tuple<nuwen::ul_t, nuwen::ul_t> nuwen::jpeg_decoder::decompress_into_insecurely(const vuc_t& input,
+    uc_t * const dest, const vuc_s_t size, const vuc_s_t stride, const jpeg_region& region,
+    const jpeg_rows_callback& callback, const ul_t max_width, const ul_t max_height) {
+
+    using namespace std;
+    using namespace pham::jpeg;
+
+    if (dest == NULL) {
+        throw logic_error("LOGIC ERROR: nuwen::jpeg_decoder::decompress_into_insecurely() - dest is NULL.");
+    }
+
+    decompressor_aborter aborter(m_decompressor);
+
+    read_header(input, max_width, max_height);
+
+    const ul_t image_width  = m_decompressor.image_width;
+    const ul_t image_height = m_decompressor.image_height;
+
+    if (region.x >= image_width || region.y >= image_height
+        || region.width > image_width - region.x || region.height > image_height - region.y) {
+
+        throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::decompress_into_insecurely() - Region outside image.");
     }
 
-    jpeg_error_mgr error_manager;
-    jpeg_decompress_struct decompressor;
+    const ul_t width  = region.width  == 0 ? image_width  - region.x : region.width;
+    const ul_t height = region.height == 0 ? image_height - region.y : region.height;
 
-    decompressor.err = jpeg_std_error(&error_manager);
+    const vuc_s_t row_size = static_cast<vuc_s_t>(width) * 3;
 
-    vc_t warning_message(JMSG_LENGTH_MAX, 0);
-    decompressor.client_data = &warning_message[0];
-    decompressor.err->output_message = output_message;
+    if (stride < row_size || (height - 1) * static_cast<ull_t>(stride) + row_size > size) {
+        throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::decompress_into_insecurely() - Insufficient space.");
+    }
 
-    // Obnoxiously, jpeg_create_decompress is a macro that contains an old-style cast.
-    jpeg_CreateDecompress(&decompressor, JPEG_LIB_VERSION, sizeof decompressor);
+    check(try_start_decompress(&m_decompressor), m_error_manager);
 
-    jpeg_source_mgr source_manager;
+    // Scanlines begin at the iMCU column containing x. Without jpeg_crop_scanline(), they're full width.
+    JDIMENSION first_column = region.x;
+    JDIMENSION columns = width;
 
-    source_manager.next_input_byte   = &input[0];
-    source_manager.bytes_in_buffer   = input.size();
-    source_manager.init_source       = do_nothing;
-    source_manager.fill_input_buffer = fill_input_buffer;
-    source_manager.skip_input_data   = skip_input_data;
-    source_manager.resync_to_restart = jpeg_resync_to_restart; // Default method.
-    source_manager.term_source       = do_nothing;
+#ifdef PHAM_JPEG_CROP
+    check(try_crop_scanline(&m_decompressor, first_column, columns), m_error_manager);
 
-    decompressor.src = &source_manager;
+    JDIMENSION skipped = 0;
 
-    decompressor_destroyer destroyer(decompressor);
+    check(try_skip_scanlines(&m_decompressor, region.y, skipped), m_error_manager);
 
-    jpeg_read_header(&decompressor, JPEG_TRUE);
+    if (skipped != region.y) {
+        throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::decompress_into_insecurely() - jpeg_skip_scanlines() failed.");
+    }
+#else
+    first_column = 0;
+    columns = m_decompressor.output_width;
+#endif
+
+    // When the scanlines are exactly the region's rows, they're decoded directly into dest.
+    const bool direct = first_column == region.x && columns == width;
+
+    const vuc_s_t scanline_size = static_cast<vuc_s_t>(columns) * 3;
+    const vuc_s_t offset = static_cast<vuc_s_t>(region.x - first_column) * 3;
+
+    if (!direct || m_decompressor.output_scanline < region.y) {
+        m_rows.resize(scanline_size * BATCH_ROWS);
+    }
+
+    // Without jpeg_skip_scanlines(), rows above the region are read into m_rows and discarded.
+    while (m_decompressor.output_scanline < region.y) {
+        JSAMPROW p = &m_rows[0];
+        JDIMENSION k = 0;
+
+        check(try_read_scanlines(&m_decompressor, &p, 1, k), m_error_manager);
+
+        if (k != 1) {
+            throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::decompress_into_insecurely() - jpeg_read_scanlines() failed.");
+        }
+    }
 
-    const ul_t width  = decompressor.image_width;
-    const ul_t height = decompressor.image_height;
+    for (ul_t first = 0; first < height; first += BATCH_ROWS) {
+        const ul_t n = min(BATCH_ROWS, height - first);
+
+        JSAMPROW rows[BATCH_ROWS];
+
+        for (ul_t i = 0; i < n; ++i) {
+            rows[i] = direct ? dest + (first + i) * stride : &m_rows[i * scanline_size];
+        }
+
+        // jpeg_read_scanlines() can return fewer rows than were requested.
+        for (ul_t done = 0; done < n; ) {
+            JDIMENSION k = 0;
+
+            check(try_read_scanlines(&m_decompressor, rows + done, n - done, k), m_error_manager);
+
+            if (k == 0) {
+                throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::decompress_into_insecurely() - jpeg_read_scanlines() failed.");
+            }
+
+            done += k;
+        }
+
+        if (!direct) {
+            for (ul_t i = 0; i < n; ++i) {
+                copy(rows[i] + offset, rows[i] + offset + row_size, dest + (first + i) * stride);
+            }
+        }
+
+        if (callback) {
+            callback(first, n);
+        }
+    }
+
+    // When rows below the region remain, the decoder aborts instead of reading them.
+    if (m_decompressor.output_scanline == m_decompressor.output_height) {
+        check(try_finish_decompress(&m_decompressor), m_error_manager);
+    }
+
+    check_warnings();
+
+    return boost::make_tuple(width, height);
+}
+
+inline nuwen::jpeg_info nuwen::jpeg_decoder::probe_insecurely(const vuc_t& input) {
+    using namespace pham::jpeg;
+
+    decompressor_aborter aborter(m_decompressor);
+
+    start_reading(input);
+
+    check(try_read_header(&m_decompressor), m_error_manager);
+
+    jpeg_info ret;
+
+    ret.width       = m_decompressor.image_width;
+    ret.height      = m_decompressor.image_height;
+    ret.components  = static_cast<ul_t>(m_decompressor.num_components);
+    ret.progressive = m_decompressor.progressive_mode != 0;
+
+    m_decompressor.scale_num = 1;
+
+    for (int i = 0; i < 4; ++i) {
+        m_decompressor.scale_denom = 1U << i;
+
+        check(try_calc_output_dimensions(&m_decompressor), m_error_manager);
+
+        ret.scaled_widths[i]  = m_decompressor.output_width;
+        ret.scaled_heights[i] = m_decompressor.output_height;
+    }
+
+    check_warnings();
+
+    return ret;
+}
+
+inline void nuwen::jpeg_decoder::start_reading(const vuc_t& input) {
+    if (input.empty()) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::start_reading() - Empty input.");
+    }
+
+    // output_message() clears client_data when libjpeg warns.
+    m_warning_message.assign(JMSG_LENGTH_MAX, 0);
+    m_decompressor.client_data = &m_warning_message[0];
+
+    m_source_manager.next_input_byte = &input[0];
+    m_source_manager.bytes_in_buffer = input.size();
+}
+
+inline void nuwen::jpeg_decoder::read_header(const vuc_t& input, const ul_t max_width, const ul_t max_height) {
+    using namespace std;
+
+    start_reading(input);
+
+    pham::jpeg::check(pham::jpeg::try_read_header(&m_decompressor), m_error_manager);
+
+    const ul_t width  = m_decompressor.image_width;
+    const ul_t height = m_decompressor.image_height;
 
     if (width == 0) {
-        throw runtime_error("RUNTIME ERROR: nuwen::decompress_jpeg_insecurely() - Zero width.");
+        throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::read_header() - Zero width.");
     }
 
     if (height == 0) {
-        throw runtime_error("RUNTIME ERROR: nuwen::decompress_jpeg_insecurely() - Zero height.");
+        throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::read_header() - Zero height.");
     }
 
     if (width > max_width) {
-        throw runtime_error("RUNTIME ERROR: nuwen::decompress_jpeg_insecurely() - Huge width.");
+        throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::read_header() - Huge width.");
     }
 
     if (height > max_height) {
-        throw runtime_error("RUNTIME ERROR: nuwen::decompress_jpeg_insecurely() - Huge height.");
+        throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::read_header() - Huge height.");
     }
 
-    if (decompressor.num_components != 3) {
-        throw runtime_error("RUNTIME ERROR: nuwen::decompress_jpeg_insecurely() - Unexpected number of components.");
+    if (m_decompressor.num_components != 3) {
+        throw runtime_error("RUNTIME ERROR: nuwen::jpeg_decoder::read_header() - Unexpected number of components.");
     }
+}
 
-    jpeg_start_decompress(&decompressor);
+inline void nuwen::jpeg_decoder::check_warnings() const {
+    if (m_decompressor.client_data == NULL) {
+        throw std::runtime_error(str(boost::format(
+            "RUNTIME ERROR: nuwen::jpeg_decoder::check_warnings() - libjpeg warned \"%1%\".") % &m_warning_message[0]));
+    }
+}
 
-    tuple<ul_t, ul_t, vuc_t> ret(width, height, vuc_t(width * height * decompressor.num_components, 0));
+inline void nuwen::compress_jpeg_into(const uc_t * const pixels, const ul_t width, const ul_t height,
+    const vuc_s_t stride, vuc_t& dest, const int quality, const jpeg_dct_method dct, const bool optimize_huffman) {
 
-    uc_t * scanptr = &ret.get<2>()[0];
+    jpeg_encoder e;
+
+    e.compress_into(pixels, width, height, stride, dest, quality, dct, optimize_huffman);
+}
+
+inline nuwen::vuc_t nuwen::compress_jpeg(const boost::tuple<ul_t, ul_t, vuc_t>& image,
+    const int quality, const jpeg_dct_method dct, const bool optimize_huffman) {
+
+    jpeg_encoder e;
+
+    return e.compress(image, quality, dct, optimize_huffman);
+}
+
+inline nuwen::jpeg_encoder::jpeg_encoder() : m_warning_message(JMSG_LENGTH_MAX, 0) {
+    m_compressor.err = jpeg_std_error(&m_error_manager);
+    m_compressor.err->error_exit = pham::error_exit;
+    m_compressor.err->output_message = pham::output_message;
+
+    pham::jpeg::check(pham::jpeg::try_create_compress(&m_compressor), m_error_manager);
+
+    m_compressor.input_components = 3;
+    m_compressor.in_color_space   = JCS_RGB;
+
+    // The destructor won't run if this throws.
+    const bool ok = pham::jpeg::try_set_defaults(&m_compressor);
+
+    if (!ok) {
+        jpeg_destroy_compress(&m_compressor);
+    }
+
+    pham::jpeg::check(ok, m_error_manager);
+
+    for (int i = 0; i < NUM_HUFF_TBLS; ++i) {
+        if (m_compressor.dc_huff_tbl_ptrs[i]) {
+            m_dc_tables[i] = *m_compressor.dc_huff_tbl_ptrs[i];
+        }
+
+        if (m_compressor.ac_huff_tbl_ptrs[i]) {
+            m_ac_tables[i] = *m_compressor.ac_huff_tbl_ptrs[i];
+        }
+    }
+}
+
+inline nuwen::jpeg_encoder::~jpeg_encoder() {
+    jpeg_destroy_compress(&m_compressor);
+}
+
+inline void nuwen::jpeg_encoder::compress_into(const uc_t * const pixels, const ul_t width, const ul_t height,
+    const vuc_s_t stride, vuc_t& dest, const int quality, const jpeg_dct_method dct, const bool optimize_huffman) {
+
+    using namespace std;
+    using namespace pham::jpeg;
+
+    if (pixels == NULL) {
+        throw logic_error("LOGIC ERROR: nuwen::jpeg_encoder::compress_into() - pixels is NULL.");
+    }
+
+    // JPEG_MAX_DIMENSION is libjpeg's limit.
+    if (width == 0 || height == 0 || width > JPEG_MAX_DIMENSION || height > JPEG_MAX_DIMENSION) {
+        throw logic_error("LOGIC ERROR: nuwen::jpeg_encoder::compress_into() - Invalid size.");
+    }
+
+    if (stride < width * 3ULL) {
+        throw logic_error("LOGIC ERROR: nuwen::jpeg_encoder::compress_into() - Invalid stride.");
+    }
+
+    if (quality < 0 || quality > 100) {
+        throw logic_error("LOGIC ERROR: nuwen::jpeg_encoder::compress_into() - Invalid quality.");
+    }
+
+    pham::append_guard guard(dest);
+
+    destination d;
+
+    d.init_destination    = init_destination;
+    d.empty_output_buffer = empty_output_buffer;
+    d.term_destination    = term_destination;
+    d.m_dest              = &dest;
+
+    m_warning_message.assign(JMSG_LENGTH_MAX, 0);
+    m_compressor.client_data = &m_warning_message[0];
+
+    compressor_aborter aborter(m_compressor);
+
+    m_compressor.dest = &d;
+
+    m_compressor.image_width  = width;
+    m_compressor.image_height = height;
+
+    set_defaults();
+    check(try_set_quality(&m_compressor, quality), m_error_manager);
+
+    m_compressor.dct_method = dct == fast_dct ? JDCT_IFAST : JDCT_ISLOW;
+    m_compressor.optimize_coding = static_cast<JPEG_boolean>(optimize_huffman);
 
-    // No scaling is being used.
-    while (decompressor.output_scanline < height) {
-        if (jpeg_read_scanlines(&decompressor, &scanptr, 1) != 1) {
-            throw runtime_error("RUNTIME ERROR: nuwen::decompress_jpeg_insecurely() - jpeg_read_scanlines() failed.");
+    check(try_start_compress(&m_compressor), m_error_manager);
+
+    while (m_compressor.next_scanline < height) {
+        // libjpeg doesn't modify the rows, despite its non-const interface.
+        JSAMPROW row = const_cast<uc_t *>(pixels) + m_compressor.next_scanline * stride;
+        JDIMENSION k = 0;
+
+        check(try_write_scanlines(&m_compressor, &row, 1, k), m_error_manager);
+
+        if (k != 1) {
+            throw runtime_error("RUNTIME ERROR: nuwen::jpeg_encoder::compress_into() - jpeg_write_scanlines() failed.");
+        }
+    }
+
+    check(try_finish_compress(&m_compressor), m_error_manager);
+
+    // The destination manager is about to go away.
+    m_compressor.dest = NULL;
+
+    if (m_compressor.client_data == NULL) {
+        throw runtime_error(str(boost::format(
+            "RUNTIME ERROR: nuwen::jpeg_encoder::compress_into() - libjpeg warned \"%1%\".") % &m_warning_message[0]));
+    }
+
+    guard.dismiss();
+}
+
+inline void nuwen::jpeg_encoder::set_defaults() {
+    pham::jpeg::check(pham::jpeg::try_set_defaults(&m_compressor), m_error_manager);
+
+    // jpeg_set_defaults() keeps Huffman tables that already exist, but optimized coding overwrites them.
+    // The constructor saved the standard tables, so they're restored here.
+    for (int i = 0; i < NUM_HUFF_TBLS; ++i) {
+        if (m_compressor.dc_huff_tbl_ptrs[i]) {
+            *m_compressor.dc_huff_tbl_ptrs[i] = m_dc_tables[i];
         }
 
-        scanptr += width * decompressor.num_components;
+        if (m_compressor.ac_huff_tbl_ptrs[i]) {
+            *m_compressor.ac_huff_tbl_ptrs[i] = m_ac_tables[i];
+        }
     }
+}
+
+inline nuwen::vuc_t nuwen::jpeg_encoder::compress(const boost::tuple<ul_t, ul_t, vuc_t>& image,
+    const int quality, const jpeg_dct_method dct, const bool optimize_huffman) {
 
-    jpeg_finish_decompress(&decompressor);
+    const ul_t width = image.get<0>();
+    const ul_t height = image.get<1>();
+    const vuc_t& pixels = image.get<2>();
 
-    if (decompressor.client_data == NULL) {
-        throw runtime_error(str(format(
-            "RUNTIME ERROR: nuwen::decompress_jpeg_insecurely() - libjpeg warned \"%1%\".") % &warning_message[0]));
+    if (pixels.size() != 3ULL * width * height || pixels.empty()) {
+        throw std::logic_error("LOGIC ERROR: nuwen::jpeg_encoder::compress() - Invalid image.");
     }
 
+    vuc_t ret;
+
+    compress_into(&pixels[0], width, height, width * 3, ret, quality, dct, optimize_huffman);
+
     return ret;
 }
 
@@ -9,14 +9,19 @@
 #include "vector.hh"
 
 #include "external_begin.hh"
+    #include <algorithm>
+    #include <cstdlib>
+    #include <stdexcept>
+    #include <vector>
     #include <boost/tuple/tuple.hpp>
 #include "external_end.hh"
 
+using namespace std;
 using namespace boost;
 using namespace nuwen;
 
-bool test() {
-    const vuc_t image_jpeg = vuc_from_hex(
+const vuc_t& image_jpeg() {
+    static const vuc_t ret = vuc_from_hex(
         "FFD8FFE000104A46494600010200006400640000FFEC00114475636B7900010004000000500000FFEE00264164"
         "6F62650064C0000000010300150403060A0D000001C7000002110000026A000002C4FFDB008400020202020202"
         "0202020203020202030403020203040504040404040506050505050505060607070807070609090A0A09090C0C"
@@ -34,7 +39,11 @@ bool test() {
         "2100142F2D3D97AD69E432A2856D1188F494A6E45966B9749C54BDBF8EB1A391216CCFFFDA0008010203013F10"
         "B25817BD79D4CFEE56385E27FFDA0008010303013F10E88333F7D8A9D6237DDCCFFFD9");
 
-    const vuc_t image_rgb = vuc_from_hex(
+    return ret;
+}
+
+const vuc_t& image_rgb() {
+    static const vuc_t ret = vuc_from_hex(
         "615E575A554F65605A726B655E5550574C485F54505345425C4A46837A7D7F79794F41385E4E41A49B96C1BDBC"
         "ADA5A25E595359524C3F3832423B353B322D4A413C4D443F4338343E3538564E4B73696063504944302544382C"
         "86837E9998A0605750463D36211811261D18231C1638312B3F3832362F2935323B514B3F594C3B46322B553E38"
@@ -54,11 +63,230 @@ bool test() {
         "84766D6F61582D1F14180A00190C031B120B120D0916120F251C1515120B0C0B0717120F1F110640311C685C50"
         "BEB5BA");
 
-    const tuple<ul_t, ul_t, vuc_t> t = decompress_jpeg_insecurely(image_jpeg);
+    return ret;
+}
+
+bool test() {
+    const tuple<ul_t, ul_t, vuc_t> t = decompress_jpeg_insecurely(image_jpeg());
+
+    return t.get<0>() == 16 && t.get<1>() == 16 && t.get<2>() == image_rgb();
+}
+
+bool has_size(const tuple<ul_t, ul_t, vuc_t>& t, const ul_t width, const ul_t height) {
+    return t.get<0>() == width && t.get<1>() == height && t.get<2>().size() == width * height * 3;
+}
+
+bool test_scaled() {
+    const vuc_t& rgb = image_rgb();
+
+    const tuple<ul_t, ul_t, vuc_t> eighth = decompress_jpeg_scaled_insecurely(image_jpeg(), 1, 1);
+
+    // At 1/8 scale, each pixel is roughly its 8x8 block's average.
+    for (ul_t y = 0; y < 2; ++y) {
+        for (ul_t x = 0; x < 2; ++x) {
+            for (ul_t c = 0; c < 3; ++c) {
+                ul_t sum = 0;
+
+                for (ul_t i = 0; i < 8; ++i) {
+                    for (ul_t k = 0; k < 8; ++k) {
+                        sum += rgb[((y * 8 + i) * 16 + x * 8 + k) * 3 + c];
+                    }
+                }
+
+                if (abs(static_cast<int>(eighth.get<2>()[(y * 2 + x) * 3 + c]) - static_cast<int>(sum / 64)) > 8) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    try {
+        (void) decompress_jpeg_scaled_insecurely(image_jpeg(), 0, 1);
+        return false;
+    } catch (const logic_error&) { }
+
+    return has_size(eighth, 2, 2)
+        && has_size(decompress_jpeg_scaled_insecurely(image_jpeg(), 3, 3), 4, 4)
+        && has_size(decompress_jpeg_scaled_insecurely(image_jpeg(), 5, 1), 8, 8)
+        && decompress_jpeg_scaled_insecurely(image_jpeg(), 16, 9).get<2>() == rgb
+        && decompress_jpeg_scaled_insecurely(image_jpeg(), 17, 17).get<2>() == rgb;
+}
+
+bool test_decoder() {
+    jpeg_decoder d;
+
+    for (int i = 0; i < 3; ++i) {
+        if (d.decompress_insecurely(image_jpeg()).get<2>() != image_rgb()) {
+            return false;
+        }
+
+        if (!has_size(d.decompress_scaled_insecurely(image_jpeg(), 4, 4), 4, 4)) {
+            return false;
+        }
+
+        // A failure part of the way through leaves the decoder usable.
+        try {
+            (void) d.decompress_insecurely(image_jpeg(), 8, 8);
+            return false;
+        } catch (const runtime_error&) { }
+
+        // So does a failure inside libjpeg.
+        try {
+            (void) d.decompress_insecurely(vuc_from_hex("FFD8FFDB0000"));
+            return false;
+        } catch (const runtime_error&) { }
+    }
+
+    return true;
+}
+
+class row_counter {
+public:
+    row_counter(ul_t& rows, ul_t& calls) : m_rows(&rows), m_calls(&calls) { }
+
+    void operator()(const ul_t first, const ul_t n) const {
+        if (first == *m_rows) {
+            *m_rows += n;
+        }
+
+        ++*m_calls;
+    }
+
+private:
+    ul_t * m_rows;
+    ul_t * m_calls;
+};
+
+bool test_into(const ul_t x, const ul_t y, const ul_t width, const ul_t height) {
+    const vuc_t& rgb = image_rgb();
+
+    const vuc_s_t stride = width * 3 + 5;
+
+    vuc_t buf(stride * height, 0xEE);
+
+    ul_t rows = 0;
+    ul_t calls = 0;
+
+    jpeg_decoder d;
+
+    const tuple<ul_t, ul_t> t = d.decompress_into_insecurely(image_jpeg(), &buf[0], buf.size(),
+        stride, jpeg_region(x, y, width == 16 - x ? 0 : width, height == 16 - y ? 0 : height), row_counter(rows, calls));
+
+    for (ul_t r = 0; r < height; ++r) {
+        const vuc_ci_t src = rgb.begin() + ((y + r) * 16 + x) * 3;
+        const vuc_ci_t row = buf.begin() + r * stride;
+
+        if (!equal(row, row + width * 3, src) || row[width * 3] != 0xEE || row[width * 3 + 4] != 0xEE) {
+            return false;
+        }
+    }
+
+    return t.get<0>() == width && t.get<1>() == height && rows == height && calls == 1;
+}
+
+bool test_into_errors() {
+    vuc_t buf(16 * 16 * 3);
+
+    try {
+        (void) decompress_jpeg_into_insecurely(image_jpeg(), &buf[0], buf.size() - 1, 16 * 3);
+        return false;
+    } catch (const runtime_error&) { }
+
+    try {
+        (void) decompress_jpeg_into_insecurely(image_jpeg(), &buf[0], buf.size(), 16 * 3, jpeg_region(8, 8, 9, 1));
+        return false;
+    } catch (const runtime_error&) { }
+
+    const tuple<ul_t, ul_t> t = decompress_jpeg_into_insecurely(image_jpeg(), &buf[0], buf.size(), 16 * 3);
+
+    return t.get<0>() == 16 && t.get<1>() == 16 && buf == image_rgb();
+}
+
+bool test_probe() {
+    jpeg_decoder d;
+
+    const jpeg_info info = d.probe_insecurely(image_jpeg());
+
+    const ul_t sizes[] = { 16, 8, 4, 2 };
+
+    for (int i = 0; i < 4; ++i) {
+        if (info.scaled_widths[i] != sizes[i] || info.scaled_heights[i] != sizes[i]) {
+            return false;
+        }
+    }
+
+    try {
+        (void) probe_jpeg_insecurely(vuc_t());
+        return false;
+    } catch (const runtime_error&) { }
+
+    return info.width == 16 && info.height == 16 && info.components == 3 && info.progressive
+        && d.decompress_insecurely(image_jpeg()).get<2>() == image_rgb()
+        && probe_jpeg_insecurely(image_jpeg()).width == 16;
+}
+
+bool close_to(const vuc_t& a, const vuc_t& b, const int tolerance) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (vuc_s_t i = 0; i < a.size(); ++i) {
+        if (abs(a[i] - b[i]) > tolerance) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool test_encoder() {
+    const tuple<ul_t, ul_t, vuc_t> image(16, 16, image_rgb());
+
+    jpeg_encoder e;
+
+    const vuc_t accurate = e.compress(image, 95);
+    const vuc_t fast = e.compress(image, 95, fast_dct);
+    const vuc_t optimized = e.compress(image, 95, accurate_dct, true);
+
+    // Padded rows and appending give the same bytes, and a reused encoder is deterministic.
+    vuc_t padded(16 * 50, 0xCD);
+
+    for (ul_t y = 0; y < 16; ++y) {
+        copy(image_rgb().begin() + y * 48, image_rgb().begin() + (y + 1) * 48, padded.begin() + y * 50);
+    }
+
+    vuc_t appended(3, 0xAB);
+
+    compress_jpeg_into(&padded[0], 16, 16, 50, appended, 95);
+
+    try {
+        e.compress_into(&padded[0], 16, 16, 47, appended);
+        return false;
+    } catch (const logic_error&) { }
+
+    try {
+        (void) compress_jpeg(image, 101);
+        return false;
+    } catch (const logic_error&) { }
+
+    const tuple<ul_t, ul_t, vuc_t> t = decompress_jpeg_insecurely(accurate);
 
-    return t.get<0>() == 16 && t.get<1>() == 16 && t.get<2>() == image_rgb;
+    return has_size(t, 16, 16) && close_to(t.get<2>(), image_rgb(), 24)
+        && close_to(decompress_jpeg_insecurely(fast).get<2>(), image_rgb(), 24)
+        && decompress_jpeg_insecurely(optimized).get<2>() == t.get<2>()
+        && optimized.size() <= accurate.size()
+        && e.compress(image, 95) == accurate
+        && appended.size() == 3 + accurate.size()
+        && equal(accurate.begin(), accurate.end(), appended.begin() + 3)
+        && compress_jpeg(image, 10).size() < accurate.size();
 }
 
 int main() {
     NUWEN_TEST("jpeg1", test())
+    NUWEN_TEST("jpeg2", test_scaled())
+    NUWEN_TEST("jpeg3", test_decoder())
+    NUWEN_TEST("jpeg4", test_into(0, 0, 16, 16) && test_into(5, 3, 7, 9) && test_into(9, 15, 7, 1) && test_into(0, 8, 16, 8))
+    NUWEN_TEST("jpeg5", test_into_errors())
+    NUWEN_TEST("jpeg6", test_probe())
+    NUWEN_TEST("jpeg7", test_encoder())
 }
@@ -0,0 +1,102 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#ifndef PHAM_JPEG_THREAD_HH
+#define PHAM_JPEG_THREAD_HH
+
+#include "compiler.hh"
+
+#ifdef NUWEN_PLATFORM_MSVC
+    #pragma once
+#endif
+
+#include "jpeg.hh"
+#include "thread.hh"
+#include "typedef.hh"
+
+#include "external_begin.hh"
+    #include <vector>
+    #include <boost/thread/once.hpp>
+    #include <boost/thread/tss.hpp>
+    #include <boost/tuple/tuple.hpp>
+#include "external_end.hh"
+
+// These require Boost.Thread. jpeg.hh alone doesn't.
+
+namespace nuwen {
+    // Created on first use in each thread.
+    inline jpeg_decoder& thread_jpeg_decoder();
+
+    // Decodes the inputs concurrently on p, each thread using its thread_jpeg_decoder().
+    // The results are in the same order as the inputs. If any input fails, this throws.
+    inline std::vector<boost::tuple<ul_t, ul_t, vuc_t> > decompress_jpegs_insecurely(const std::vector<vuc_t>& inputs,
+        thread::pool& p, ul_t max_width = 2048, ul_t max_height = 2048);
+}
+
+namespace pham {
+    namespace jpeg {
+        inline boost::thread_specific_ptr<nuwen::jpeg_decoder>& thread_decoders() {
+            static boost::thread_specific_ptr<nuwen::jpeg_decoder> p;
+            return p;
+        }
+
+        inline void make_thread_decoders() {
+            (void) thread_decoders();
+        }
+
+        class batch_decompressor {
+        public:
+            batch_decompressor(const std::vector<nuwen::vuc_t>& inputs,
+                std::vector<boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t> >& outputs,
+                const nuwen::ul_t max_width, const nuwen::ul_t max_height)
+                : m_inputs(&inputs), m_outputs(&outputs), m_max_width(max_width), m_max_height(max_height) { }
+
+            void operator()(const nuwen::vuc_s_t i) const {
+                boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t> t
+                    = nuwen::thread_jpeg_decoder().decompress_insecurely((*m_inputs)[i], m_max_width, m_max_height);
+
+                boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t>& out = (*m_outputs)[i];
+
+                // Swapping avoids copying the pixels.
+                out.get<0>() = t.get<0>();
+                out.get<1>() = t.get<1>();
+                out.get<2>().swap(t.get<2>());
+            }
+
+        private:
+            const std::vector<nuwen::vuc_t> *                                    m_inputs;
+            std::vector<boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t> > * m_outputs;
+            nuwen::ul_t                                                          m_max_width;
+            nuwen::ul_t                                                          m_max_height;
+        };
+    }
+}
+
+inline nuwen::jpeg_decoder& nuwen::thread_jpeg_decoder() {
+    static boost::once_flag flag = BOOST_ONCE_INIT;
+
+    boost::call_once(pham::jpeg::make_thread_decoders, flag);
+
+    boost::thread_specific_ptr<jpeg_decoder>& p = pham::jpeg::thread_decoders();
+
+    if (!p.get()) {
+        p.reset(new jpeg_decoder);
+    }
+
+    return *p;
+}
+
+inline std::vector<boost::tuple<nuwen::ul_t, nuwen::ul_t, nuwen::vuc_t> > nuwen::decompress_jpegs_insecurely(
+    const std::vector<vuc_t>& inputs, thread::pool& p, const ul_t max_width, const ul_t max_height) {
+
+    std::vector<boost::tuple<ul_t, ul_t, vuc_t> > ret(inputs.size());
+
+    thread::parallel_for(p, static_cast<vuc_s_t>(0), inputs.size(),
+        pham::jpeg::batch_decompressor(inputs, ret, max_width, max_height));
+
+    return ret;
+}
+
+#endif // Idempotency
@@ -0,0 +1,96 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#include "jpeg.hh"
+#include "jpeg_thread.hh"
+#include "test.hh"
+#include "thread.hh"
+#include "typedef.hh"
+#include "vector.hh"
+
+#include "external_begin.hh"
+    #include <stdexcept>
+    #include <vector>
+    #include <boost/tuple/tuple.hpp>
+#include "external_end.hh"
+
+using namespace std;
+using namespace boost;
+using namespace nuwen;
+
+// A 16 by 16 gradient.
+vuc_t make_jpeg() {
+    vuc_t pixels;
+
+    for (ul_t y = 0; y < 16; ++y) {
+        for (ul_t x = 0; x < 16; ++x) {
+            pixels.push_back(static_cast<uc_t>(x * 16));
+            pixels.push_back(static_cast<uc_t>(y * 16));
+            pixels.push_back(static_cast<uc_t>((x + y) * 8));
+        }
+    }
+
+    return compress_jpeg(tuple<ul_t, ul_t, vuc_t>(16, 16, pixels));
+}
+
+const vuc_t& image_jpeg() {
+    static const vuc_t ret = make_jpeg();
+
+    return ret;
+}
+
+bool test_thread_decoder() {
+    jpeg_decoder& d = thread_jpeg_decoder();
+
+    try {
+        (void) d.decompress_insecurely(vuc_from_hex("FFD8FFDB0000"));
+        return false;
+    } catch (const runtime_error&) { }
+
+    return &d == &thread_jpeg_decoder()
+        && d.decompress_insecurely(image_jpeg()).get<2>() == decompress_jpeg_insecurely(image_jpeg()).get<2>();
+}
+
+bool test_batch() {
+    thread::pool& p = thread::default_pool();
+
+    const vector<vuc_t> inputs(50, image_jpeg());
+    const vuc_t rgb = decompress_jpeg_insecurely(image_jpeg()).get<2>();
+
+    const vector<tuple<ul_t, ul_t, vuc_t> > outputs = decompress_jpegs_insecurely(inputs, p);
+
+    for (vector<tuple<ul_t, ul_t, vuc_t> >::const_iterator i = outputs.begin(); i != outputs.end(); ++i) {
+        if (i->get<0>() != 16 || i->get<1>() != 16 || i->get<2>() != rgb) {
+            return false;
+        }
+    }
+
+    vector<vuc_t> bad(inputs);
+    bad[17].clear();
+
+    try {
+        (void) decompress_jpegs_insecurely(bad, p);
+        return false;
+    } catch (const runtime_error&) { }
+
+    vector<vuc_t> corrupt(inputs);
+    corrupt[23] = vuc_from_hex("FFD8FFDB0000");
+
+    try {
+        (void) decompress_jpegs_insecurely(corrupt, p);
+        return false;
+    } catch (const runtime_error&) { }
+
+    // The threads' decoders are still usable.
+    const vector<tuple<ul_t, ul_t, vuc_t> > again = decompress_jpegs_insecurely(inputs, p);
+
+    return outputs.size() == inputs.size() && again.size() == inputs.size() && again[23].get<2>() == rgb
+        && decompress_jpegs_insecurely(vector<vuc_t>(), p).empty();
+}
+
+int main() {
+    NUWEN_TEST("jpeg_thread1", test_thread_decoder())
+    NUWEN_TEST("jpeg_thread2", test_batch())
+}
@@ -32,6 +32,7 @@
         #include <boost/format.hpp>
         #include <boost/lexical_cast.hpp>
         #include <boost/regex.hpp>
+        #include <fcntl.h>
         #include <sys/types.h>
         #include <unistd.h>
     #endif
@@ -39,8 +40,37 @@
 
 namespace nuwen {
     inline ull_t vm_bytes();
+
+    // The most physical memory that this process has used, since it began or since reset_peak_resident_bytes().
+    inline ull_t peak_resident_bytes();
+
+    // Lowers the peak to the current usage. This returns false where that's impossible
+    // (on Windows, and on Linux before 4.0), and then peak_resident_bytes() keeps reporting the lifetime peak.
+    inline bool reset_peak_resident_bytes();
 }
 
+#ifdef NUWEN_PLATFORM_UNIX
+    namespace pham {
+        // Returns the number of kilobytes in one of /proc/<PID>/status's fields, or an empty string.
+        inline std::string proc_status_kb(const std::string& field) {
+            using namespace std;
+            using namespace boost;
+            using namespace nuwen;
+            using namespace nuwen::file;
+
+            const string filename = str(format("/proc/%1%/status") % getpid());
+
+            const vuc_t v = read_file(filename);
+
+            const string s = string_cast<string>(v);
+
+            const regex r("\\A.*" + field + ":\\s*(\\d+) kB.*\\z");
+
+            return regex_replace(s, r, "$1", regex_constants::format_no_copy);
+        }
+    }
+#endif
+
 inline nuwen::ull_t nuwen::vm_bytes() {
     using namespace std;
 
@@ -78,24 +108,61 @@ inline nuwen::ull_t nuwen::vm_bytes() {
     #endif
 
     #ifdef NUWEN_PLATFORM_UNIX
-        using namespace boost;
-        using namespace nuwen::file;
+        const string kb = pham::proc_status_kb("VmSize");
+
+        if (kb.empty()) {
+            throw runtime_error("RUNTIME ERROR: nuwen::vm_bytes() - Parsing /proc/<PID>/status failed.");
+        }
+
+        return boost::lexical_cast<ull_t>(kb) * 1024;
+    #endif
+}
+
+inline nuwen::ull_t nuwen::peak_resident_bytes() {
+    using namespace std;
 
-        const string filename = str(format("/proc/%1%/status") % getpid());
+    #ifdef NUWEN_PLATFORM_WINDOWS
+        PROCESS_MEMORY_COUNTERS x;
 
-        const vuc_t v = read_file(filename);
+        x.cb = sizeof x;
 
-        const string s = string_cast<string>(v);
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &x, sizeof x) == 0) {
+            throw runtime_error("RUNTIME ERROR: nuwen::peak_resident_bytes() - GetProcessMemoryInfo() failed.");
+        }
 
-        static const regex r("\\A.*VmSize:\\s*(\\d+) kB.*\\z");
+        return static_cast<ull_t>(x.PeakWorkingSetSize);
+    #endif
 
-        const string kb = regex_replace(s, r, "$1", regex_constants::format_no_copy);
+    #ifdef NUWEN_PLATFORM_UNIX
+        // VmHWM is the resident set's high-water mark.
+        const string kb = pham::proc_status_kb("VmHWM");
 
         if (kb.empty()) {
-            throw runtime_error("RUNTIME ERROR: nuwen::vm_bytes() - Parsing /proc/<PID>/status failed.");
+            throw runtime_error("RUNTIME ERROR: nuwen::peak_resident_bytes() - Parsing /proc/<PID>/status failed.");
         }
 
-        return lexical_cast<ull_t>(kb) * 1024;
+        return boost::lexical_cast<ull_t>(kb) * 1024;
+    #endif
+}
+
+inline bool nuwen::reset_peak_resident_bytes() {
+    #ifdef NUWEN_PLATFORM_WINDOWS
+        return false;
+    #endif
+
+    #ifdef NUWEN_PLATFORM_UNIX
+        // Writing 5 to clear_refs resets VmHWM.
+        const int fd = open("/proc/self/clear_refs", O_WRONLY);
+
+        if (fd == -1) {
+            return false;
+        }
+
+        const bool ret = write(fd, "5", 1) == 1;
+
+        close(fd);
+
+        return ret;
     #endif
 }
 
@@ -32,6 +32,27 @@ bool test_vm_bytes() {
     return true;
 }
 
+bool test_peak_resident_bytes() {
+    const ull_t N = 10000000;
+
+    const bool reset = reset_peak_resident_bytes();
+
+    const ull_t initial = peak_resident_bytes();
+
+    {
+        const vuc_t v(N);
+    }
+
+    const ull_t final = peak_resident_bytes();
+
+    cout << "Initial peak physical memory usage: " << comma_from_ull(initial) << " B." << endl;
+    cout << "  Final peak physical memory usage: " << comma_from_ull(final  ) << " B." << endl;
+
+    // Where the peak can't be reset, it may already have been higher.
+    return final >= initial && (!reset || final - initial >= N / 2);
+}
+
 int main() {
     NUWEN_TEST("memory1", test_vm_bytes())
+    NUWEN_TEST("memory2", test_peak_resident_bytes())
 }
@@ -27,6 +27,7 @@ namespace nuwen {
         class twister : public boost::noncopyable {
         public:
             inline twister();
+            inline explicit twister(ul_t seed);
 
             inline uc_t   random_uc();
             inline us_t   random_us();
@@ -61,6 +62,8 @@ namespace pham {
 
 inline nuwen::random::twister::twister() : m_mt(pham::make_seed()) { }
 
+inline nuwen::random::twister::twister(const ul_t seed) : m_mt(seed) { }
+
 inline nuwen::uc_t nuwen::random::twister::random_uc() {
     return static_cast<nuwen::uc_t>(m_mt() & 0xFF);
 }
@@ -12,16 +12,104 @@
     #pragma once
 #endif
 
-#include "gluon.hh"
+#include "file.hh"
 #include "typedef.hh"
 #include "vector.hh"
 
+// GCC 4.9 added the sha target and its intrinsics.
+#if defined(NUWEN_PLATFORM_GCC) && (defined(__i386__) || defined(__x86_64__)) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+    #define PHAM_SHA256_X86
+#endif
+
 #include "external_begin.hh"
+    #include <algorithm>
     #include <stdexcept>
+    #include <string>
+    #include <vector>
+
+    #ifdef PHAM_SHA256_X86
+        #include <cpuid.h>
+        #include <immintrin.h>
+    #endif
 #include "external_end.hh"
 
 namespace nuwen {
     inline vuc_t sha256(const vuc_t& v);
+    inline vuc_t sha256(view::byte_view v);
+
+    // Appends the 32-byte hash to dest.
+    inline void sha256_into(view::byte_view v, vuc_t& dest);
+
+    // Hashes each message, appending the 32-byte hashes to dest in the same order.
+    // With AVX-512 or AVX2, several messages are hashed at once in SIMD lanes.
+    inline void sha256_batch_into(const std::vector<view::byte_view>& messages, vuc_t& dest);
+    inline std::vector<vuc_t> sha256_batch(const std::vector<vuc_t>& messages);
+
+    // These read the file a piece at a time, giving the same hash as sha256(file::read_file(filename)).
+    inline vuc_t sha256_file(const std::string& filename);
+    inline vuc_t sha256_file(file::input_file& f);
+
+    // The compression function used on this machine: "SHA-NI", "AVX2", "SSSE3", or "portable".
+    inline const char * sha256_implementation();
+
+    // Hashes a message that arrives in pieces, buffering at most one 64-byte block.
+    // After finalize(), the hasher is reset and can hash another message.
+    class sha256_hasher {
+    public:
+        inline sha256_hasher();
+
+        inline void update(view::byte_view v);
+
+        // Writes the 32-byte hash to out, without allocating.
+        inline void finalize(uc_t * out);
+
+        inline vuc_t finalize();
+
+        // Appends the 32-byte hash to dest.
+        inline void finalize_into(vuc_t& dest);
+
+        inline void reset();
+
+        // The number of bytes given to update() since the last reset.
+        inline ull_t size() const;
+
+    private:
+        ul_t  m_H[8];
+        uc_t  m_block[64];
+        ul_t  m_used;
+        ull_t m_size;
+    };
+
+    // HMAC-SHA256 (RFC 2104) with a fixed key. The padded key blocks are hashed once, here,
+    // so each MAC costs only the message's blocks and two finalizations.
+    // A MAC can be computed all at once with mac() or in pieces with update() and finalize().
+    class hmac_sha256 {
+    public:
+        inline explicit hmac_sha256(view::byte_view key);
+
+        inline vuc_t mac(view::byte_view message) const;
+
+        // Appends the 32-byte MAC to dest.
+        inline void mac_into(view::byte_view message, vuc_t& dest) const;
+
+        // Writes the 32-byte MAC to out, without allocating.
+        inline void mac(view::byte_view message, uc_t * out) const;
+
+        // Compares in constant time.
+        inline bool verify(view::byte_view message, view::byte_view tag) const;
+
+        inline void update(view::byte_view v);
+
+        // After finalize(), the next MAC begins.
+        inline void finalize(uc_t * out);
+        inline vuc_t finalize();
+
+    private:
+        sha256_hasher m_inner_start;
+        sha256_hasher m_outer_start;
+        sha256_hasher m_inner;
+    };
 }
 
 namespace pham {
@@ -68,73 +156,953 @@ namespace pham {
             0x19A4C116UL, 0x1E376C08UL, 0x2748774CUL, 0x34B0BCB5UL, 0x391C0CB3UL, 0x4ED8AA4AUL,
             0x5B9CCA4FUL, 0x682E6FF3UL, 0x748F82EEUL, 0x78A5636FUL, 0x84C87814UL, 0x8CC70208UL,
             0x90BEFFFAUL, 0xA4506CEBUL, 0xBEF9A3F7UL, 0xC67178F2UL };
+
+        const word_t H0[] = {
+            0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
+            0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL };
+
+        // Performs the 64 rounds on one block. WK[i] is the schedule word W[i] plus K[i].
+        inline void rounds(word_t * const H, const word_t * const WK) {
+            word_t a = H[0], b = H[1], c = H[2], d = H[3], e = H[4], f = H[5], g = H[6], h = H[7];
+
+            for (int i = 0; i < 64; ++i) {
+                const word_t t1 = h + big_one(e) + ch(e, f, g) + WK[i];
+                const word_t t2 = big_zero(a) + maj(a, b, c);
+
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+
+            H[0] += a; H[1] += b; H[2] += c; H[3] += d; H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+        }
+
+        // Each of these processes n consecutive 64-byte blocks.
+        typedef void (*compress_t)(word_t * H, const nuwen::uc_t * p, nuwen::vuc_s_t n);
+
+        inline void compress_portable(word_t * const H, const nuwen::uc_t * p, nuwen::vuc_s_t n) {
+            for ( ; n > 0; --n) {
+                word_t W[64];
+
+                for (int i = 0; i < 16; ++i) {
+                    W[i] = t_from_vuc_unchecked<word_t>(p);
+                    p += 4;
+                }
+
+                for (int i = 16; i < 64; ++i) {
+                    W[i] = small_one(W[i - 2]) + W[i - 7] + small_zero(W[i - 15]) + W[i - 16];
+                }
+
+                for (int i = 0; i < 64; ++i) {
+                    W[i] += K[i];
+                }
+
+                rounds(H, W);
+            }
+        }
+
+        enum implementation { portable, ssse3, avx2, sha_ni };
+
+#ifdef PHAM_SHA256_X86
+        struct cpu_features {
+            bool ssse3;
+            bool sse41;
+            bool sha;
+            bool avx2;
+            bool avx512;
+        };
+
+        inline cpu_features detect_cpu() {
+            cpu_features ret = { false, false, false, false, false };
+
+            unsigned int a = 0, b = 0, c = 0, d = 0; // POISON_OK
+
+            if (!__get_cpuid(1, &a, &b, &c, &d)) {
+                return ret;
+            }
+
+            ret.ssse3 = (c & (1U << 9)) != 0;
+            ret.sse41 = (c & (1U << 19)) != 0;
+
+            // The OS must save the YMM registers, and the ZMM registers for AVX-512.
+            unsigned int xcr0 = 0, xcr0_high = 0; // POISON_OK
+
+            const bool has_osxsave = (c & (1U << 27)) != 0;
+            const bool has_avx = (c & (1U << 28)) != 0;
+
+            if (has_osxsave) {
+                __asm__("xgetbv" : "=a" (xcr0), "=d" (xcr0_high) : "c" (0));
+            }
+
+            const bool ymm = has_osxsave && has_avx && (xcr0 & 0x06) == 0x06;
+            const bool zmm = ymm && (xcr0 & 0xE0) == 0xE0;
+
+            if (__get_cpuid_max(0, NULL) >= 7) {
+                __cpuid_count(7, 0, a, b, c, d);
+
+                ret.sha    = ret.ssse3 && ret.sse41 && (b & (1U << 29)) != 0;
+                ret.avx2   = ymm && (b & (1U << 5)) != 0;
+                ret.avx512 = zmm && (b & (1U << 16)) != 0;
+            }
+
+            return ret;
+        }
+
+        // The CPU is examined once. Racing initializations would agree.
+        inline const cpu_features& cpu() {
+            static const cpu_features f = detect_cpu();
+
+            return f;
+        }
+
+        inline bool cpu_supports(const implementation i) {
+            const cpu_features& f = cpu();
+
+            switch (i) {
+                case sha_ni: return f.sha;
+                case avx2:   return f.avx2;
+                case ssse3:  return f.ssse3;
+                default:     return true;
+            }
+        }
+
+        // These expand the message schedule four words at a time, in each 128-bit lane.
+        // The rounds are serial, so they stay scalar.
+
+        __attribute__((target("ssse3"))) inline __m128i small_zero_x4(const __m128i x) {
+            return _mm_xor_si128(_mm_xor_si128(
+                _mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25)),
+                _mm_or_si128(_mm_srli_epi32(x, 18), _mm_slli_epi32(x, 14))),
+                _mm_srli_epi32(x, 3));
+        }
+
+        __attribute__((target("ssse3"))) inline __m128i small_one_x4(const __m128i x) {
+            return _mm_xor_si128(_mm_xor_si128(
+                _mm_or_si128(_mm_srli_epi32(x, 17), _mm_slli_epi32(x, 15)),
+                _mm_or_si128(_mm_srli_epi32(x, 19), _mm_slli_epi32(x, 13))),
+                _mm_srli_epi32(x, 10));
+        }
+
+        // Given W[t - 16] through W[t - 1] in X0 through X3, returns W[t] through W[t + 3].
+        __attribute__((target("ssse3"))) inline __m128i schedule_x4(
+            const __m128i X0, const __m128i X1, const __m128i X2, const __m128i X3) {
+
+            __m128i x = _mm_add_epi32(_mm_add_epi32(X0, small_zero_x4(_mm_alignr_epi8(X1, X0, 4))),
+                _mm_alignr_epi8(X3, X2, 4));
+
+            // W[t + 2] and W[t + 3] depend on W[t] and W[t + 1].
+            x = _mm_add_epi32(x, small_one_x4(_mm_srli_si128(X3, 8)));
+
+            return _mm_add_epi32(x, small_one_x4(_mm_slli_si128(x, 8)));
+        }
+
+        __attribute__((target("avx2"))) inline __m256i small_zero_x8(const __m256i x) {
+            return _mm256_xor_si256(_mm256_xor_si256(
+                _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25)),
+                _mm256_or_si256(_mm256_srli_epi32(x, 18), _mm256_slli_epi32(x, 14))),
+                _mm256_srli_epi32(x, 3));
+        }
+
+        __attribute__((target("avx2"))) inline __m256i small_one_x8(const __m256i x) {
+            return _mm256_xor_si256(_mm256_xor_si256(
+                _mm256_or_si256(_mm256_srli_epi32(x, 17), _mm256_slli_epi32(x, 15)),
+                _mm256_or_si256(_mm256_srli_epi32(x, 19), _mm256_slli_epi32(x, 13))),
+                _mm256_srli_epi32(x, 10));
+        }
+
+        __attribute__((target("avx2"))) inline __m256i schedule_x8(
+            const __m256i X0, const __m256i X1, const __m256i X2, const __m256i X3) {
+
+            __m256i x = _mm256_add_epi32(_mm256_add_epi32(X0, small_zero_x8(_mm256_alignr_epi8(X1, X0, 4))),
+                _mm256_alignr_epi8(X3, X2, 4));
+
+            x = _mm256_add_epi32(x, small_one_x8(_mm256_srli_si256(X3, 8)));
+
+            return _mm256_add_epi32(x, small_one_x8(_mm256_slli_si256(x, 8)));
+        }
+
+        __attribute__((target("ssse3"))) inline __m128i load_x4(const void * const p) {
+            const __m128i BSWAP = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+            return _mm_shuffle_epi8(_mm_loadu_si128(static_cast<const __m128i *>(p)), BSWAP);
+        }
+
+        __attribute__((target("ssse3"))) inline void store_wk_x4(word_t * const WK, const int t, const __m128i x) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(WK + t),
+                _mm_add_epi32(x, _mm_loadu_si128(reinterpret_cast<const __m128i *>(K + t))));
+        }
+
+        __attribute__((target("ssse3"))) inline void compress_ssse3(
+            word_t * const H, const nuwen::uc_t * p, nuwen::vuc_s_t n) {
+
+            for ( ; n > 0; --n, p += 64) {
+                word_t WK[64];
+
+                __m128i X[4];
+
+                for (int i = 0; i < 4; ++i) {
+                    X[i] = load_x4(p + 16 * i);
+                    store_wk_x4(WK, 4 * i, X[i]);
+                }
+
+                // X[i % 4] holds the oldest four words, which are replaced.
+                for (int t = 16; t < 64; t += 4) {
+                    const int i = t / 4;
+
+                    X[i % 4] = schedule_x4(X[i % 4], X[(i + 1) % 4], X[(i + 2) % 4], X[(i + 3) % 4]);
+
+                    store_wk_x4(WK, t, X[i % 4]);
+                }
+
+                rounds(H, WK);
+            }
+        }
+
+        // Expands the schedules of two blocks at once, one in each 128-bit lane.
+        __attribute__((target("avx2"))) inline void compress_avx2(
+            word_t * const H, const nuwen::uc_t * p, nuwen::vuc_s_t n) {
+
+            for ( ; n >= 2; n -= 2, p += 128) {
+                word_t WK[2][64];
+
+                __m256i X[4];
+
+                for (int t = 0; t < 64; t += 4) {
+                    const int i = t / 4;
+
+                    if (t < 16) {
+                        X[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(load_x4(p + 4 * t)),
+                            load_x4(p + 64 + 4 * t), 1);
+                    } else {
+                        X[i % 4] = schedule_x8(X[i % 4], X[(i + 1) % 4], X[(i + 2) % 4], X[(i + 3) % 4]);
+                    }
+
+                    const __m256i wk = _mm256_add_epi32(X[i % 4],
+                        _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(K + t))));
+
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(WK[0] + t), _mm256_castsi256_si128(wk));
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(WK[1] + t), _mm256_extracti128_si256(wk, 1));
+                }
+
+                rounds(H, WK[0]);
+                rounds(H, WK[1]);
+            }
+
+            compress_ssse3(H, p, n);
+        }
+
+        __attribute__((target("sha,sse4.1"))) inline void compress_sha_ni(
+            word_t * const H, const nuwen::uc_t * p, nuwen::vuc_s_t n) {
+
+            // The SHA instructions keep the state as ABEF and CDGH.
+            __m128i t = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(H)), 0xB1);
+            __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(H + 4)), 0x1B);
+            __m128i abef = _mm_alignr_epi8(t, cdgh, 8);
+
+            cdgh = _mm_blend_epi16(cdgh, t, 0xF0);
+
+            for ( ; n > 0; --n, p += 64) {
+                const __m128i abef_saved = abef;
+                const __m128i cdgh_saved = cdgh;
+
+                __m128i M[4];
+
+                // Each iteration performs four rounds. M[i % 4] holds the oldest four words, which are replaced.
+                for (int i = 0; i < 16; ++i) {
+                    if (i < 4) {
+                        M[i] = load_x4(p + 16 * i);
+                    } else {
+                        const __m128i x = _mm_add_epi32(_mm_sha256msg1_epu32(M[i % 4], M[(i + 1) % 4]),
+                            _mm_alignr_epi8(M[(i + 3) % 4], M[(i + 2) % 4], 4));
+
+                        M[i % 4] = _mm_sha256msg2_epu32(x, M[(i + 3) % 4]);
+                    }
+
+                    const __m128i wk = _mm_add_epi32(M[i % 4],
+                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(K + 4 * i)));
+
+                    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+                    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0E));
+                }
+
+                abef = _mm_add_epi32(abef, abef_saved);
+                cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+            }
+
+            t = _mm_shuffle_epi32(abef, 0x1B);
+            cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(H), _mm_blend_epi16(t, cdgh, 0xF0));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(H + 4), _mm_alignr_epi8(cdgh, t, 8));
+        }
+
+        // These compress one block from each of 8 or 16 messages, one message per 32-bit lane.
+        // S holds the states transposed: S[lanes * j + k] is word j of lane k's state.
+
+        __attribute__((target("avx2"))) inline __m256i rotr_x8(const __m256i x, const int n) {
+            return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+        }
+
+        __attribute__((target("avx2"))) inline void compress_lanes_avx2(
+            word_t * const S, const nuwen::uc_t * const * const blocks) {
+
+            __m256i v[8];
+            __m256i W[16];
+
+            for (int j = 0; j < 8; ++j) {
+                v[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(S + 8 * j));
+            }
+
+            __m256i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+
+            for (int i = 0; i < 64; ++i) {
+                __m256i& w = W[i % 16];
+
+                if (i < 16) {
+                    w = _mm256_set_epi32(
+                        static_cast<int>(t_from_vuc_unchecked<word_t>(blocks[7] + 4 * i)),
+                        static_cast<int>(t_from_vuc_unchecked<word_t>(blocks[6] + 4 * i)),
+                        static_cast<int>(t_from_vuc_unchecked<word_t>(blocks[5] + 4 * i)),
+                        static_cast<int>(t_from_vuc_unchecked<word_t>(blocks[4] + 4 * i)),
+                        static_cast<int>(t_from_vuc_unchecked<word_t>(blocks[3] + 4 * i)),
+                        static_cast<int>(t_from_vuc_unchecked<word_t>(blocks[2] + 4 * i)),
+                        static_cast<int>(t_from_vuc_unchecked<word_t>(blocks[1] + 4 * i)),
+                        static_cast<int>(t_from_vuc_unchecked<word_t>(blocks[0] + 4 * i)));
+                } else {
+                    const __m256i w2 = W[(i - 2) % 16];
+                    const __m256i w15 = W[(i - 15) % 16];
+
+                    const __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(w2, 17), rotr_x8(w2, 19)),
+                        _mm256_srli_epi32(w2, 10));
+                    const __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(w15, 7), rotr_x8(w15, 18)),
+                        _mm256_srli_epi32(w15, 3));
+
+                    w = _mm256_add_epi32(_mm256_add_epi32(w, s0), _mm256_add_epi32(W[(i - 7) % 16], s1));
+                }
+
+                const __m256i big_one_e = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(e, 6), rotr_x8(e, 11)),
+                    rotr_x8(e, 25));
+                const __m256i ch_efg = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+
+                const __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, big_one_e),
+                    _mm256_add_epi32(_mm256_add_epi32(ch_efg, w), _mm256_set1_epi32(static_cast<int>(K[i]))));
+
+                const __m256i big_zero_a = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(a, 2), rotr_x8(a, 13)),
+                    rotr_x8(a, 22));
+                const __m256i maj_abc = _mm256_or_si256(_mm256_and_si256(a, b),
+                    _mm256_and_si256(c, _mm256_or_si256(a, b)));
+
+                h = g;
+                g = f;
+                f = e;
+                e = _mm256_add_epi32(d, t1);
+                d = c;
+                c = b;
+                b = a;
+                a = _mm256_add_epi32(t1, _mm256_add_epi32(big_zero_a, maj_abc));
+            }
+
+            v[0] = _mm256_add_epi32(v[0], a); v[1] = _mm256_add_epi32(v[1], b);
+            v[2] = _mm256_add_epi32(v[2], c); v[3] = _mm256_add_epi32(v[3], d);
+            v[4] = _mm256_add_epi32(v[4], e); v[5] = _mm256_add_epi32(v[5], f);
+            v[6] = _mm256_add_epi32(v[6], g); v[7] = _mm256_add_epi32(v[7], h);
+
+            for (int j = 0; j < 8; ++j) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(S + 8 * j), v[j]);
+            }
+        }
+
+        // GCC 12's unmasked AVX-512 rotates and shifts merge into _mm512_undefined_epi32(), which draws
+        // -Wmaybe-uninitialized. Zero-masking with every lane selected is the same instruction without it.
+        template <int N> __attribute__((target("avx512f"))) inline __m512i rotr_x16(const __m512i x) {
+            return _mm512_maskz_ror_epi32(static_cast<__mmask16>(0xFFFF), x, N);
+        }
+
+        template <int N> __attribute__((target("avx512f"))) inline __m512i shr_x16(const __m512i x) {
+            return _mm512_maskz_srli_epi32(static_cast<__mmask16>(0xFFFF), x, N);
+        }
+
+        // AVX-512 has ternary logic for the sigma functions' XORs, ch(), and maj().
+        __attribute__((target("avx512f"))) inline void compress_lanes_avx512(
+            word_t * const S, const nuwen::uc_t * const * const blocks) {
+
+            __m512i v[8];
+            __m512i W[16];
+
+            for (int j = 0; j < 8; ++j) {
+                v[j] = _mm512_loadu_si512(S + 16 * j);
+            }
+
+            __m512i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+
+            for (int i = 0; i < 64; ++i) {
+                __m512i& w = W[i % 16];
+
+                if (i < 16) {
+                    word_t x[16];
+
+                    for (int k = 0; k < 16; ++k) {
+                        x[k] = t_from_vuc_unchecked<word_t>(blocks[k] + 4 * i);
+                    }
+
+                    w = _mm512_loadu_si512(x);
+                } else {
+                    const __m512i w2 = W[(i - 2) % 16];
+                    const __m512i w15 = W[(i - 15) % 16];
+
+                    const __m512i s1 = _mm512_ternarylogic_epi32(rotr_x16<17>(w2), rotr_x16<19>(w2),
+                        shr_x16<10>(w2), 0x96);
+                    const __m512i s0 = _mm512_ternarylogic_epi32(rotr_x16<7>(w15), rotr_x16<18>(w15),
+                        shr_x16<3>(w15), 0x96);
+
+                    w = _mm512_add_epi32(_mm512_add_epi32(w, s0), _mm512_add_epi32(W[(i - 7) % 16], s1));
+                }
+
+                const __m512i big_one_e = _mm512_ternarylogic_epi32(rotr_x16<6>(e), rotr_x16<11>(e),
+                    rotr_x16<25>(e), 0x96);
+
+                const __m512i t1 = _mm512_add_epi32(_mm512_add_epi32(h, big_one_e),
+                    _mm512_add_epi32(_mm512_add_epi32(_mm512_ternarylogic_epi32(e, f, g, 0xCA), w),
+                    _mm512_set1_epi32(static_cast<int>(K[i]))));
+
+                const __m512i big_zero_a = _mm512_ternarylogic_epi32(rotr_x16<2>(a), rotr_x16<13>(a),
+                    rotr_x16<22>(a), 0x96);
+
+                h = g;
+                g = f;
+                f = e;
+                e = _mm512_add_epi32(d, t1);
+                d = c;
+                c = b;
+                b = a;
+                a = _mm512_add_epi32(t1, _mm512_add_epi32(big_zero_a, _mm512_ternarylogic_epi32(b, c, d, 0xE8)));
+            }
+
+            v[0] = _mm512_add_epi32(v[0], a); v[1] = _mm512_add_epi32(v[1], b);
+            v[2] = _mm512_add_epi32(v[2], c); v[3] = _mm512_add_epi32(v[3], d);
+            v[4] = _mm512_add_epi32(v[4], e); v[5] = _mm512_add_epi32(v[5], f);
+            v[6] = _mm512_add_epi32(v[6], g); v[7] = _mm512_add_epi32(v[7], h);
+
+            for (int j = 0; j < 8; ++j) {
+                _mm512_storeu_si512(S + 16 * j, v[j]);
+            }
+        }
+#else
+        inline bool cpu_supports(const implementation i) {
+            return i == portable;
+        }
+#endif
+
+        // Returns NULL when this machine can't use i.
+        inline compress_t compress_function(const implementation i) {
+            if (!cpu_supports(i)) {
+                return NULL;
+            }
+
+            switch (i) {
+#ifdef PHAM_SHA256_X86
+                case sha_ni: return compress_sha_ni;
+                case avx2:   return compress_avx2;
+                case ssse3:  return compress_ssse3;
+#endif
+                default:     return compress_portable;
+            }
+        }
+
+        inline implementation best_implementation() {
+            const implementation preferred[] = { sha_ni, avx2, ssse3 };
+
+            for (int i = 0; i < 3; ++i) {
+                if (compress_function(preferred[i])) {
+                    return preferred[i];
+                }
+            }
+
+            return portable;
+        }
+
+        // The choice is made once. Racing initializations would agree.
+        inline void compress(word_t * const H, const nuwen::uc_t * const p, const nuwen::vuc_s_t n) {
+            static const compress_t f = compress_function(best_implementation());
+
+            f(H, p, n);
+        }
+
+        typedef void (*compress_lanes_t)(word_t * S, const nuwen::uc_t * const * blocks);
+
+        const int MAX_LANES = 16;
+
+        // Returns NULL when this machine can't hash that many messages at once.
+        inline compress_lanes_t lanes_function(const int lanes) {
+#ifdef PHAM_SHA256_X86
+            if (lanes == 8 && cpu().avx2) {
+                return compress_lanes_avx2;
+            }
+
+            if (lanes == 16 && cpu().avx512) {
+                return compress_lanes_avx512;
+            }
+#endif
+
+            return NULL;
+        }
+
+        // Returns 0 when hashing one message at a time is best.
+        inline int best_lanes() {
+            if (lanes_function(16)) {
+                return 16;
+            }
+
+            // SHA-NI hashes one message about as quickly as AVX2 hashes eight.
+            if (cpu_supports(sha_ni)) {
+                return 0;
+            }
+
+            return lanes_function(8) ? 8 : 0;
+        }
+
+        // One message in a multi-buffer batch, followed by its padding.
+        class lane {
+        public:
+            lane() : m_p(NULL), m_index(0), m_full(0), m_blocks(0), m_next(0) { }
+
+            void start(const nuwen::view::byte_view v, const nuwen::vuc_s_t index) {
+                m_p = v.data();
+                m_index = index;
+                m_full = v.size() / 64;
+                m_next = 0;
+
+                // The final one or two blocks hold the tail, 0x80, zeros, and the big-endian bit count.
+                const nuwen::vuc_s_t n = v.size() % 64;
+
+                std::fill(m_tail, m_tail + 128, static_cast<nuwen::uc_t>(0));
+                std::copy(v.end() - n, v.end(), m_tail);
+
+                m_tail[n] = 0x80;
+
+                const nuwen::vuc_s_t tail_size = n + 9 <= 64 ? 64 : 128;
+
+                const nuwen::ull_t bits = v.size() * 8ULL;
+
+                for (int i = 0; i < 8; ++i) {
+                    m_tail[tail_size - 1 - i] = static_cast<nuwen::uc_t>(bits >> (8 * i));
+                }
+
+                m_blocks = m_full + tail_size / 64;
+            }
+
+            nuwen::vuc_s_t index() const {
+                return m_index;
+            }
+
+            const nuwen::uc_t * block() const {
+                return m_next < m_full ? m_p + 64 * m_next : m_tail + 64 * (m_next - m_full);
+            }
+
+            // Returns true when the message is finished.
+            bool advance() {
+                return ++m_next == m_blocks;
+            }
+
+        private:
+            const nuwen::uc_t * m_p;
+            nuwen::vuc_s_t      m_index;
+            nuwen::vuc_s_t      m_full;
+            nuwen::vuc_s_t      m_blocks;
+            nuwen::vuc_s_t      m_next;
+            nuwen::uc_t         m_tail[128];
+        };
+
+        // Hashes n messages, writing each 32-byte hash to out + 32 * i. Each lane takes the next message
+        // as soon as it finishes one. When most lanes have run dry, the stragglers are finished one at a time.
+        inline void hash_lanes(const compress_lanes_t f, const int lanes,
+            const nuwen::view::byte_view * const messages, const nuwen::vuc_s_t n, nuwen::uc_t * const out) {
+
+            const nuwen::uc_t idle[64] = { 0 };
+
+            word_t S[8 * MAX_LANES];
+            lane l[MAX_LANES];
+            bool busy[MAX_LANES];
+            const nuwen::uc_t * blocks[MAX_LANES];
+
+            nuwen::vuc_s_t next = 0;
+            int active = 0;
+
+            for (int k = 0; k < lanes; ++k) {
+                busy[k] = next < n;
+
+                if (busy[k]) {
+                    l[k].start(messages[next], next);
+                    ++next;
+                    ++active;
+                }
+
+                for (int j = 0; j < 8; ++j) {
+                    S[lanes * j + k] = H0[j];
+                }
+            }
+
+            while (active > 0 && (next < n || 4 * active > lanes)) {
+                for (int k = 0; k < lanes; ++k) {
+                    blocks[k] = busy[k] ? l[k].block() : idle;
+                }
+
+                f(S, blocks);
+
+                for (int k = 0; k < lanes; ++k) {
+                    if (busy[k] && l[k].advance()) {
+                        nuwen::uc_t * const hash = out + 32 * l[k].index();
+
+                        for (int i = 0; i < 32; ++i) {
+                            hash[i] = static_cast<nuwen::uc_t>(S[lanes * (i / 4) + k] >> (24 - 8 * (i % 4)));
+                        }
+
+                        busy[k] = next < n;
+
+                        if (busy[k]) {
+                            l[k].start(messages[next], next);
+                            ++next;
+                        } else {
+                            --active;
+                        }
+
+                        for (int j = 0; j < 8; ++j) {
+                            S[lanes * j + k] = H0[j];
+                        }
+                    }
+                }
+            }
+
+            for (int k = 0; k < lanes; ++k) {
+                if (busy[k]) {
+                    word_t H[8];
+
+                    for (int j = 0; j < 8; ++j) {
+                        H[j] = S[lanes * j + k];
+                    }
+
+                    do {
+                        compress(H, l[k].block(), 1);
+                    } while (!l[k].advance());
+
+                    nuwen::uc_t * const hash = out + 32 * l[k].index();
+
+                    for (int i = 0; i < 32; ++i) {
+                        hash[i] = static_cast<nuwen::uc_t>(H[i / 4] >> (24 - 8 * (i % 4)));
+                    }
+                }
+            }
+        }
     }
 }
 
 inline nuwen::vuc_t nuwen::sha256(const vuc_t& v) {
+    return sha256(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::sha256(const view::byte_view v) {
+    vuc_t hash;
+
+    sha256_into(v, hash);
+
+    return hash;
+}
+
+inline void nuwen::sha256_into(const view::byte_view v, vuc_t& dest) {
+    sha256_hasher h;
+
+    h.update(v);
+
+    h.finalize_into(dest);
+}
+
+inline void nuwen::sha256_batch_into(const std::vector<view::byte_view>& messages, vuc_t& dest) {
     using namespace pham::helper256;
 
-    word_t H[] = {
-        0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
-        0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL };
+    if (messages.empty()) {
+        return;
+    }
 
-    vuc_ci_t it  = v.begin();
-    vuc_ci_t end = v.end();
+    const vuc_s_t old_size = dest.size();
 
-    vuc_t padding;
+    dest.resize(old_size + 32 * messages.size());
 
-    while (padding.empty() || it != end) {
-        if (end - it < 64) {
-            if (!padding.empty()) {
-                throw std::logic_error("LOGIC ERROR: nuwen::sha256() - padding should be consumed cleanly.");
-            }
+    uc_t * const out = &dest[old_size];
 
-            const int k = static_cast<int>(63 - (v.size() + 8) % 64);
+    static const int lanes = best_lanes();
 
-            padding = vec(cat(vuc_t(it, end))(0x80)(vuc_t(k, 0x00))(vuc_from_ull(v.size() * 8ULL)));
+    if (lanes > 0 && messages.size() > 1) {
+        hash_lanes(lanes_function(lanes), lanes, &messages[0], messages.size(), out);
+    } else {
+        for (vuc_s_t i = 0; i < messages.size(); ++i) {
+            sha256_hasher h;
 
-            it  = padding.begin();
-            end = padding.end();
+            h.update(messages[i]);
+
+            h.finalize(out + 32 * i);
         }
+    }
+}
 
-        word_t W[64];
+inline std::vector<nuwen::vuc_t> nuwen::sha256_batch(const std::vector<vuc_t>& messages) {
+    const std::vector<view::byte_view> views(messages.begin(), messages.end());
 
-        for (int i = 0; i < 16; ++i) {
-            W[i] = ul_from_vuc(it, end);
-            it += 4;
-        }
+    vuc_t hashes;
+
+    sha256_batch_into(views, hashes);
+
+    std::vector<vuc_t> ret;
+
+    ret.reserve(messages.size());
+
+    for (vuc_ci_t i = hashes.begin(); i != hashes.end(); i += 32) {
+        ret.push_back(vuc_t(i, i + 32));
+    }
+
+    return ret;
+}
+
+inline nuwen::hmac_sha256::hmac_sha256(const view::byte_view key) {
+    // Keys longer than a block are hashed first.
+    uc_t padded[64] = { 0 };
+
+    if (key.size() > 64) {
+        sha256_hasher h;
+
+        h.update(key);
+
+        h.finalize(padded);
+    } else {
+        std::copy(key.begin(), key.end(), padded);
+    }
+
+    uc_t block[64];
+
+    for (int i = 0; i < 64; ++i) {
+        block[i] = static_cast<uc_t>(padded[i] ^ 0x36);
+    }
+
+    m_inner_start.update(view::byte_view(block, 64));
+
+    for (int i = 0; i < 64; ++i) {
+        block[i] = static_cast<uc_t>(padded[i] ^ 0x5C);
+    }
+
+    m_outer_start.update(view::byte_view(block, 64));
+
+    m_inner = m_inner_start;
+}
 
-        for (int i = 16; i < 64; ++i) {
-            W[i] = small_one(W[i - 2]) + W[i - 7] + small_zero(W[i - 15]) + W[i - 16];
+inline nuwen::vuc_t nuwen::hmac_sha256::mac(const view::byte_view message) const {
+    vuc_t ret;
+
+    mac_into(message, ret);
+
+    return ret;
+}
+
+inline void nuwen::hmac_sha256::mac_into(const view::byte_view message, vuc_t& dest) const {
+    uc_t out[32];
+
+    mac(message, out);
+
+    dest.insert(dest.end(), out, out + 32);
+}
+
+inline void nuwen::hmac_sha256::mac(const view::byte_view message, uc_t * const out) const {
+    sha256_hasher inner(m_inner_start);
+
+    inner.update(message);
+
+    inner.finalize(out);
+
+    sha256_hasher outer(m_outer_start);
+
+    outer.update(view::byte_view(out, 32));
+
+    outer.finalize(out);
+}
+
+inline bool nuwen::hmac_sha256::verify(const view::byte_view message, const view::byte_view tag) const {
+    if (tag.size() != 32) {
+        return false;
+    }
+
+    uc_t out[32];
+
+    mac(message, out);
+
+    uc_t diff = 0;
+
+    for (int i = 0; i < 32; ++i) {
+        diff |= static_cast<uc_t>(out[i] ^ tag[i]);
+    }
+
+    return diff == 0;
+}
+
+inline void nuwen::hmac_sha256::update(const view::byte_view v) {
+    m_inner.update(v);
+}
+
+inline void nuwen::hmac_sha256::finalize(uc_t * const out) {
+    m_inner.finalize(out);
+
+    m_inner = m_inner_start;
+
+    sha256_hasher outer(m_outer_start);
+
+    outer.update(view::byte_view(out, 32));
+
+    outer.finalize(out);
+}
+
+inline nuwen::vuc_t nuwen::hmac_sha256::finalize() {
+    vuc_t ret(32);
+
+    finalize(&ret[0]);
+
+    return ret;
+}
+
+inline nuwen::vuc_t nuwen::sha256_file(const std::string& filename) {
+    file::input_file f(filename);
+
+    const vuc_t ret = sha256_file(f);
+
+    f.close();
+
+    return ret;
+}
+
+inline nuwen::vuc_t nuwen::sha256_file(file::input_file& f) {
+    const vuc_s_t CHUNK_SIZE = 1048576;
+
+    sha256_hasher h;
+
+    while (true) {
+        const vuc_t chunk = f.read_at_most(CHUNK_SIZE);
+
+        h.update(chunk);
+
+        if (chunk.size() != CHUNK_SIZE) {
+            return h.finalize();
         }
+    }
+}
+
+inline const char * nuwen::sha256_implementation() {
+    using namespace pham::helper256;
+
+    switch (best_implementation()) {
+        case sha_ni: return "SHA-NI";
+        case avx2:   return "AVX2";
+        case ssse3:  return "SSSE3";
+        default:     return "portable";
+    }
+}
+
+inline nuwen::sha256_hasher::sha256_hasher() {
+    reset();
+}
+
+inline void nuwen::sha256_hasher::update(const view::byte_view v) {
+    using namespace pham::helper256;
+
+    view::byte_view::const_iterator it = v.begin();
+
+    m_size += v.size();
 
-        word_t a = H[0], b = H[1], c = H[2], d = H[3], e = H[4], f = H[5], g = H[6], h = H[7];
+    if (m_used > 0) {
+        const ul_t n = static_cast<ul_t>(std::min<vuc_s_t>(64 - m_used, v.size()));
 
-        for (int i = 0; i < 64; ++i) {
-            const word_t t1 = h + big_one(e) + ch(e, f, g) + K[i] + W[i];
-            const word_t t2 = big_zero(a) + maj(a, b, c);
+        std::copy(it, it + n, m_block + m_used);
 
-            h = g;
-            g = f;
-            f = e;
-            e = d + t1;
-            d = c;
-            c = b;
-            b = a;
-            a = t1 + t2;
+        it += n;
+        m_used += n;
+
+        if (m_used < 64) {
+            return;
         }
 
-        H[0] += a; H[1] += b; H[2] += c; H[3] += d; H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+        compress(m_H, m_block, 1);
+
+        m_used = 0;
     }
 
-    vuc_t hash;
-    hash.reserve(32);
+    // Whole blocks are hashed directly from v.
+    const vuc_s_t blocks = static_cast<vuc_s_t>(v.end() - it) / 64;
+
+    compress(m_H, it, blocks);
+
+    it += blocks * 64;
+
+    std::copy(it, v.end(), m_block);
+
+    m_used = static_cast<ul_t>(v.end() - it);
+}
+
+inline void nuwen::sha256_hasher::finalize(uc_t * const out) {
+    using namespace pham::helper256;
+
+    // The final one or two blocks hold the tail, 0x80, zeros, and the big-endian bit count.
+    m_block[m_used++] = 0x80;
+
+    if (m_used > 56) {
+        std::fill(m_block + m_used, m_block + 64, static_cast<uc_t>(0));
+
+        compress(m_H, m_block, 1);
+
+        m_used = 0;
+    }
+
+    std::fill(m_block + m_used, m_block + 56, static_cast<uc_t>(0));
+
+    const ull_t bits = m_size * 8;
 
     for (int i = 0; i < 8; ++i) {
-        hash += cat(vuc_from_ul(H[i]));
+        m_block[63 - i] = static_cast<uc_t>(bits >> (8 * i));
     }
 
+    compress(m_H, m_block, 1);
+
+    for (int i = 0; i < 32; ++i) {
+        out[i] = static_cast<uc_t>(m_H[i / 4] >> (24 - 8 * (i % 4)));
+    }
+
+    reset();
+}
+
+inline nuwen::vuc_t nuwen::sha256_hasher::finalize() {
+    vuc_t hash;
+
+    finalize_into(hash);
+
     return hash;
 }
 
+inline void nuwen::sha256_hasher::finalize_into(vuc_t& dest) {
+    uc_t hash[32];
+
+    finalize(hash);
+
+    dest.insert(dest.end(), hash, hash + 32);
+}
+
+inline void nuwen::sha256_hasher::reset() {
+    std::copy(pham::helper256::H0, pham::helper256::H0 + 8, m_H);
+
+    m_used = 0;
+    m_size = 0;
+}
+
+inline nuwen::ull_t nuwen::sha256_hasher::size() const {
+    return m_size;
+}
+
 #endif // Idempotency
@@ -4,6 +4,7 @@
 // http://boost.org/LICENSE_1_0.txt .
 
 #include "clock.hh"
+#include "file.hh"
 #include "gluon.hh"
 #include "sha256.hh"
 #include "test.hh"
@@ -11,6 +12,7 @@
 #include "vector.hh"
 
 #include "external_begin.hh"
+    #include <algorithm>
     #include <fstream>
     #include <iostream>
     #include <ostream>
@@ -25,6 +27,9 @@ using namespace std;
 using namespace boost;
 using namespace nuwen;
 using namespace nuwen::chrono;
+using namespace nuwen::file;
+
+const string TEST_FILE("foobar.tmp");
 
 bool test_hex(const string& data, const string& hash) {
     return sha256(vuc_from_hex(data)) == vuc_from_hex(hash);
@@ -50,6 +55,197 @@ bool test_speed() {
     return hash == vuc_from_hex("CEE41E98D0A6AD65CC0EC77A2BA50BF26D64DC9007F7F1C7D7DF68B8B71291A6");
 }
 
+bool test_hasher() {
+    vuc_t v(300);
+
+    for (vuc_s_t i = 0; i < v.size(); ++i) {
+        v[i] = static_cast<uc_t>(i * 37 + 11);
+    }
+
+    const vuc_s_t pieces[] = { 1, 3, 55, 56, 63, 64, 65, 300 };
+
+    sha256_hasher h;
+
+    for (vuc_s_t n = 0; n <= v.size(); n += 7) {
+        const vuc_t expected = sha256(view::byte_view(v.empty() ? NULL : &v[0], n));
+
+        for (size_t k = 0; k < sizeof pieces / sizeof pieces[0]; ++k) {
+            for (vuc_s_t i = 0; i < n; i += pieces[k]) {
+                h.update(view::byte_view(&v[i], min(pieces[k], n - i)));
+            }
+
+            if (h.size() != n || h.finalize() != expected || h.size() != 0) {
+                return false;
+            }
+        }
+    }
+
+    // finalize() resets the hasher, and an empty update() changes nothing.
+    h.update(view::byte_view(string("ab")));
+    h.update(view::byte_view());
+    h.update(view::byte_view(string("c")));
+
+    uc_t out[32];
+
+    h.finalize(out);
+
+    vuc_t dest(1, 0xFF);
+    vuc_t expected(1, 0xFF);
+
+    h.finalize_into(dest);
+    sha256_into(view::byte_view(), expected);
+
+    return vuc_t(out, out + 32) == vuc_from_hex("BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD")
+        && dest == expected;
+}
+
+bool test_implementations() {
+    using namespace pham::helper256;
+
+    vuc_t v(64 * 7);
+
+    for (vuc_s_t i = 0; i < v.size(); ++i) {
+        v[i] = static_cast<uc_t>(i * i + 5 * i + 3);
+    }
+
+    const implementation all[] = { portable, ssse3, avx2, sha_ni };
+
+    for (int i = 0; i < 4; ++i) {
+        const compress_t f = compress_function(all[i]);
+
+        if (!f) {
+            cout << "SHA-256 implementation " << i << " is unsupported here." << endl;
+            continue;
+        }
+
+        for (vuc_s_t n = 0; n <= 7; ++n) {
+            word_t expected[8];
+            word_t actual[8];
+
+            copy(H0, H0 + 8, expected);
+            copy(H0, H0 + 8, actual);
+
+            compress_portable(expected, &v[0], n);
+            f(actual, &v[0], n);
+
+            if (!equal(expected, expected + 8, actual)) {
+                return false;
+            }
+        }
+    }
+
+    cout << "SHA-256 implementation: " << sha256_implementation() << endl;
+
+    return compress_function(best_implementation()) != NULL;
+}
+
+bool test_batch() {
+    using namespace pham::helper256;
+
+    // Mixed lengths refill lanes at different times, and the longest message is finished by itself.
+    vector<vuc_t> messages(100);
+
+    for (vuc_s_t i = 0; i < messages.size(); ++i) {
+        messages[i].resize(i == 37 ? 5000 : (i * 13) % 150);
+
+        for (vuc_s_t k = 0; k < messages[i].size(); ++k) {
+            messages[i][k] = static_cast<uc_t>(i * 7 + k);
+        }
+    }
+
+    vuc_t expected;
+
+    for (vuc_s_t i = 0; i < messages.size(); ++i) {
+        sha256_into(messages[i], expected);
+    }
+
+    const vector<view::byte_view> views(messages.begin(), messages.end());
+
+    const int lanes[] = { 8, 16 };
+
+    for (int i = 0; i < 2; ++i) {
+        const compress_lanes_t f = lanes_function(lanes[i]);
+
+        if (!f) {
+            cout << "SHA-256 with " << lanes[i] << " lanes is unsupported here." << endl;
+            continue;
+        }
+
+        for (vuc_s_t n = 1; n <= views.size(); n += 33) {
+            vuc_t actual(32 * n);
+
+            hash_lanes(f, lanes[i], &views[0], n, &actual[0]);
+
+            if (!equal(actual.begin(), actual.end(), expected.begin())) {
+                return false;
+            }
+        }
+    }
+
+    const vector<vuc_t> hashes = sha256_batch(messages);
+
+    vuc_t dest(1, 0xAB);
+
+    sha256_batch_into(views, dest);
+    sha256_batch_into(vector<view::byte_view>(), dest);
+
+    return hashes.size() == messages.size() && hashes[37] == sha256(messages[37])
+        && dest.size() == 1 + expected.size() && equal(expected.begin(), expected.end(), dest.begin() + 1)
+        && sha256_batch(vector<vuc_t>()).empty();
+}
+
+bool test_files() {
+    const vuc_s_t sizes[] = { 0, 1, 1000, 1048576, 1048577, 3000000 };
+
+    for (int i = 0; i < 6; ++i) {
+        vuc_t v(sizes[i]);
+
+        for (vuc_s_t k = 0; k < v.size(); ++k) {
+            v[k] = static_cast<uc_t>(k ^ (k >> 9));
+        }
+
+        write_file(v, TEST_FILE, overwrite);
+
+        const bool streamed = sha256_file(TEST_FILE) == sha256(v);
+
+        remove_file(TEST_FILE);
+
+        if (!streamed) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool test_hmac(const vuc_t& key, const string& message, const string& expected) {
+    const hmac_sha256 h(key);
+
+    const vuc_t tag = vuc_from_hex(expected);
+
+    // Computing it in pieces, twice, also checks that finalize() starts over.
+    hmac_sha256 pieces(key);
+
+    for (int i = 0; i < 2; ++i) {
+        for (vs_s_t k = 0; k < message.size(); k += 5) {
+            pieces.update(view::byte_view(message.substr(k, 5)));
+        }
+
+        if (pieces.finalize() != tag) {
+            return false;
+        }
+    }
+
+    vuc_t wrong(tag);
+
+    wrong[31] ^= 1;
+
+    return h.mac(view::byte_view(message)) == tag
+        && h.verify(view::byte_view(message), tag)
+        && !h.verify(view::byte_view(message), wrong)
+        && !h.verify(view::byte_view(message), view::byte_view(&tag[0], 31));
+}
+
 typedef vector<pair<string, string> > vpss_t;
 typedef vpss_t::const_iterator vpss_ci_t;
 
@@ -105,6 +301,25 @@ int main() {
     NUWEN_TEST("sha256-3", sha256(vuc_t(1000000, 97)) == vuc_from_hex(
         "CDC76E5C9914FB9281A1C7E284D73E67F1809A48A497200E046D39CCC7112CD0"))
 
+    // Test hashing through a byte_view, which doesn't need a vuc_t.
+    NUWEN_TEST("sha256-3a", sha256(view::byte_view(string("abc"))) == vuc_from_hex(
+        "BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD"))
+
+    NUWEN_TEST("sha256-3b", test_hasher())
+    NUWEN_TEST("sha256-3c", test_implementations())
+    NUWEN_TEST("sha256-3d", test_batch())
+    NUWEN_TEST("sha256-3e", test_files())
+
+    // Test the RFC 4231 examples, including a key longer than a block.
+    NUWEN_TEST("sha256-3f", test_hmac(vuc_t(20, 0x0B), "Hi There",
+        "B0344C61D8DB38535CA8AFCEAF0BF12B881DC200C9833DA726E9376C2E32CFF7"))
+
+    NUWEN_TEST("sha256-3g", test_hmac(vuc_from_hex("4A656665"), "what do ya want for nothing?",
+        "5BDCC146BF60754E6A042426089575C75A003F089D2739839DEC58B964EC3843"))
+
+    NUWEN_TEST("sha256-3h", test_hmac(vuc_t(131, 0xAA), "Test Using Larger Than Block-Size Key - Hash Key First",
+        "60E431591EE0B67F0D8A26AACBF5B77F8E0BC6213728C5140546040F0EE37F54"))
+
     // Test a huge example and also gather timing information.
     NUWEN_TEST("sha256-4", test_speed())
 
@@ -0,0 +1,126 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#ifndef PHAM_SHA256_THREAD_HH
+#define PHAM_SHA256_THREAD_HH
+
+#include "compiler.hh"
+
+#ifdef NUWEN_PLATFORM_MSVC
+    #pragma once
+#endif
+
+#include "file.hh"
+#include "sha256.hh"
+#include "thread.hh"
+#include "typedef.hh"
+#include "vector.hh"
+
+#include "external_begin.hh"
+    #include <algorithm>
+    #include <stdexcept>
+    #include <string>
+    #include <vector>
+#include "external_end.hh"
+
+// These require Boost.Thread. sha256.hh alone doesn't.
+
+namespace nuwen {
+    // These compute the Merkle tree hash of RFC 6962 with leaf_size-byte leaves, which are hashed in parallel on p.
+    // A leaf's hash is sha256(0x00 + leaf) and a parent's hash is sha256(0x01 + left + right), where an odd node
+    // at the end of a level is promoted. Unlike sha256(), this depends on leaf_size.
+    // sha256_tree_file() memory-maps the whole file instead of reading it, so the file must fit in the
+    // address space. Where vuc_s_t is 32-bit, files of 4 GB or more throw; sha256_file() has no such limit.
+    inline vuc_t sha256_tree(view::byte_view v, thread::pool& p, vuc_s_t leaf_size = 1048576);
+    inline vuc_t sha256_tree_file(const std::string& filename, thread::pool& p, vuc_s_t leaf_size = 1048576);
+}
+
+namespace pham {
+    namespace helper256 {
+        class leaf_hasher {
+        public:
+            leaf_hasher(const nuwen::view::byte_view v, const nuwen::vuc_s_t leaf_size, nuwen::uc_t * const out)
+                : m_v(v), m_leaf_size(leaf_size), m_out(out) { }
+
+            void operator()(const nuwen::vuc_s_t i) const {
+                const nuwen::uc_t prefix = 0x00;
+
+                const nuwen::vuc_s_t pos = i * m_leaf_size;
+
+                nuwen::sha256_hasher h;
+
+                h.update(nuwen::view::byte_view(&prefix, 1));
+                h.update(m_v.sub(pos, std::min(m_leaf_size, m_v.size() - pos)));
+
+                h.finalize(m_out + 32 * i);
+            }
+
+        private:
+            nuwen::view::byte_view m_v;
+            nuwen::vuc_s_t         m_leaf_size;
+            nuwen::uc_t *          m_out;
+        };
+    }
+}
+
+inline nuwen::vuc_t nuwen::sha256_tree(const view::byte_view v, thread::pool& p, const vuc_s_t leaf_size) {
+    if (leaf_size == 0) {
+        throw std::logic_error("LOGIC ERROR: nuwen::sha256_tree() - leaf_size is zero.");
+    }
+
+    if (v.empty()) {
+        return sha256(v);
+    }
+
+    const vuc_s_t leaves = (v.size() - 1) / leaf_size + 1;
+
+    vuc_t level(32 * leaves);
+
+    thread::parallel_for(p, static_cast<vuc_s_t>(0), leaves, pham::helper256::leaf_hasher(v, leaf_size, &level[0]), 1);
+
+    // Each parent's message is 0x01 followed by its children's hashes. A level's parents are hashed as a batch.
+    vuc_t messages;
+    std::vector<view::byte_view> views;
+
+    while (level.size() > 32) {
+        const vuc_s_t nodes = level.size() / 32;
+
+        messages.clear();
+        views.clear();
+
+        for (vuc_s_t i = 0; i + 1 < nodes; i += 2) {
+            messages.push_back(0x01);
+            messages.insert(messages.end(), level.begin() + 32 * i, level.begin() + 32 * (i + 2));
+        }
+
+        for (vuc_s_t i = 0; i < messages.size(); i += 65) {
+            views.push_back(view::byte_view(&messages[i], 65));
+        }
+
+        vuc_t next;
+
+        sha256_batch_into(views, next);
+
+        if (nodes % 2 != 0) {
+            next.insert(next.end(), level.end() - 32, level.end());
+        }
+
+        level.swap(next);
+    }
+
+    return level;
+}
+
+inline nuwen::vuc_t nuwen::sha256_tree_file(const std::string& filename, thread::pool& p, const vuc_s_t leaf_size) {
+    file::mapped_file f(filename);
+
+    const vuc_t ret = sha256_tree(f.bytes(), p, leaf_size);
+
+    f.close();
+
+    return ret;
+}
+
+#endif // Idempotency
@@ -0,0 +1,83 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#include "file.hh"
+#include "gluon.hh"
+#include "sha256.hh"
+#include "sha256_thread.hh"
+#include "test.hh"
+#include "thread.hh"
+#include "typedef.hh"
+#include "vector.hh"
+
+#include "external_begin.hh"
+    #include <stdexcept>
+    #include <string>
+#include "external_end.hh"
+
+using namespace std;
+using namespace nuwen;
+using namespace nuwen::file;
+
+const string TEST_FILE("foobar.tmp");
+
+// RFC 6962's recursive definition, splitting at the largest power of two less than the number of leaves.
+vuc_t merkle(const view::byte_view v, const vuc_s_t leaf_size) {
+    if (v.size() <= leaf_size) {
+        return sha256(vec(cat(vuc_t(1, 0x00))(v.vuc())));
+    }
+
+    vuc_s_t k = leaf_size;
+
+    while (2 * k < v.size()) {
+        k *= 2;
+    }
+
+    return sha256(vec(cat(vuc_t(1, 0x01))(merkle(v.sub(0, k), leaf_size))(merkle(v.sub(k, v.size() - k), leaf_size))));
+}
+
+bool test_tree() {
+    thread::pool p(4);
+
+    const vuc_s_t sizes[] = { 0, 1, 1000, 1048576, 1048577, 3000000 };
+
+    for (int i = 0; i < 6; ++i) {
+        vuc_t v(sizes[i]);
+
+        for (vuc_s_t k = 0; k < v.size(); ++k) {
+            v[k] = static_cast<uc_t>(k ^ (k >> 9));
+        }
+
+        write_file(v, TEST_FILE, overwrite);
+
+        const bool tree = sha256_tree_file(TEST_FILE, p) == (v.empty() ? sha256(v) : merkle(v, 1048576))
+            && (v.size() < 1000 || sha256_tree(v, p, 100) == merkle(v, 100));
+
+        remove_file(TEST_FILE);
+
+        if (!tree) {
+            return false;
+        }
+    }
+
+    // Odd nodes are promoted, and a single leaf is still prefixed.
+    const vuc_t abc = vuc_from_hex("616263");
+
+    const vuc_t a = sha256(vuc_from_hex("0061"));
+    const vuc_t b = sha256(vuc_from_hex("0062"));
+    const vuc_t c = sha256(vuc_from_hex("0063"));
+
+    try {
+        (void) sha256_tree(abc, p, 0);
+        return false;
+    } catch (const logic_error&) { }
+
+    return sha256_tree(abc, p, 1) == sha256(vec(cat(vuc_t(1, 0x01))(sha256(vec(cat(vuc_t(1, 0x01))(a)(b))))(c)))
+        && sha256_tree(abc, p, 3) == sha256(vuc_from_hex("00616263"));
+}
+
+int main() {
+    NUWEN_TEST("sha256_thread1", test_tree())
+}
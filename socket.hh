@@ -21,11 +21,14 @@
 #include "external_begin.hh"
     #include <algorithm>
     #include <cstdlib>
+    #include <deque>
     #include <exception>
     #include <map>
+    #include <set>
     #include <stdexcept>
     #include <string>
     #include <utility>
+    #include <vector>
     #include <boost/lexical_cast.hpp>
     #include <boost/shared_ptr.hpp>
     #include <boost/utility.hpp>
@@ -33,7 +36,10 @@
 
 namespace pham {
     namespace sock {
+        class epoll_set;
         class proto_socket;
+        class uring;
+        class wake_pair;
         struct cxn_state;
     }
 }
@@ -45,6 +51,17 @@ namespace nuwen {
         const ull_t DEFAULT_TIMEOUT_MS = 30000;
         const ul_t  DEFAULT_LIMIT      = 10485760;
 
+        // How server_socket waits for its clients. default_backend is epoll_backend on Linux
+        // and select_backend elsewhere. select() can't handle more than FD_SETSIZE clients.
+        // io_uring_backend batches every receive and send of a pump into one system call.
+        // It needs Linux 5.19 and falls back to default_backend when it's unavailable.
+        enum event_backend {
+            default_backend,
+            select_backend,
+            epoll_backend,
+            io_uring_backend
+        };
+
         class client_socket {
         public:
             inline client_socket(const std::string& server, us_t port);
@@ -78,10 +95,18 @@ namespace nuwen {
 
         class server_socket : public boost::noncopyable {
         public:
+            // If reuse_port is true, the listening socket is bound with SO_REUSEPORT, so that several
+            // server_sockets can share a port with the kernel spreading connections among them.
             inline explicit server_socket(us_t port,
-                ull_t timeout_ms    = DEFAULT_TIMEOUT_MS,
-                ul_t  receive_limit = DEFAULT_LIMIT,
-                ul_t  send_limit    = DEFAULT_LIMIT);
+                ull_t         timeout_ms    = DEFAULT_TIMEOUT_MS,
+                ul_t          receive_limit = DEFAULT_LIMIT,
+                ul_t          send_limit    = DEFAULT_LIMIT,
+                event_backend backend       = default_backend,
+                bool          reuse_port    = false);
+
+            inline ~server_socket();
+
+            inline event_backend backend() const;
 
             inline std::pair<client_id, vuc_t> next_request();
 
@@ -92,23 +117,73 @@ namespace nuwen {
 
             inline void finish(client_id id);
 
-        private:
-            inline void pump(std::pair<client_id, vuc_t> * request);
-
-            inline void accept_client();
+            // This may be called from any thread. next_request() then returns an empty request from client_id(),
+            // right away if it's waiting or else once no other requests are available.
+            inline void wake();
 
+        private:
             typedef boost::shared_ptr<pham::sock::proto_socket> ptr_t;
 
             typedef std::map<client_id, boost::shared_ptr<pham::sock::cxn_state> > map_t;
             typedef map_t::iterator map_i_t;
             typedef map_t::const_iterator map_ci_t;
 
+            inline void pump(std::pair<client_id, vuc_t> * request);
+
+            inline void accept_client();
+
+            inline bool take_wake(std::pair<client_id, vuc_t> * request);
+
+            // The epoll backend keeps its descriptors registered and visits only clients with something to do.
+            // Clients are tagged with their IDs, the listener with client_id::INVALID_ID, and m_wake with this.
+            static const ull_t WAKE_TAG = 0xFFFFFFFFFFFFFFFFULL;
+
+            inline void pump_epoll(std::pair<client_id, vuc_t> * request);
+            inline void accept_clients();
+            inline bool service(client_id id, bool reading);
+            inline void reap_clients();
+            inline void erase_client(map_i_t i);
+
+            // The io_uring backend keeps a receive in flight for each client that may send a request.
+            enum uring_operation {
+                uring_accept,
+                uring_recv,
+                uring_send,
+                uring_cancel,
+                uring_wake
+            };
+
+            inline void pump_uring(std::pair<client_id, vuc_t> * request);
+            inline void complete_uring(ull_t tag, int result, ul_t flags);
+            inline void drain_uring();
+
             const ptr_t m_server;
             map_t       m_clients;
             ull_t       m_next_id;
             const ull_t m_timeout_ms;
             const ul_t  m_receive_limit;
             const ul_t  m_send_limit;
+
+            boost::shared_ptr<pham::sock::epoll_set> m_epoll;
+
+            // Clients with readiness to act on (epoll) or that need a receive submitted (io_uring).
+            std::set<client_id>    m_ready;
+            std::deque<client_id>  m_requests;   // Clients with complete requests, in arrival order.
+            std::set<client_id>    m_sending;    // Clients with data waiting to be sent.
+            std::vector<client_id> m_maybe_dead; // Clients that may have finished.
+            bool                   m_listener_readable;
+            ull_t                  m_last_sweep_clock;
+
+            // Erased clients linger here until the kernel is done with their buffers.
+            map_t                  m_closing;
+            bool                   m_accept_armed;
+            bool                   m_wake_armed;
+
+            const boost::shared_ptr<pham::sock::wake_pair> m_wake;
+            bool                                          m_woken;
+
+            // This is destroyed first, so that outstanding operations never outlive their buffers.
+            boost::shared_ptr<pham::sock::uring> m_uring;
         };
     }
 }
@@ -227,7 +302,16 @@ namespace pham {
                   m_incoming(),
                   m_length(sizeof m_length),
                   m_reading_length(true),
-                  m_receive_limit(receive_limit) { }
+                  m_receive_limit(receive_limit),
+                  m_readable(false),
+                  m_writable(false),
+                  m_queued(false),
+                  m_recv_armed(false),
+                  m_send_armed(false),
+                  m_in_flight(),
+                  m_sent(0),
+                  m_backlog(),
+                  m_backlog_pos(0) { }
 
             bool has_request() const {
                 return !m_finished && !m_reading_length && m_incoming.size() == m_length;
@@ -250,7 +334,7 @@ namespace pham {
             }
 
             bool dead() const {
-                return (m_finished && m_outgoing.empty())
+                return (m_finished && m_outgoing.empty() && m_in_flight.empty())
                     || (nuwen::clock_ctr() - m_last_request_clock) * 1000 > nuwen::clock_freq() * m_timeout_ms;
             }
 
@@ -292,6 +376,153 @@ namespace pham {
                 return false;
             }
 
+            #ifdef PHAM_SOCKET_EPOLL
+                bool can_read() const {
+                    return m_readable && !m_finished && !has_request();
+                }
+
+                // The socket is non-blocking. This reads until it would block or a request is complete,
+                // returning true when the client should be dropped.
+                bool read_some() {
+                    while (true) {
+                        const nuwen::vuc_s_t old_size = m_incoming.size();
+
+                        // Memory is committed as data arrives, not as lengths are claimed.
+                        m_incoming.resize(std::min<nuwen::vuc_s_t>(m_length, old_size + 65536));
+
+                        const ssize_t count = recv(m_socket.raw(), &m_incoming[old_size], m_incoming.size() - old_size, 0);
+
+                        if (count <= 0) {
+                            m_incoming.resize(old_size);
+
+                            if (count == -1 && errno == EINTR) {
+                                continue;
+                            }
+
+                            if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                                m_readable = false;
+                                return false;
+                            }
+
+                            return true;
+                        }
+
+                        m_incoming.resize(old_size + static_cast<nuwen::vuc_s_t>(count));
+
+                        if (m_reading_length && m_incoming.size() == m_length) {
+                            m_reading_length = false;
+
+                            m_length = nuwen::ul_from_vuc(m_incoming);
+
+                            m_incoming.clear();
+
+                            if (m_length > m_receive_limit) {
+                                return true;
+                            }
+                        }
+
+                        if (has_request()) {
+                            return false;
+                        }
+                    }
+                }
+
+                // This sends until it would block or nothing is left, returning true when the client should be dropped.
+                bool write_some() {
+                    nuwen::vuc_s_t sent = 0;
+
+                    while (sent < m_outgoing.size()) {
+                        const ssize_t count = send(m_socket.raw(), &m_outgoing[sent], m_outgoing.size() - sent, MSG_NOSIGNAL);
+
+                        if (count == -1 && errno == EINTR) {
+                            continue;
+                        }
+
+                        if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                            m_writable = false;
+                            break;
+                        }
+
+                        if (count <= 0) {
+                            return true;
+                        }
+
+                        sent += static_cast<nuwen::vuc_s_t>(count);
+                    }
+
+                    m_outgoing.erase(m_outgoing.begin(), m_outgoing.begin() + sent);
+
+                    return false;
+                }
+            #endif
+
+            #ifdef PHAM_SOCKET_URING
+                bool can_receive() const {
+                    return !m_recv_armed && !m_finished && !has_request();
+                }
+
+                // Received data can run past the end of the current request. The rest is kept in the backlog.
+                // These return true when the client should be dropped.
+                bool consume(const nuwen::uc_t * const p, const nuwen::vuc_s_t n) {
+                    if (m_backlog_pos == m_backlog.size()) {
+                        bool drop = false;
+
+                        const nuwen::vuc_s_t k = take(p, n, drop);
+
+                        m_backlog.assign(p + k, p + n);
+                        m_backlog_pos = 0;
+
+                        return drop;
+                    }
+
+                    m_backlog.insert(m_backlog.end(), p, p + n);
+
+                    return parse_backlog();
+                }
+
+                bool parse_backlog() {
+                    bool drop = false;
+
+                    if (m_backlog_pos < m_backlog.size()) {
+                        m_backlog_pos += take(&m_backlog[m_backlog_pos], m_backlog.size() - m_backlog_pos, drop);
+                    }
+
+                    if (m_backlog_pos == m_backlog.size()) {
+                        m_backlog.clear();
+                        m_backlog_pos = 0;
+                    }
+
+                    return drop;
+                }
+
+                nuwen::vuc_s_t take(const nuwen::uc_t * const p, const nuwen::vuc_s_t n, bool& drop) {
+                    nuwen::vuc_s_t i = 0;
+
+                    while (i < n && !m_finished && !has_request()) {
+                        const nuwen::vuc_s_t k = std::min<nuwen::vuc_s_t>(m_length - m_incoming.size(), n - i);
+
+                        m_incoming.insert(m_incoming.end(), p + i, p + i + k);
+
+                        i += k;
+
+                        if (m_reading_length && m_incoming.size() == m_length) {
+                            m_reading_length = false;
+
+                            m_length = nuwen::ul_from_vuc(m_incoming);
+
+                            m_incoming.clear();
+
+                            if (m_length > m_receive_limit) {
+                                drop = true;
+                                break;
+                            }
+                        }
+                    }
+
+                    return i;
+                }
+            #endif
+
             bool send_data(const wrapped_fd_set& writeset) {
                 if (writeset.contains(m_socket.raw())) {
                     if (m_outgoing.empty()) {
@@ -323,6 +554,19 @@ namespace pham {
             nuwen::ul_t        m_length;
             bool               m_reading_length;
             const nuwen::ul_t  m_receive_limit;
+
+            // These are used by the epoll backend. Readiness is edge-triggered, so it's remembered until used up.
+            bool               m_readable;
+            bool               m_writable;
+            bool               m_queued;
+
+            // These are used by the io_uring backend. m_in_flight is what the kernel is sending, starting at m_sent.
+            bool               m_recv_armed;
+            bool               m_send_armed;
+            nuwen::vuc_t       m_in_flight;
+            nuwen::vuc_s_t     m_sent;
+            nuwen::vuc_t       m_backlog;
+            nuwen::vuc_s_t     m_backlog_pos;
         };
     }
 
@@ -340,9 +584,21 @@ namespace pham {
 
     const int MAX_CLIENTS = 128;
 
-    inline boost::shared_ptr<sock::proto_socket> make_server_socket(const nuwen::us_t port) {
+    inline boost::shared_ptr<sock::proto_socket> make_server_socket(const nuwen::us_t port, const bool reuse_port = false) {
         const boost::shared_ptr<sock::proto_socket> p = make_socket();
 
+        if (reuse_port) {
+            #ifdef SO_REUSEPORT
+                const int n = 1;
+
+                if (socket_error(setsockopt(p->raw(), SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char *>(&n), sizeof n))) {
+                    throw std::runtime_error("RUNTIME ERROR: pham::make_server_socket() - setsockopt() failed.");
+                }
+            #else
+                throw std::logic_error("LOGIC ERROR: pham::make_server_socket() - SO_REUSEPORT is unavailable.");
+            #endif
+        }
+
         const addrinfo hints = { AI_PASSIVE, PF_INET, SOCK_STREAM, 0, 0, NULL, NULL, NULL };
 
         sock::address_information ai;
@@ -444,25 +700,96 @@ inline void nuwen::sock::client_socket::write(const vuc_t& v) {
     m_p->primitive_write(vec(cat(vuc_from_ul(static_cast<ul_t>(v.size())))(v)));
 }
 
-inline nuwen::sock::server_socket::server_socket(const us_t port,
-    const ull_t timeout_ms, const ul_t receive_limit, const ul_t send_limit)
-    : m_server(pham::make_server_socket(port)),
+inline nuwen::sock::server_socket::server_socket(const us_t port, const ull_t timeout_ms,
+    const ul_t receive_limit, const ul_t send_limit, const event_backend backend, const bool reuse_port)
+    : m_server(pham::make_server_socket(port, reuse_port)),
       m_clients(),
       m_next_id(client_id::FIRST_VALID_ID),
       m_timeout_ms(timeout_ms),
       m_receive_limit(receive_limit),
-      m_send_limit(send_limit) { }
+      m_send_limit(send_limit),
+      m_epoll(),
+      m_ready(),
+      m_requests(),
+      m_sending(),
+      m_maybe_dead(),
+      m_listener_readable(false),
+      m_last_sweep_clock(clock_ctr()),
+      m_closing(),
+      m_accept_armed(false),
+      m_wake_armed(false),
+      m_wake(new pham::sock::wake_pair),
+      m_woken(false),
+      m_uring() {
+
+    #ifdef PHAM_SOCKET_URING
+        if (backend == io_uring_backend) {
+            try {
+                m_uring.reset(new pham::sock::uring);
+            } catch (const std::runtime_error&) {
+                // Fall back to epoll.
+            }
+        }
+    #endif
+
+    #ifdef PHAM_SOCKET_EPOLL
+        if (backend != select_backend && !m_uring) {
+            m_epoll.reset(new pham::sock::epoll_set);
+
+            pham::sock::make_nonblocking(m_server->raw());
+
+            m_epoll->add(m_server->raw(), client_id::INVALID_ID, EPOLLIN | EPOLLET);
+
+            // This is level-triggered, so it's reported until drained.
+            m_epoll->add(m_wake->reader(), WAKE_TAG, EPOLLIN);
+        }
+    #else
+        if (backend == epoll_backend) {
+            throw std::logic_error("LOGIC ERROR: nuwen::sock::server_socket::server_socket() - epoll is unavailable.");
+        }
+    #endif
+}
+
+inline nuwen::sock::server_socket::~server_socket() {
+    if (m_uring) {
+        try {
+            drain_uring();
+        } catch (...) {
+            // Closing the ring will cancel whatever is left.
+        }
+    }
+}
+
+inline nuwen::sock::event_backend nuwen::sock::server_socket::backend() const {
+    if (m_uring) {
+        return io_uring_backend;
+    }
+
+    return m_epoll ? epoll_backend : select_backend;
+}
 
 inline std::pair<nuwen::sock::client_id, nuwen::vuc_t> nuwen::sock::server_socket::next_request() {
     std::pair<client_id, vuc_t> ret;
 
-    pump(&ret);
+    if (m_uring) {
+        pump_uring(&ret);
+    } else if (m_epoll) {
+        pump_epoll(&ret);
+    } else {
+        pump(&ret);
+    }
 
     return ret;
 }
 
 inline void nuwen::sock::server_socket::flush() {
-    pump(NULL);
+    if (m_uring) {
+        pump_uring(NULL);
+    } else if (m_epoll) {
+        pump_epoll(NULL);
+    } else {
+        pump(NULL);
+    }
 }
 
 inline void nuwen::sock::server_socket::write_continue(const client_id id, const vuc_t& v) {
@@ -476,7 +803,13 @@ inline void nuwen::sock::server_socket::write_continue(const client_id id, const
         i->second->m_outgoing += cat(vuc_from_ul(static_cast<ul_t>(v.size())))(v);
 
         if (i->second->m_outgoing.size() > m_send_limit) {
-            m_clients.erase(i);
+            erase_client(i);
+        } else if (m_epoll || m_uring) {
+            m_sending.insert(id);
+
+            if (i->second->m_writable) {
+                m_ready.insert(id);
+            }
         }
     }
 }
@@ -491,6 +824,10 @@ inline void nuwen::sock::server_socket::finish(const client_id id) {
 
     if (i != m_clients.end()) {
         i->second->m_finished = true;
+
+        if (m_epoll || m_uring) {
+            m_maybe_dead.push_back(id);
+        }
     }
 }
 
@@ -504,6 +841,10 @@ inline void nuwen::sock::server_socket::pump(std::pair<client_id, vuc_t> * const
                     return;
                 }
             }
+
+            if (take_wake(request)) {
+                return;
+            }
         }
 
         // Nuke dead clients.
@@ -525,6 +866,10 @@ inline void nuwen::sock::server_socket::pump(std::pair<client_id, vuc_t> * const
             readset.add(m_server->raw());
         }
 
+        if (request) {
+            readset.add(m_wake->reader());
+        }
+
         for (map_ci_t i = m_clients.begin(); i != m_clients.end(); ++i) {
             // If a request is wanted, try to receive data from all unfinished clients.
             if (request && !i->second->m_finished) {
@@ -559,6 +904,11 @@ inline void nuwen::sock::server_socket::pump(std::pair<client_id, vuc_t> * const
         if (readset.contains(m_server->raw())) {
             accept_client();
         }
+
+        if (readset.contains(m_wake->reader())) {
+            m_wake->drain();
+            m_woken = true;
+        }
     }
 }
 
@@ -574,4 +924,511 @@ inline void nuwen::sock::server_socket::accept_client() {
     m_clients.insert(std::make_pair(client_id(m_next_id++), p));
 }
 
+inline void nuwen::sock::server_socket::wake() {
+    m_wake->wake();
+}
+
+inline bool nuwen::sock::server_socket::take_wake(std::pair<client_id, vuc_t> * const request) {
+    if (!m_woken) {
+        return false;
+    }
+
+    m_woken = false;
+
+    *request = std::make_pair(client_id(), vuc_t());
+
+    return true;
+}
+
+inline void nuwen::sock::server_socket::pump_epoll(std::pair<client_id, vuc_t> * const request) {
+    #ifdef PHAM_SOCKET_EPOLL
+        // Timeouts are checked at most this often.
+        const ull_t SWEEP_MS = 1000;
+
+        while (true) {
+            // If a request is wanted and one exists, return it.
+            if (request) {
+                while (!m_requests.empty()) {
+                    const client_id id = m_requests.front();
+
+                    m_requests.pop_front();
+
+                    const map_i_t i = m_clients.find(id);
+
+                    if (i != m_clients.end() && i->second->has_request()) {
+                        i->second->m_queued = false;
+
+                        *request = std::make_pair(id, i->second->extract_request());
+
+                        // More data may already be waiting.
+                        if (i->second->m_readable) {
+                            m_ready.insert(id);
+                        }
+
+                        return;
+                    }
+                }
+
+                if (take_wake(request)) {
+                    return;
+                }
+            }
+
+            reap_clients();
+
+            // If we are flushing and no clients have data waiting to be sent, return.
+            if (request == NULL && m_sending.empty()) {
+                return;
+            }
+
+            // If a request is wanted, accept new clients.
+            if (request && m_listener_readable) {
+                accept_clients();
+            }
+
+            // Receive data from and send data to clients that are ready. busy means that one can do more without waiting.
+            bool busy = false;
+
+            const std::vector<client_id> ready(m_ready.begin(), m_ready.end());
+
+            for (std::vector<client_id>::const_iterator i = ready.begin(); i != ready.end(); ++i) {
+                if (service(*i, request != NULL)) {
+                    busy = true;
+                }
+            }
+
+            // Block until something interesting happens. When there's already a request to return, or nothing left
+            // to flush, events are still harvested without waiting, so that a client that keeps the queue full
+            // can't starve the listener, the other clients, the wake pipe, or the sweep.
+            const bool done = request ? !m_requests.empty() : m_sending.empty();
+
+            const int n = m_epoll->wait(busy || done ? 0 : static_cast<int>(std::min(m_timeout_ms, SWEEP_MS)));
+
+            for (int k = 0; k < n; ++k) {
+                const epoll_event& e = m_epoll->event(k);
+
+                if (e.data.u64 == client_id::INVALID_ID) {
+                    m_listener_readable = true;
+                    continue;
+                }
+
+                if (e.data.u64 == WAKE_TAG) {
+                    m_wake->drain();
+                    m_woken = true;
+                    continue;
+                }
+
+                const client_id id(e.data.u64);
+
+                const map_i_t i = m_clients.find(id);
+
+                if (i != m_clients.end()) {
+                    if (e.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                        i->second->m_readable = true;
+                    }
+
+                    if (e.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                        i->second->m_writable = true;
+                    }
+
+                    m_ready.insert(id);
+                }
+            }
+
+            if ((clock_ctr() - m_last_sweep_clock) * 1000 > clock_freq() * SWEEP_MS) {
+                m_last_sweep_clock = clock_ctr();
+
+                for (map_i_t i = m_clients.begin(); i != m_clients.end(); /* see body */) {
+                    if (i->second->dead()) {
+                        erase_client(i++);
+                    } else {
+                        ++i;
+                    }
+                }
+            }
+        }
+    #else
+        (void) request;
+    #endif
+}
+
+inline void nuwen::sock::server_socket::accept_clients() {
+    #ifdef PHAM_SOCKET_EPOLL
+        while (true) {
+            const PHAM_SOCKET t = accept4(m_server->raw(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (pham::invalid_socket(t)) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    m_listener_readable = false;
+                    return;
+                }
+
+                // The client gave up while waiting to be accepted.
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+
+                throw std::runtime_error("RUNTIME ERROR: nuwen::sock::server_socket::accept_clients() - accept4() failed.");
+            }
+
+            const boost::shared_ptr<pham::sock::cxn_state> p(new pham::sock::cxn_state(t, m_timeout_ms, m_receive_limit));
+
+            const client_id id(m_next_id++);
+
+            m_epoll->add(t, id.m_id, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+
+            m_clients.insert(std::make_pair(id, p));
+        }
+    #endif
+}
+
+inline bool nuwen::sock::server_socket::service(const client_id id, const bool reading) {
+    #ifdef PHAM_SOCKET_EPOLL
+        const map_i_t i = m_clients.find(id);
+
+        if (i == m_clients.end()) {
+            m_ready.erase(id);
+            return false;
+        }
+
+        pham::sock::cxn_state& c = *i->second;
+
+        bool drop = reading && c.can_read() && c.read_some();
+
+        if (!drop && c.m_writable && !c.m_outgoing.empty()) {
+            drop = c.write_some();
+
+            if (c.m_outgoing.empty()) {
+                m_sending.erase(id);
+            }
+        }
+
+        if (drop || c.dead()) {
+            erase_client(i);
+            return false;
+        }
+
+        if (c.has_request() && !c.m_queued) {
+            c.m_queued = true;
+            m_requests.push_back(id);
+        }
+
+        const bool can_read = c.can_read();
+        const bool can_write = c.m_writable && !c.m_outgoing.empty();
+
+        if (!can_read && !can_write) {
+            m_ready.erase(id);
+        }
+
+        return (reading && can_read) || can_write;
+    #else
+        (void) id;
+        (void) reading;
+
+        return false;
+    #endif
+}
+
+inline void nuwen::sock::server_socket::reap_clients() {
+    for (std::vector<client_id>::const_iterator k = m_maybe_dead.begin(); k != m_maybe_dead.end(); ++k) {
+        const map_i_t i = m_clients.find(*k);
+
+        if (i != m_clients.end() && i->second->dead()) {
+            erase_client(i);
+        }
+    }
+
+    m_maybe_dead.clear();
+}
+
+inline void nuwen::sock::server_socket::erase_client(const map_i_t i) {
+    m_ready.erase(i->first);
+    m_sending.erase(i->first);
+
+    #ifdef PHAM_SOCKET_URING
+        if (i->second->m_recv_armed || i->second->m_send_armed) {
+            m_uring->cancel(i->second->m_socket.raw(), uring_cancel);
+
+            m_closing.insert(*i);
+        }
+    #endif
+
+    m_clients.erase(i);
+}
+
+inline void nuwen::sock::server_socket::pump_uring(std::pair<client_id, vuc_t> * const request) {
+    #ifdef PHAM_SOCKET_URING
+        // Timeouts are checked at most this often.
+        const ull_t SWEEP_MS = 1000;
+
+        while (true) {
+            // If a request is wanted and one exists, return it.
+            if (request) {
+                while (!m_requests.empty()) {
+                    const client_id id = m_requests.front();
+
+                    m_requests.pop_front();
+
+                    const map_i_t i = m_clients.find(id);
+
+                    if (i != m_clients.end() && i->second->has_request()) {
+                        pham::sock::cxn_state& c = *i->second;
+
+                        c.m_queued = false;
+
+                        *request = std::make_pair(id, c.extract_request());
+
+                        // The next request may already be in the backlog.
+                        if (c.parse_backlog()) {
+                            erase_client(i);
+                        } else if (c.has_request()) {
+                            c.m_queued = true;
+                            m_requests.push_back(id);
+                        } else {
+                            m_ready.insert(id);
+                        }
+
+                        return;
+                    }
+                }
+
+                if (take_wake(request)) {
+                    return;
+                }
+            }
+
+            reap_clients();
+
+            // If we are flushing and no clients have data waiting to be sent, return.
+            if (request == NULL && m_sending.empty()) {
+                return;
+            }
+
+            // If a request is wanted, accept new clients and receive from clients without requests.
+            if (request) {
+                if (!m_accept_armed) {
+                    m_uring->accept(m_server->raw(), uring_accept);
+                    m_accept_armed = true;
+                }
+
+                if (!m_wake_armed) {
+                    m_uring->poll(m_wake->reader(), uring_wake);
+                    m_wake_armed = true;
+                }
+
+                for (std::set<client_id>::const_iterator k = m_ready.begin(); k != m_ready.end(); ++k) {
+                    const map_i_t i = m_clients.find(*k);
+
+                    if (i != m_clients.end() && i->second->can_receive()) {
+                        m_uring->recv(i->second->m_socket.raw(), k->m_id << 3 | uring_recv);
+                        i->second->m_recv_armed = true;
+                    }
+                }
+
+                m_ready.clear();
+            }
+
+            // Send everything that each client has waiting. Its buffer is swapped out, so it stays put while the kernel uses it.
+            for (std::set<client_id>::const_iterator k = m_sending.begin(); k != m_sending.end(); ++k) {
+                const map_i_t i = m_clients.find(*k);
+
+                if (i != m_clients.end() && !i->second->m_send_armed && !i->second->m_outgoing.empty()) {
+                    pham::sock::cxn_state& c = *i->second;
+
+                    c.m_in_flight.swap(c.m_outgoing);
+                    c.m_sent = 0;
+
+                    m_uring->send(c.m_socket.raw(), &c.m_in_flight[0], static_cast<ul_t>(c.m_in_flight.size()), k->m_id << 3 | uring_send);
+                    c.m_send_armed = true;
+                }
+            }
+
+            // Submit everything and block until something interesting happens.
+            m_uring->submit(true, std::min(m_timeout_ms, SWEEP_MS));
+
+            io_uring_cqe cqe;
+
+            while (m_uring->completion(cqe)) {
+                complete_uring(cqe.user_data, cqe.res, cqe.flags);
+            }
+
+            if ((clock_ctr() - m_last_sweep_clock) * 1000 > clock_freq() * SWEEP_MS) {
+                m_last_sweep_clock = clock_ctr();
+
+                for (map_i_t i = m_clients.begin(); i != m_clients.end(); /* see body */) {
+                    if (i->second->dead()) {
+                        erase_client(i++);
+                    } else {
+                        ++i;
+                    }
+                }
+            }
+        }
+    #else
+        (void) request;
+    #endif
+}
+
+inline void nuwen::sock::server_socket::complete_uring(const ull_t tag, const int result, const ul_t flags) {
+    #ifdef PHAM_SOCKET_URING
+        const ull_t operation = tag & 7;
+
+        if (operation == uring_cancel) {
+            return;
+        }
+
+        if (operation == uring_wake) {
+            m_wake_armed = false;
+
+            if (result >= 0) {
+                m_wake->drain();
+                m_woken = true;
+            }
+
+            return;
+        }
+
+        if (operation == uring_accept) {
+            m_accept_armed = false;
+
+            if (result >= 0) {
+                const boost::shared_ptr<pham::sock::cxn_state> p(new pham::sock::cxn_state(result, m_timeout_ms, m_receive_limit));
+
+                const client_id id(m_next_id++);
+
+                m_clients.insert(std::make_pair(id, p));
+
+                m_ready.insert(id);
+            } else if (result != -EINTR && result != -EAGAIN && result != -ECONNABORTED && result != -ECANCELED) {
+                throw std::runtime_error("RUNTIME ERROR: nuwen::sock::server_socket::complete_uring() - accept failed.");
+            }
+
+            return;
+        }
+
+        const client_id id(tag >> 3);
+
+        bool closing = false;
+
+        map_i_t i = m_clients.find(id);
+
+        if (i == m_clients.end()) {
+            i = m_closing.find(id);
+            closing = true;
+        }
+
+        const bool has_buffer = pham::sock::uring::has_buffer(flags);
+        const ul_t buffer_id = pham::sock::uring::buffer_id(flags);
+
+        if (closing && i == m_closing.end()) {
+            if (has_buffer) {
+                m_uring->recycle(buffer_id);
+            }
+
+            return;
+        }
+
+        pham::sock::cxn_state& c = *i->second;
+
+        bool drop = false;
+
+        if (operation == uring_recv) {
+            c.m_recv_armed = false;
+
+            if (has_buffer) {
+                if (!closing && result > 0) {
+                    drop = c.consume(m_uring->buffer(buffer_id), static_cast<vuc_s_t>(result));
+                }
+
+                m_uring->recycle(buffer_id);
+            }
+
+            if (closing || drop) {
+                // Nothing more to do.
+            } else if (result == -ENOBUFS || result == -EINTR || result == -EAGAIN) {
+                m_ready.insert(id);
+            } else if (result <= 0) {
+                drop = true;
+            } else if (c.has_request()) {
+                if (!c.m_queued) {
+                    c.m_queued = true;
+                    m_requests.push_back(id);
+                }
+            } else {
+                m_ready.insert(id);
+            }
+        } else {
+            c.m_send_armed = false;
+
+            if (closing) {
+                // Nothing more to do.
+            } else if (result < 0 && result != -EINTR && result != -EAGAIN) {
+                drop = true;
+            } else {
+                c.m_sent += static_cast<vuc_s_t>(std::max(result, 0));
+
+                if (c.m_sent < c.m_in_flight.size()) {
+                    m_uring->send(c.m_socket.raw(), &c.m_in_flight[c.m_sent],
+                        static_cast<ul_t>(c.m_in_flight.size() - c.m_sent), tag);
+
+                    c.m_send_armed = true;
+                } else {
+                    c.m_in_flight.clear();
+                    c.m_sent = 0;
+
+                    if (c.m_outgoing.empty()) {
+                        m_sending.erase(id);
+                    }
+                }
+            }
+        }
+
+        if (closing) {
+            if (!c.m_recv_armed && !c.m_send_armed) {
+                m_closing.erase(i);
+            }
+        } else if (drop || c.dead()) {
+            erase_client(i);
+        }
+    #else
+        (void) tag;
+        (void) result;
+        (void) flags;
+    #endif
+}
+
+inline void nuwen::sock::server_socket::drain_uring() {
+    #ifdef PHAM_SOCKET_URING
+        while (!m_clients.empty()) {
+            erase_client(m_clients.begin());
+        }
+
+        m_uring->cancel(static_cast<PHAM_SOCKET>(-1), uring_cancel);
+
+        bool progress = true;
+
+        while (progress && (m_accept_armed || m_wake_armed || !m_closing.empty())) {
+            m_uring->submit(true, 1000);
+
+            progress = false;
+
+            io_uring_cqe cqe;
+
+            while (m_uring->completion(cqe)) {
+                progress = true;
+
+                if ((cqe.user_data & 7) == uring_accept) {
+                    m_accept_armed = false;
+
+                    if (cqe.res >= 0) {
+                        close(cqe.res);
+                    }
+                } else {
+                    complete_uring(cqe.user_data, cqe.res, cqe.flags);
+                }
+            }
+        }
+    #endif
+}
+
 #endif // Idempotency
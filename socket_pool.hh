@@ -0,0 +1,583 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#ifndef PHAM_SOCKET_POOL_HH
+#define PHAM_SOCKET_POOL_HH
+
+#include "compiler.hh"
+
+#ifdef NUWEN_PLATFORM_MSVC
+    #pragma once
+#endif
+
+#include "socket.hh"
+#include "thread.hh"
+#include "typedef.hh"
+
+#include "external_begin.hh"
+    #include <deque>
+    #include <map>
+    #include <set>
+    #include <stdexcept>
+    #include <utility>
+    #include <vector>
+    #include <boost/exception_ptr.hpp>
+    #include <boost/function.hpp>
+    #include <boost/shared_ptr.hpp>
+    #include <boost/thread.hpp>
+    #include <boost/utility.hpp>
+
+    #ifdef NUWEN_PLATFORM_WINDOWS
+        #include <windows.h>
+    #endif
+
+    #ifdef __linux__
+        #include <sched.h>
+    #endif
+#include "external_end.hh"
+
+namespace pham {
+    namespace sock {
+        // Something a handler has asked the I/O loop to do.
+        struct posted_action {
+            posted_action() : m_id(), m_data(), m_write(false), m_finish(false), m_done(false) { }
+
+            nuwen::sock::client_id m_id;
+            nuwen::vuc_t           m_data;
+            bool                   m_write;
+            bool                   m_finish;
+            bool                   m_done; // The handler for m_id has returned.
+        };
+
+        // Requests behind a client's running handler.
+        struct waiting_requests {
+            waiting_requests() : m_requests(), m_bytes(0) { }
+
+            std::deque<nuwen::vuc_t> m_requests;
+            nuwen::ull_t             m_bytes; // Including a length prefix for each request.
+        };
+
+        class request_task;
+        class reactor_task;
+
+        // Pins the calling thread to the index-th processor that it may run on, wrapping around.
+        // This is a hint, so failure is ignored, as is the request on platforms without affinity.
+        inline void pin_thread(const nuwen::ul_t index) {
+            #ifdef NUWEN_PLATFORM_WINDOWS
+                DWORD_PTR process = 0;
+                DWORD_PTR system = 0;
+
+                if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system) || process == 0) {
+                    return;
+                }
+
+                nuwen::ul_t count = 0;
+
+                for (DWORD_PTR m = process; m != 0; m &= m - 1) {
+                    ++count;
+                }
+
+                DWORD_PTR m = process;
+
+                for (nuwen::ul_t k = index % count; k > 0; --k) {
+                    m &= m - 1;
+                }
+
+                SetThreadAffinityMask(GetCurrentThread(), m & ~(m - 1));
+            #elif defined(__linux__)
+                cpu_set_t allowed;
+
+                if (sched_getaffinity(0, sizeof allowed, &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+                    return;
+                }
+
+                int k = static_cast<int>(index % static_cast<nuwen::ul_t>(CPU_COUNT(&allowed)));
+
+                for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &allowed) && k-- == 0) {
+                        cpu_set_t one;
+
+                        CPU_ZERO(&one);
+                        CPU_SET(cpu, &one);
+
+                        sched_setaffinity(0, sizeof one, &one);
+
+                        return;
+                    }
+                }
+            #else
+                (void) index;
+            #endif
+        }
+    }
+}
+
+namespace nuwen {
+    namespace sock {
+        // Runs a server_socket's I/O loop on the thread that calls run(), handing each request to a worker in a pool.
+        // Handlers answer through write_continue(), write_finish(), and finish(), which may be called from any thread.
+        // Each client's requests are handled one at a time, in order, so its replies stay in order.
+        // Once a client is finished, its unhandled requests are dropped and further writes to it are ignored.
+        // A client whose requests waiting behind its handler exceed receive_limit bytes is finished.
+        // A handler that throws loses its client.
+        class pooled_server : public boost::noncopyable {
+        public:
+            typedef boost::function<void (pooled_server&, client_id, const vuc_t&)> handler_t;
+
+            inline pooled_server(us_t port, const handler_t& handler, thread::pool& workers,
+                ull_t         timeout_ms    = DEFAULT_TIMEOUT_MS,
+                ul_t          receive_limit = DEFAULT_LIMIT,
+                ul_t          send_limit    = DEFAULT_LIMIT,
+                event_backend backend       = default_backend);
+
+            // Serves requests until stop() is called. Then it waits for running handlers and sends what they wrote.
+            // If the server_socket throws, it waits for running handlers, discarding what they wrote, and rethrows.
+            inline void run();
+
+            inline void stop();
+
+            inline void write_continue(client_id id, const vuc_t& v);
+            inline void write_finish  (client_id id, const vuc_t& v);
+
+            inline void finish(client_id id);
+
+        private:
+            friend class pham::sock::request_task;
+
+            inline void post(client_id id, const vuc_t * v, bool finish, bool done);
+
+            // This runs on a worker.
+            inline void handle(client_id id, const vuc_t& request);
+
+            // These run on the I/O loop.
+            inline void dispatch(client_id id, vuc_t& request);
+            inline void submit(client_id id, vuc_t& request);
+            inline bool apply_posted(bool send);
+            inline void wait_for_handlers(bool send);
+
+            server_socket   m_server;
+            const handler_t m_handler;
+            thread::pool&   m_workers;
+            const ul_t      m_receive_limit;
+
+            boost::mutex                          m_mutex;
+            boost::condition_variable             m_posted;
+            std::deque<pham::sock::posted_action> m_actions;  // Guarded by m_mutex.
+            bool                                  m_stopping; // Guarded by m_mutex.
+
+            std::set<client_id>                               m_busy;     // Clients with a handler running.
+            std::map<client_id, pham::sock::waiting_requests> m_waiting;  // Requests behind a running handler.
+            std::set<client_id>                               m_finished; // Clients finished while a handler may be running.
+        };
+
+        // Runs one server_socket per thread, each with its own listening socket bound with SO_REUSEPORT.
+        // The kernel spreads connections among them, and nothing is shared between threads, so handlers
+        // answer directly through the server_socket that they're given. A handler that throws loses its client.
+        class reactor_server : public boost::noncopyable {
+        public:
+            typedef boost::function<void (server_socket&, client_id, const vuc_t&)> handler_t;
+
+            // If threads is 0, there's one per hardware thread. If pin is true, each thread is pinned to a processor.
+            // The listening sockets are opened here, so a port that's in use is reported here.
+            inline reactor_server(us_t port, const handler_t& handler, ul_t threads = 0, bool pin = false,
+                ull_t         timeout_ms    = DEFAULT_TIMEOUT_MS,
+                ul_t          receive_limit = DEFAULT_LIMIT,
+                ul_t          send_limit    = DEFAULT_LIMIT,
+                event_backend backend       = default_backend);
+
+            inline ul_t size() const;
+
+            // Serves requests until stop() is called, then flushes every reactor.
+            // If a reactor fails, the others are stopped and its exception is rethrown here.
+            inline void run();
+
+            inline void stop();
+
+        private:
+            friend class pham::sock::reactor_task;
+
+            inline void reactor(ul_t index);
+
+            std::vector<boost::shared_ptr<server_socket> > m_servers;
+            const handler_t                                m_handler;
+            const bool                                     m_pin;
+
+            boost::mutex         m_mutex;
+            bool                 m_stopping; // Guarded by m_mutex.
+            boost::exception_ptr m_error;    // Guarded by m_mutex.
+        };
+    }
+}
+
+namespace pham {
+    namespace sock {
+        class request_task {
+        public:
+            request_task(nuwen::sock::pooled_server& server, const nuwen::sock::client_id id,
+                const boost::shared_ptr<const nuwen::vuc_t>& request)
+                : m_server(&server), m_id(id), m_request(request) { }
+
+            void operator()() const {
+                m_server->handle(m_id, *m_request);
+            }
+
+        private:
+            nuwen::sock::pooled_server *          m_server;
+            nuwen::sock::client_id                m_id;
+            boost::shared_ptr<const nuwen::vuc_t> m_request;
+        };
+
+        class reactor_task {
+        public:
+            reactor_task(nuwen::sock::reactor_server& server, const nuwen::ul_t index) : m_server(&server), m_index(index) { }
+
+            void operator()() const {
+                m_server->reactor(m_index);
+            }
+
+        private:
+            nuwen::sock::reactor_server * m_server;
+            nuwen::ul_t                   m_index;
+        };
+    }
+}
+
+inline nuwen::sock::pooled_server::pooled_server(const us_t port, const handler_t& handler, thread::pool& workers,
+    const ull_t timeout_ms, const ul_t receive_limit, const ul_t send_limit, const event_backend backend)
+    : m_server(port, timeout_ms, receive_limit, send_limit, backend),
+      m_handler(handler),
+      m_workers(workers),
+      m_receive_limit(receive_limit),
+      m_mutex(),
+      m_posted(),
+      m_actions(),
+      m_stopping(false),
+      m_busy(),
+      m_waiting(),
+      m_finished() {
+
+    if (m_handler.empty()) {
+        throw std::logic_error("LOGIC ERROR: nuwen::sock::pooled_server::pooled_server() - handler is empty.");
+    }
+}
+
+inline void nuwen::sock::pooled_server::run() {
+    try {
+        while (true) {
+            std::pair<client_id, vuc_t> p = m_server.next_request();
+
+            if (apply_posted(true)) {
+                break;
+            }
+
+            // server_socket::wake() produces requests from client_id().
+            if (p.first != client_id()) {
+                dispatch(p.first, p.second);
+            }
+
+            // Once a finished client has no handler running, server_socket won't produce its requests again.
+            for (std::set<client_id>::iterator i = m_finished.begin(); i != m_finished.end(); /* see body */) {
+                if (m_busy.find(*i) == m_busy.end()) {
+                    m_finished.erase(i++);
+                } else {
+                    ++i;
+                }
+            }
+        }
+    } catch (...) {
+        // The server_socket has failed, so what the handlers write is discarded.
+        wait_for_handlers(false);
+        throw;
+    }
+
+    wait_for_handlers(true);
+
+    m_server.flush();
+}
+
+// Handlers refer to this object, so every one of them must return before run() does.
+inline void nuwen::sock::pooled_server::wait_for_handlers(const bool send) {
+    m_waiting.clear();
+
+    while (!m_busy.empty()) {
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+
+            while (m_actions.empty()) {
+                m_posted.wait(lock);
+            }
+        }
+
+        apply_posted(send);
+    }
+}
+
+inline void nuwen::sock::pooled_server::stop() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    m_stopping = true;
+
+    m_server.wake();
+}
+
+inline void nuwen::sock::pooled_server::write_continue(const client_id id, const vuc_t& v) {
+    post(id, &v, false, false);
+}
+
+inline void nuwen::sock::pooled_server::write_finish(const client_id id, const vuc_t& v) {
+    post(id, &v, true, false);
+}
+
+inline void nuwen::sock::pooled_server::finish(const client_id id) {
+    post(id, NULL, true, false);
+}
+
+inline void nuwen::sock::pooled_server::post(const client_id id, const vuc_t * const v, const bool finish, const bool done) {
+    // The copy is made outside the lock.
+    vuc_t data;
+
+    if (v) {
+        data = *v;
+    }
+
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    m_actions.push_back(pham::sock::posted_action());
+
+    pham::sock::posted_action& a = m_actions.back();
+
+    a.m_id = id;
+    a.m_data.swap(data);
+    a.m_write = v != NULL;
+    a.m_finish = finish;
+    a.m_done = done;
+
+    // This happens under the lock, because run() may return (and this object may be destroyed)
+    // as soon as it sees the last m_done.
+    m_server.wake();
+    m_posted.notify_all();
+}
+
+inline void nuwen::sock::pooled_server::handle(const client_id id, const vuc_t& request) {
+    try {
+        m_handler(*this, id, request);
+    } catch (...) {
+        finish(id);
+    }
+
+    post(id, NULL, false, true);
+}
+
+inline void nuwen::sock::pooled_server::dispatch(const client_id id, vuc_t& request) {
+    // This request may have been received just before its client was finished.
+    if (m_finished.find(id) != m_finished.end()) {
+        return;
+    }
+
+    if (m_busy.find(id) != m_busy.end()) {
+        pham::sock::waiting_requests& w = m_waiting[id];
+
+        w.m_bytes += request.size() + 4;
+
+        // server_socket limits each request, and this limits a client that pipelines faster than it's served.
+        if (w.m_bytes > m_receive_limit) {
+            m_waiting.erase(id);
+            m_finished.insert(id);
+            m_server.finish(id);
+            return;
+        }
+
+        w.m_requests.push_back(vuc_t());
+        w.m_requests.back().swap(request);
+    } else {
+        m_busy.insert(id);
+
+        submit(id, request);
+    }
+}
+
+// id is already in m_busy, and leaves it if no handler will run.
+inline void nuwen::sock::pooled_server::submit(const client_id id, vuc_t& request) {
+    try {
+        const boost::shared_ptr<vuc_t> p(new vuc_t);
+
+        p->swap(request);
+
+        m_workers.submit(pham::sock::request_task(*this, id, p));
+    } catch (...) {
+        m_busy.erase(id);
+        throw;
+    }
+}
+
+inline bool nuwen::sock::pooled_server::apply_posted(const bool send) {
+    std::deque<pham::sock::posted_action> actions;
+    bool stopping = false;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        actions.swap(m_actions);
+        stopping = m_stopping;
+    }
+
+    std::deque<pham::sock::posted_action>::iterator i = actions.begin();
+
+    try {
+        for ( ; i != actions.end(); ++i) {
+            // After a client is finished, its handlers have nothing more to say to it,
+            // and the requests behind them are dropped instead of being dispatched.
+            if (send && m_finished.find(i->m_id) == m_finished.end()) {
+                if (i->m_write && i->m_finish) {
+                    m_server.write_finish(i->m_id, i->m_data);
+                } else if (i->m_write) {
+                    m_server.write_continue(i->m_id, i->m_data);
+                } else if (i->m_finish) {
+                    m_server.finish(i->m_id);
+                }
+
+                if (i->m_finish) {
+                    m_finished.insert(i->m_id);
+                    m_waiting.erase(i->m_id);
+                }
+            }
+
+            if (i->m_done) {
+                const std::map<client_id, pham::sock::waiting_requests>::iterator k = m_waiting.find(i->m_id);
+
+                if (k == m_waiting.end()) {
+                    m_busy.erase(i->m_id);
+                } else {
+                    vuc_t request;
+
+                    request.swap(k->second.m_requests.front());
+
+                    k->second.m_requests.pop_front();
+                    k->second.m_bytes -= request.size() + 4;
+
+                    if (k->second.m_requests.empty()) {
+                        m_waiting.erase(k);
+                    }
+
+                    submit(i->m_id, request);
+                }
+            }
+        }
+    } catch (...) {
+        // The handlers whose actions are dropped have still returned.
+        for ( ; i != actions.end(); ++i) {
+            if (i->m_done) {
+                m_busy.erase(i->m_id);
+            }
+        }
+
+        throw;
+    }
+
+    return stopping;
+}
+
+inline nuwen::sock::reactor_server::reactor_server(const us_t port, const handler_t& handler, const ul_t threads, const bool pin,
+    const ull_t timeout_ms, const ul_t receive_limit, const ul_t send_limit, const event_backend backend)
+    : m_servers(), m_handler(handler), m_pin(pin), m_mutex(), m_stopping(false), m_error() {
+
+    if (m_handler.empty()) {
+        throw std::logic_error("LOGIC ERROR: nuwen::sock::reactor_server::reactor_server() - handler is empty.");
+    }
+
+    const ul_t n = threads == 0 ? thread::hardware_threads() : threads;
+
+    for (ul_t i = 0; i < n; ++i) {
+        m_servers.push_back(boost::shared_ptr<server_socket>(
+            new server_socket(port, timeout_ms, receive_limit, send_limit, backend, true)));
+    }
+}
+
+inline nuwen::ul_t nuwen::sock::reactor_server::size() const {
+    return static_cast<ul_t>(m_servers.size());
+}
+
+inline void nuwen::sock::reactor_server::run() {
+    boost::thread_group g;
+
+    try {
+        for (ul_t i = 0; i < size(); ++i) {
+            g.create_thread(pham::sock::reactor_task(*this, i));
+        }
+    } catch (...) {
+        stop();
+        g.join_all();
+        throw;
+    }
+
+    g.join_all();
+
+    boost::exception_ptr error;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        error = m_error;
+    }
+
+    if (error) {
+        boost::rethrow_exception(error);
+    }
+}
+
+inline void nuwen::sock::reactor_server::stop() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+
+    m_stopping = true;
+
+    for (std::vector<boost::shared_ptr<server_socket> >::const_iterator i = m_servers.begin(); i != m_servers.end(); ++i) {
+        (*i)->wake();
+    }
+}
+
+inline void nuwen::sock::reactor_server::reactor(const ul_t index) {
+    server_socket& s = *m_servers[index];
+
+    try {
+        if (m_pin) {
+            pham::sock::pin_thread(index);
+        }
+
+        while (true) {
+            std::pair<client_id, vuc_t> p = s.next_request();
+
+            // Only stop() wakes a reactor, so m_mutex is taken only then.
+            if (p.first == client_id()) {
+                boost::lock_guard<boost::mutex> lock(m_mutex);
+
+                if (m_stopping) {
+                    break;
+                }
+
+                continue;
+            }
+
+            try {
+                m_handler(s, p.first, p.second);
+            } catch (...) {
+                s.finish(p.first);
+            }
+        }
+
+        s.flush();
+    } catch (...) {
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+
+            if (!m_error) {
+                m_error = boost::current_exception();
+            }
+        }
+
+        stop();
+    }
+}
+
+#endif // Idempotency
@@ -0,0 +1,397 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#include "clock.hh"
+#include "socket.hh"
+#include "socket_pool.hh"
+#include "test.hh"
+#include "thread.hh"
+#include "typedef.hh"
+#include "vector.hh"
+
+#include "external_begin.hh"
+    #include <iostream>
+    #include <ostream>
+    #include <stdexcept>
+    #include <string>
+    #include <vector>
+    #include <boost/thread.hpp>
+#include "external_end.hh"
+
+using namespace std;
+using namespace nuwen;
+using namespace nuwen::sock;
+
+const us_t POOLED_PORT  = 47127;
+const us_t REACTOR_PORT = 47128;
+const us_t REUSE_PORT   = 47129;
+const us_t FAIR_PORT    = 47130;
+const us_t LIMIT_PORT   = 47131;
+
+// This works with pooled_server and server_socket.
+template <typename Server> void square(Server& serv, const client_id id, const vuc_t& request) {
+    const string s = string_cast<string>(request);
+
+    if (s == "bye") {
+        serv.write_finish(id, string_cast<vuc_t>("Goodbye."));
+    } else if (s == "farewell") {
+        // The client's next request arrives while this handler is still running.
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+        serv.write_finish(id, vuc_t(4194304, 'x'));
+    } else if (s == "nap") {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+        serv.write_continue(id, string_cast<vuc_t>("Yawn."));
+    } else if (s == "boom") {
+        throw runtime_error("RUNTIME ERROR: square() - Throwing on purpose.");
+    } else {
+        const ul_t n = ul_from_vuc(request);
+
+        serv.write_continue(id, vuc_from_ul(n * n));
+    }
+}
+
+template <typename Server> class serve {
+public:
+    explicit serve(Server& serv) : m_serv(&serv) { }
+
+    void operator()() const {
+        m_serv->run();
+    }
+
+private:
+    Server * m_serv;
+};
+
+// Each client pipelines its requests, so their replies must come back in order.
+class client {
+public:
+    client(const us_t port, const ul_t first, bool& ok) : m_port(port), m_first(first), m_ok(&ok) { }
+
+    void operator()() const {
+        try {
+            client_socket c("localhost", m_port);
+
+            for (ul_t i = m_first; i < m_first + 500; ++i) {
+                c.write(vuc_from_ul(i));
+            }
+
+            bool ok = true;
+
+            for (ul_t i = m_first; i < m_first + 500; ++i) {
+                ok = ok && ul_from_vuc(c.read()) == i * i;
+            }
+
+            *m_ok = ok;
+        } catch (const exception&) {
+            *m_ok = false;
+        }
+    }
+
+private:
+    us_t   m_port;
+    ul_t   m_first;
+    bool * m_ok;
+};
+
+// Set by one thread and polled by another.
+class shared_flag : public boost::noncopyable {
+public:
+    shared_flag() : m_mutex(), m_set(false) { }
+
+    void set() {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_set = true;
+    }
+
+    bool get() const {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_set;
+    }
+
+private:
+    mutable boost::mutex m_mutex;
+    bool                 m_set;
+};
+
+// Answers requests on one thread until it's woken.
+class epoll_server {
+public:
+    explicit epoll_server(server_socket& serv) : m_serv(&serv) { }
+
+    void operator()() const {
+        while (true) {
+            const pair<client_id, vuc_t> p = m_serv->next_request();
+
+            if (p.first == client_id()) {
+                return;
+            }
+
+            square(*m_serv, p.first, p.second);
+        }
+    }
+
+private:
+    server_socket * m_serv;
+};
+
+// Keeps 200 requests in flight, so that the server always has another one, until stop is set
+// or 20 seconds pass. stopped reports which happened.
+class flooder {
+public:
+    flooder(const shared_flag& stop, bool& stopped, bool& ok) : m_stop(&stop), m_stopped(&stopped), m_ok(&ok) { }
+
+    void operator()() const {
+        try {
+            client_socket c("localhost", FAIR_PORT);
+
+            ul_t sent = 0;
+            ul_t received = 0;
+
+            while (sent < 200) {
+                c.write(vuc_from_ul(sent++));
+            }
+
+            nuwen::chrono::watch w;
+
+            bool ok = true;
+
+            while (!m_stop->get() && w.seconds() < 20) {
+                ok = ok && ul_from_vuc(c.read()) == static_cast<ul_t>(received * received);
+                ++received;
+
+                c.write(vuc_from_ul(sent++));
+            }
+
+            *m_stopped = m_stop->get();
+
+            while (received < sent) {
+                ok = ok && ul_from_vuc(c.read()) == static_cast<ul_t>(received * received);
+                ++received;
+            }
+
+            *m_ok = ok;
+        } catch (const exception&) {
+            *m_ok = false;
+        }
+    }
+
+private:
+    const shared_flag * m_stop;
+    bool *              m_stopped;
+    bool *              m_ok;
+};
+
+// Connects once the flood is under way. It must be accepted and answered while the flood continues.
+class latecomer {
+public:
+    latecomer(shared_flag& done, bool& ok) : m_done(&done), m_ok(&ok) { }
+
+    void operator()() const {
+        try {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(300));
+
+            client_socket c("localhost", FAIR_PORT);
+
+            c.write(vuc_from_ul(7));
+
+            *m_ok = ul_from_vuc(c.read()) == 49;
+        } catch (const exception&) {
+            *m_ok = false;
+        }
+
+        m_done->set();
+    }
+
+private:
+    shared_flag * m_done;
+    bool *        m_ok;
+};
+
+bool test_startup() {
+    socket_startup();
+    return true;
+}
+
+bool test_clients(const us_t port) {
+    bool ok[4] = { false, false, false, false };
+
+    boost::thread_group g;
+
+    for (ul_t i = 0; i < 4; ++i) {
+        g.create_thread(client(port, i * 1000, ok[i]));
+    }
+
+    g.join_all();
+
+    return ok[0] && ok[1] && ok[2] && ok[3];
+}
+
+bool test_write_finish(const us_t port) {
+    client_socket c("localhost", port);
+
+    c.write(vuc_from_ul(12));
+    c.write(string_cast<vuc_t>("bye"));
+
+    if (ul_from_vuc(c.read()) != 144 || string_cast<string>(c.read()) != "Goodbye.") {
+        return false;
+    }
+
+    try {
+        c.read();
+    } catch (const runtime_error&) {
+        return true;
+    }
+
+    return false;
+}
+
+// pooled_server must drop the request behind a finishing handler, not answer it.
+bool test_finish_pipelined() {
+    client_socket c("localhost", POOLED_PORT);
+
+    c.write(string_cast<vuc_t>("farewell"));
+    c.write(vuc_from_ul(12));
+
+    if (c.read() != vuc_t(4194304, 'x')) {
+        return false;
+    }
+
+    try {
+        c.read();
+    } catch (const runtime_error&) {
+        return true;
+    }
+
+    return false;
+}
+
+// pooled_server finishes a client that pipelines more than receive_limit bytes behind a running handler.
+bool test_waiting_limit() {
+    {
+        client_socket c("localhost", LIMIT_PORT);
+
+        c.write(string_cast<vuc_t>("nap"));
+
+        for (ul_t i = 0; i < 100; ++i) {
+            c.write(vuc_from_ul(i));
+        }
+
+        try {
+            c.read();
+            return false;
+        } catch (const runtime_error&) { }
+    }
+
+    // Other clients are unaffected.
+    client_socket c("localhost", LIMIT_PORT);
+
+    c.write(string_cast<vuc_t>("nap"));
+    c.write(vuc_from_ul(12));
+
+    return string_cast<string>(c.read()) == "Yawn." && ul_from_vuc(c.read()) == 144;
+}
+
+bool test_throwing_handler(const us_t port) {
+    client_socket c("localhost", port);
+
+    c.write(string_cast<vuc_t>("boom"));
+
+    try {
+        c.read();
+    } catch (const runtime_error&) {
+        return true;
+    }
+
+    return false;
+}
+
+bool test_reuse_port() {
+    server_socket a(REUSE_PORT, DEFAULT_TIMEOUT_MS, DEFAULT_LIMIT, DEFAULT_LIMIT, default_backend, true);
+    server_socket b(REUSE_PORT, DEFAULT_TIMEOUT_MS, DEFAULT_LIMIT, DEFAULT_LIMIT, default_backend, true);
+
+    return true;
+}
+
+bool test_fairness() {
+    server_socket serv(FAIR_PORT, DEFAULT_TIMEOUT_MS, DEFAULT_LIMIT, DEFAULT_LIMIT, epoll_backend);
+
+    if (serv.backend() != epoll_backend) {
+        cout << "The epoll backend is unavailable here." << endl;
+        return true;
+    }
+
+    boost::thread io((epoll_server(serv)));
+
+    shared_flag done;
+
+    bool stopped = false;
+    bool flood_ok = false;
+    bool late_ok = false;
+
+    boost::thread_group g;
+
+    g.create_thread(flooder(done, stopped, flood_ok));
+    g.create_thread(latecomer(done, late_ok));
+
+    g.join_all();
+
+    serv.wake();
+    io.join();
+
+    return stopped && flood_ok && late_ok;
+}
+
+int main() {
+    NUWEN_TEST("socket_pool1", test_startup())
+
+    {
+        thread::pool workers;
+
+        pooled_server serv(POOLED_PORT, square<pooled_server>, workers);
+
+        boost::thread io((serve<pooled_server>(serv)));
+
+        NUWEN_TEST("socket_pool2", test_clients(POOLED_PORT))
+        NUWEN_TEST("socket_pool3", test_write_finish(POOLED_PORT))
+        NUWEN_TEST("socket_pool4", test_throwing_handler(POOLED_PORT))
+        NUWEN_TEST("socket_pool5", test_finish_pipelined())
+
+        serv.stop();
+        io.join();
+    }
+
+    {
+        thread::pool workers;
+
+        pooled_server serv(LIMIT_PORT, square<pooled_server>, workers, DEFAULT_TIMEOUT_MS, 256);
+
+        boost::thread io((serve<pooled_server>(serv)));
+
+        NUWEN_TEST("socket_pool6", test_waiting_limit())
+
+        serv.stop();
+        io.join();
+    }
+
+    NUWEN_TEST("socket_pool7", test_reuse_port())
+
+    {
+        reactor_server serv(REACTOR_PORT, square<server_socket>, 4, true);
+
+        boost::thread io((serve<reactor_server>(serv)));
+
+        NUWEN_TEST("socket_pool8", serv.size() == 4)
+        NUWEN_TEST("socket_pool9", test_clients(REACTOR_PORT))
+        NUWEN_TEST("socket_pool10", test_write_finish(REACTOR_PORT))
+        NUWEN_TEST("socket_pool11", test_throwing_handler(REACTOR_PORT))
+
+        serv.stop();
+        io.join();
+    }
+
+    NUWEN_TEST("socket_pool12", test_fairness())
+}
@@ -12,9 +12,25 @@
     #pragma once
 #endif
 
+#include "typedef.hh"
+
+// Linux has epoll and accept4().
+#if defined(NUWEN_PLATFORM_UNIX) && defined(__linux__)
+    #define PHAM_SOCKET_EPOLL
+
+    #ifdef __has_include
+        #if __has_include(<linux/io_uring.h>)
+            #define PHAM_SOCKET_URING_HEADER
+        #endif
+    #endif
+#endif
+
 #include "external_begin.hh"
     #include <algorithm>
+    #include <cstring>
+    #include <deque>
     #include <stdexcept>
+    #include <vector>
     #include <boost/utility.hpp>
 
     #ifdef NUWEN_PLATFORM_WINDOWS
@@ -23,6 +39,8 @@
     #endif
 
     #ifdef NUWEN_PLATFORM_UNIX
+        #include <cerrno>
+        #include <fcntl.h>
         #include <netdb.h>
         #include <netinet/in.h>
         #include <netinet/tcp.h>
@@ -32,8 +50,25 @@
         #include <sys/types.h>
         #include <unistd.h>
     #endif
+
+    #ifdef PHAM_SOCKET_EPOLL
+        #include <sys/epoll.h>
+    #endif
+
+    #ifdef PHAM_SOCKET_URING_HEADER
+        #include <csignal>
+        #include <linux/io_uring.h>
+        #include <poll.h>
+        #include <sys/mman.h>
+        #include <sys/syscall.h>
+    #endif
 #include "external_end.hh"
 
+// Provided buffer rings arrived in Linux 5.19, along with IORING_RECVSEND_POLL_FIRST.
+#if defined(PHAM_SOCKET_URING_HEADER) && defined(IORING_RECVSEND_POLL_FIRST) && defined(__NR_io_uring_setup)
+    #define PHAM_SOCKET_URING
+#endif
+
 #ifdef NUWEN_PLATFORM_WINDOWS
     typedef SOCKET PHAM_SOCKET;
 #endif
@@ -112,6 +147,495 @@ namespace pham {
             bool        m_empty;
             PHAM_SOCKET m_max;
         };
+
+        inline void make_nonblocking(const PHAM_SOCKET s) {
+            #ifdef NUWEN_PLATFORM_WINDOWS
+                u_long mode = 1;
+
+                if (socket_error(ioctlsocket(s, FIONBIO, &mode))) {
+                    throw std::runtime_error("RUNTIME ERROR: pham::sock::make_nonblocking() - ioctlsocket() failed.");
+                }
+            #endif
+
+            #ifdef NUWEN_PLATFORM_UNIX
+                const int flags = fcntl(s, F_GETFL, 0);
+
+                if (flags == -1 || fcntl(s, F_SETFL, flags | O_NONBLOCK) == -1) {
+                    throw std::runtime_error("RUNTIME ERROR: pham::sock::make_nonblocking() - fcntl() failed.");
+                }
+            #endif
+        }
+
+        inline void close_socket(const PHAM_SOCKET s) {
+            if (!invalid_socket(s)) {
+                #ifdef NUWEN_PLATFORM_WINDOWS
+                    closesocket(s);
+                #endif
+
+                #ifdef NUWEN_PLATFORM_UNIX
+                    close(s);
+                #endif
+            }
+        }
+
+        // A connected pair of non-blocking sockets. wake() can be called from any thread,
+        // making reader() readable until drain() is called.
+        class wake_pair : public boost::noncopyable {
+        public:
+            wake_pair() : m_reader(static_cast<PHAM_SOCKET>(-1)), m_writer(static_cast<PHAM_SOCKET>(-1)) {
+                try {
+                    connect_pair();
+
+                    make_nonblocking(m_reader);
+                    make_nonblocking(m_writer);
+                } catch (...) {
+                    close_socket(m_reader);
+                    close_socket(m_writer);
+                    throw;
+                }
+            }
+
+            ~wake_pair() {
+                close_socket(m_reader);
+                close_socket(m_writer);
+            }
+
+            PHAM_SOCKET reader() const {
+                return m_reader;
+            }
+
+            // If the pair is full, a wake is already pending, so failure here is harmless.
+            void wake() {
+                const char c = 0;
+
+                send(m_writer, &c, 1, 0);
+            }
+
+            void drain() {
+                char buf[64];
+
+                while (recv(m_reader, buf, sizeof buf, 0) > 0) { }
+            }
+
+        private:
+            void connect_pair() {
+                #ifdef NUWEN_PLATFORM_WINDOWS
+                    // Windows lacks socketpair(), so this connects through the loopback interface.
+                    const PHAM_SOCKET listener = socket(PF_INET, SOCK_STREAM, 0);
+
+                    if (invalid_socket(listener)) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::wake_pair::connect_pair() - socket() failed.");
+                    }
+
+                    sockaddr_in addr;
+                    int len = sizeof addr;
+
+                    std::memset(&addr, 0, sizeof addr);
+                    addr.sin_family = AF_INET;
+                    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                    addr.sin_port = 0;
+
+                    sockaddr * const p = reinterpret_cast<sockaddr *>(&addr);
+
+                    bool ok = !socket_error(bind(listener, p, sizeof addr))
+                        && !socket_error(listen(listener, 1))
+                        && !socket_error(getsockname(listener, p, &len));
+
+                    if (ok) {
+                        m_writer = socket(PF_INET, SOCK_STREAM, 0);
+                        ok = !invalid_socket(m_writer) && !socket_error(connect(m_writer, p, sizeof addr));
+                    }
+
+                    if (ok) {
+                        m_reader = accept(listener, NULL, NULL);
+                        ok = !invalid_socket(m_reader);
+                    }
+
+                    closesocket(listener);
+
+                    if (!ok) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::wake_pair::connect_pair() - Loopback connection failed.");
+                    }
+                #endif
+
+                #ifdef NUWEN_PLATFORM_UNIX
+                    PHAM_SOCKET s[2];
+
+                    if (socketpair(AF_UNIX, SOCK_STREAM, 0, s) == -1) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::wake_pair::connect_pair() - socketpair() failed.");
+                    }
+
+                    m_reader = s[0];
+                    m_writer = s[1];
+                #endif
+            }
+
+            PHAM_SOCKET m_reader;
+            PHAM_SOCKET m_writer;
+        };
+
+        #ifdef PHAM_SOCKET_EPOLL
+            // An epoll instance whose events carry a 64-bit tag instead of the descriptor.
+            class epoll_set : public boost::noncopyable {
+            public:
+                epoll_set() : m_fd(epoll_create1(EPOLL_CLOEXEC)), m_events(256) {
+                    if (m_fd == -1) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::epoll_set::epoll_set() - epoll_create1() failed.");
+                    }
+                }
+
+                ~epoll_set() {
+                    close(m_fd);
+                }
+
+                void add(const PHAM_SOCKET s, const nuwen::ull_t tag, const nuwen::ul_t events) {
+                    epoll_event e;
+
+                    e.events = events;
+                    e.data.u64 = tag;
+
+                    if (epoll_ctl(m_fd, EPOLL_CTL_ADD, s, &e) == -1) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::epoll_set::add() - epoll_ctl() failed.");
+                    }
+                }
+
+                // Returns the number of events, which are then available through event().
+                int wait(const int timeout_ms) {
+                    const int n = epoll_wait(m_fd, &m_events[0], static_cast<int>(m_events.size()), timeout_ms);
+
+                    if (n == -1) {
+                        if (errno == EINTR) {
+                            return 0;
+                        }
+
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::epoll_set::wait() - epoll_wait() failed.");
+                    }
+
+                    return n;
+                }
+
+                const epoll_event& event(const int i) const {
+                    return m_events[static_cast<std::vector<epoll_event>::size_type>(i)];
+                }
+
+            private:
+                const int                m_fd;
+                std::vector<epoll_event> m_events;
+            };
+        #endif
+
+        #ifdef PHAM_SOCKET_URING
+            // An io_uring instance with a ring of provided receive buffers, driven through raw system calls.
+            // The constructor throws std::runtime_error when the kernel can't provide what's needed.
+            class uring : public boost::noncopyable {
+            public:
+                static const nuwen::ul_t BUFFER_COUNT = 256;
+                static const nuwen::ul_t BUFFER_SIZE  = 16384;
+
+                uring()
+                    : m_fd(-1), m_sq(NULL), m_sq_size(0), m_sqes(NULL), m_sqes_size(0),
+                      m_sq_head(NULL), m_sq_tail(NULL), m_sq_mask(0), m_sq_entries(0), m_sq_array(NULL), m_sq_local_tail(0),
+                      m_cq_head(NULL), m_cq_tail(NULL), m_cq_mask(0), m_cqes(NULL),
+                      m_buf_ring(NULL), m_buffers(NULL), m_buf_tail(0) {
+
+                    try {
+                        setup();
+                    } catch (...) {
+                        release();
+                        throw;
+                    }
+                }
+
+                ~uring() {
+                    release();
+                }
+
+                // Receives into a provided buffer. The completion's flags name the buffer.
+                void recv(const PHAM_SOCKET s, const nuwen::ull_t tag) {
+                    io_uring_sqe& e = next_sqe(IORING_OP_RECV, s, tag);
+
+                    e.flags = IOSQE_BUFFER_SELECT;
+                    e.buf_group = 0;
+                }
+
+                // The data must not move until the completion arrives.
+                void send(const PHAM_SOCKET s, const nuwen::uc_t * const p, const nuwen::ul_t n, const nuwen::ull_t tag) {
+                    io_uring_sqe& e = next_sqe(IORING_OP_SEND, s, tag);
+
+                    e.addr = reinterpret_cast<nuwen::ull_t>(p);
+                    e.len = n;
+                    e.msg_flags = MSG_NOSIGNAL;
+                }
+
+                void poll(const PHAM_SOCKET s, const nuwen::ull_t tag) {
+                    io_uring_sqe& e = next_sqe(IORING_OP_POLL_ADD, s, tag);
+
+                    e.poll32_events = POLLIN;
+                }
+
+                void accept(const PHAM_SOCKET s, const nuwen::ull_t tag) {
+                    io_uring_sqe& e = next_sqe(IORING_OP_ACCEPT, s, tag);
+
+                    e.accept_flags = SOCK_CLOEXEC;
+                }
+
+                // Cancels every outstanding operation on s, or on anything if s is invalid.
+                void cancel(const PHAM_SOCKET s, const nuwen::ull_t tag) {
+                    io_uring_sqe& e = next_sqe(IORING_OP_ASYNC_CANCEL, s, tag);
+
+                    e.cancel_flags = invalid_socket(s) ? IORING_ASYNC_CANCEL_ANY : IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+                }
+
+                // Submits everything queued with a single system call, waiting up to timeout_ms for a completion if wait is true.
+                // Completions already set aside by next_sqe() count, so it doesn't wait for more.
+                void submit(const bool wait, const nuwen::ull_t timeout_ms) {
+                    const bool block = wait && m_reaped.empty();
+
+                    const nuwen::ul_t pending = m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+
+                    if (pending == 0 && !block) {
+                        return;
+                    }
+
+                    __kernel_timespec ts;
+
+                    ts.tv_sec = static_cast<__kernel_time64_t>(timeout_ms / 1000);
+                    ts.tv_nsec = static_cast<__kernel_time64_t>(timeout_ms % 1000 * 1000000);
+
+                    io_uring_getevents_arg arg;
+
+                    std::memset(&arg, 0, sizeof arg);
+                    arg.sigmask_sz = _NSIG / 8;
+                    arg.ts = reinterpret_cast<nuwen::ull_t>(&ts);
+
+                    const nuwen::ul_t flags = block ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0;
+
+                    if (syscall(__NR_io_uring_enter, m_fd, pending, block ? 1U : 0U, flags, block ? &arg : NULL, sizeof arg) == -1
+                        && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::uring::submit() - io_uring_enter() failed.");
+                    }
+                }
+
+                // Copies the oldest completion into cqe, returning false if there isn't one.
+                bool completion(io_uring_cqe& cqe) {
+                    if (!m_reaped.empty()) {
+                        cqe = m_reaped.front();
+                        m_reaped.pop_front();
+                        return true;
+                    }
+
+                    return completion_from_ring(cqe);
+                }
+
+                // These decode a completion's flags.
+                static bool has_buffer(const nuwen::ul_t flags) {
+                    return (flags & IORING_CQE_F_BUFFER) != 0;
+                }
+
+                static nuwen::ul_t buffer_id(const nuwen::ul_t flags) {
+                    return flags >> IORING_CQE_BUFFER_SHIFT;
+                }
+
+                const nuwen::uc_t * buffer(const nuwen::ul_t id) const {
+                    return m_buffers + id * BUFFER_SIZE;
+                }
+
+                // Hands a buffer back to the kernel.
+                void recycle(const nuwen::ul_t id) {
+                    io_uring_buf& b = m_buf_ring[m_buf_tail & (BUFFER_COUNT - 1)];
+
+                    b.addr = reinterpret_cast<nuwen::ull_t>(buffer(id));
+                    b.len = BUFFER_SIZE;
+                    b.bid = static_cast<nuwen::us_t>(id);
+
+                    ++m_buf_tail;
+
+                    // The ring's tail overlays the first entry's resv field.
+                    __atomic_store_n(&m_buf_ring[0].resv, m_buf_tail, __ATOMIC_RELEASE);
+                }
+
+            private:
+                static void * map(const size_t n, const int fd, const off_t offset) {
+                    void * const p = fd == -1
+                        ? mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+                        : mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+
+                    if (p == MAP_FAILED) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::uring::map() - mmap() failed.");
+                    }
+
+                    return p;
+                }
+
+                void setup() {
+                    io_uring_params params;
+
+                    std::memset(&params, 0, sizeof params);
+                    params.flags = IORING_SETUP_CQSIZE;
+                    params.cq_entries = 4 * BUFFER_COUNT;
+
+                    m_fd = static_cast<int>(syscall(__NR_io_uring_setup, BUFFER_COUNT, &params));
+
+                    if (m_fd == -1) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::uring::setup() - io_uring_setup() failed.");
+                    }
+
+                    const nuwen::ul_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+
+                    if ((params.features & needed) != needed) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::uring::setup() - The kernel is too old.");
+                    }
+
+                    // With IORING_FEAT_SINGLE_MMAP, one mapping holds both rings.
+                    m_sq_size = std::max(params.sq_off.array + params.sq_entries * sizeof(__u32),
+                        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+                    m_sq = static_cast<char *>(map(m_sq_size, m_fd, IORING_OFF_SQ_RING));
+
+                    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+                    m_sqes = static_cast<io_uring_sqe *>(map(m_sqes_size, m_fd, IORING_OFF_SQES));
+
+                    m_sq_head    = reinterpret_cast<__u32 *>(m_sq + params.sq_off.head);
+                    m_sq_tail    = reinterpret_cast<__u32 *>(m_sq + params.sq_off.tail);
+                    m_sq_mask    = *reinterpret_cast<__u32 *>(m_sq + params.sq_off.ring_mask);
+                    m_sq_entries = params.sq_entries;
+                    m_sq_array   = reinterpret_cast<__u32 *>(m_sq + params.sq_off.array);
+
+                    m_sq_local_tail = *m_sq_tail;
+
+                    m_cq_head    = reinterpret_cast<__u32 *>(m_sq + params.cq_off.head);
+                    m_cq_tail    = reinterpret_cast<__u32 *>(m_sq + params.cq_off.tail);
+                    m_cq_mask    = *reinterpret_cast<__u32 *>(m_sq + params.cq_off.ring_mask);
+                    m_cqes       = reinterpret_cast<io_uring_cqe *>(m_sq + params.cq_off.cqes);
+
+                    // io_uring_buf_ring's flexible array member is laid out differently by C++, so the ring is addressed as an array.
+                    m_buf_ring = static_cast<io_uring_buf *>(map(BUFFER_COUNT * sizeof(io_uring_buf), -1, 0));
+                    m_buffers = static_cast<nuwen::uc_t *>(map(BUFFER_COUNT * BUFFER_SIZE, -1, 0));
+
+                    io_uring_buf_reg reg;
+
+                    std::memset(&reg, 0, sizeof reg);
+                    reg.ring_addr = reinterpret_cast<nuwen::ull_t>(m_buf_ring);
+                    reg.ring_entries = BUFFER_COUNT;
+                    reg.bgid = 0;
+
+                    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::sock::uring::setup() - IORING_REGISTER_PBUF_RING failed.");
+                    }
+
+                    for (nuwen::ul_t i = 0; i < BUFFER_COUNT; ++i) {
+                        recycle(i);
+                    }
+                }
+
+                void release() {
+                    // Operations still outstanding are cancelled when the ring is closed.
+                    if (m_fd != -1) {
+                        close(m_fd);
+                    }
+
+                    if (m_buffers) {
+                        munmap(m_buffers, BUFFER_COUNT * BUFFER_SIZE);
+                    }
+
+                    if (m_buf_ring) {
+                        munmap(m_buf_ring, BUFFER_COUNT * sizeof(io_uring_buf));
+                    }
+
+                    if (m_sqes) {
+                        munmap(m_sqes, m_sqes_size);
+                    }
+
+                    if (m_sq) {
+                        munmap(m_sq, m_sq_size);
+                    }
+                }
+
+                // These read the rings directly, without the completions that next_sqe() set aside.
+                bool sq_full() const {
+                    return m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == m_sq_entries;
+                }
+
+                bool completion_from_ring(io_uring_cqe& cqe) {
+                    const nuwen::ul_t head = *m_cq_head;
+
+                    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+                        return false;
+                    }
+
+                    cqe = m_cqes[head & m_cq_mask];
+
+                    __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+                    return true;
+                }
+
+                io_uring_sqe& next_sqe(const nuwen::uc_t opcode, const PHAM_SOCKET s, const nuwen::ull_t tag) {
+                    // If the submission queue is full, hand it to the kernel first. The kernel refuses
+                    // submissions with EBUSY while the completion queue is overflowing, so if that didn't
+                    // make room, move the completions aside (completion() returns them first) and retry.
+                    if (sq_full()) {
+                        submit(false, 0);
+
+                        if (sq_full()) {
+                            io_uring_cqe cqe;
+
+                            while (completion_from_ring(cqe)) {
+                                m_reaped.push_back(cqe);
+                            }
+
+                            submit(false, 0);
+
+                            if (sq_full()) {
+                                throw std::runtime_error("RUNTIME ERROR: pham::sock::uring::next_sqe() - Submission queue full.");
+                            }
+                        }
+                    }
+
+                    const nuwen::ul_t index = m_sq_local_tail & m_sq_mask;
+
+                    io_uring_sqe& e = m_sqes[index];
+
+                    std::memset(&e, 0, sizeof e);
+                    e.opcode = opcode;
+                    e.fd = s;
+                    e.user_data = tag;
+
+                    m_sq_array[index] = index;
+
+                    ++m_sq_local_tail;
+
+                    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+                    return e;
+                }
+
+                int                 m_fd;
+
+                char *              m_sq;
+                size_t              m_sq_size;
+                io_uring_sqe *      m_sqes;
+                size_t              m_sqes_size;
+
+                __u32 *             m_sq_head;
+                __u32 *             m_sq_tail;
+                __u32               m_sq_mask;
+                __u32               m_sq_entries;
+                __u32 *             m_sq_array;
+                __u32               m_sq_local_tail;
+
+                __u32 *             m_cq_head;
+                __u32 *             m_cq_tail;
+                __u32               m_cq_mask;
+                io_uring_cqe *      m_cqes;
+
+                io_uring_buf *      m_buf_ring;
+                nuwen::uc_t *       m_buffers;
+                __u16               m_buf_tail;
+
+                std::deque<io_uring_cqe> m_reaped;
+            };
+        #endif
     }
 }
 
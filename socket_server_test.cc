@@ -9,6 +9,7 @@
 #include "vector.hh"
 
 #include "external_begin.hh"
+    #include <cstdlib>
     #include <iostream>
     #include <map>
     #include <ostream>
@@ -56,8 +57,8 @@ map<string, client_id> get_ids(server_socket& serv) {
     return ret;
 }
 
-bool test_server() {
-    server_socket serv(47123);
+bool test_server(const event_backend backend) {
+    server_socket serv(47123, DEFAULT_TIMEOUT_MS, DEFAULT_LIMIT, DEFAULT_LIMIT, backend);
 
     string dummy;
     getline(cin, dummy);
@@ -142,7 +143,26 @@ bool test_server() {
     return true;
 }
 
-int main() {
+bool test_select_backend() {
+    server_socket serv(47124, DEFAULT_TIMEOUT_MS, DEFAULT_LIMIT, DEFAULT_LIMIT, select_backend);
+
+    return serv.backend() == select_backend;
+}
+
+int main(int argc, char * argv[]) {
+    event_backend backend = default_backend;
+
+    if (argc == 2 && string(argv[1]) == "select") {
+        backend = select_backend;
+    } else if (argc == 2 && string(argv[1]) == "epoll") {
+        backend = epoll_backend;
+    } else if (argc == 2 && string(argv[1]) == "io_uring") {
+        backend = io_uring_backend;
+    } else if (argc != 1) {
+        cout << "USAGE: socket_server_test [select|epoll|io_uring]" << endl;
+        return EXIT_FAILURE;
+    }
+
     cout << "USAGE: While running socket_server_test, independently run these:" << endl;
     cout << "socket_client_test 1" << endl;
     cout << "socket_client_test 2" << endl;
@@ -150,5 +170,6 @@ int main() {
     cout << "And then press Enter in socket_server_test." << endl;
 
     NUWEN_TEST("socket_server1", test_startup())
-    NUWEN_TEST("socket_server2", test_server())
+    NUWEN_TEST("socket_server2", test_server(backend))
+    NUWEN_TEST("socket_server3", test_select_backend())
 }
@@ -0,0 +1,583 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#ifndef PHAM_THREAD_HH
+#define PHAM_THREAD_HH
+
+#include "compiler.hh"
+
+#ifdef NUWEN_PLATFORM_MSVC
+    #pragma once
+#endif
+
+#include "typedef.hh"
+
+#include "external_begin.hh"
+    #include <deque>
+    #include <stdexcept>
+    #include <vector>
+    #include <boost/exception_ptr.hpp>
+    #include <boost/function.hpp>
+    #include <boost/optional.hpp>
+    #include <boost/shared_ptr.hpp>
+    #include <boost/thread.hpp>
+    #include <boost/utility.hpp>
+#include "external_end.hh"
+
+namespace pham {
+    namespace thread {
+        typedef boost::function<void ()> task_t;
+
+        // Each worker owns a queue. It pushes and pops at the back; thieves take from the front.
+        struct queue : public boost::noncopyable {
+            explicit queue(const nuwen::ul_t index) : m_index(index) { }
+
+            const nuwen::ul_t  m_index;
+            boost::mutex       m_mutex;
+            std::deque<task_t> m_tasks;
+        };
+
+        inline void leave_queue_alone(queue *) { }
+
+        struct group_state;
+
+        template <typename T> struct future_state;
+    }
+}
+
+namespace nuwen {
+    namespace thread {
+        // The number of hardware threads, or 1 if that can't be determined.
+        inline ul_t hardware_threads();
+
+        class pool : public boost::noncopyable {
+        public:
+            // Sized to the hardware. If max_threads is nonzero, at most max_threads workers are started.
+            inline explicit pool(ul_t max_threads = 0);
+
+            // Finishes every submitted task, then joins the workers.
+            inline ~pool();
+
+            inline ul_t size() const;
+
+            // A task submitted by a worker goes into that worker's own queue; idle workers steal.
+            // Exceptions that escape a task are discarded; task_group and future report them.
+            inline void submit(const boost::function<void ()>& task);
+
+            // Runs one pending task on the calling thread, returning false if there was nothing to run.
+            // Waiting in a task_group or future does this, so that waiting inside a task can't starve the pool.
+            inline bool run_pending_task();
+
+        private:
+            struct worker {
+                worker(pool * const p, const ul_t index) : m_p(p), m_index(index) { }
+
+                void operator()() const {
+                    m_p->work(m_index);
+                }
+
+                pool * m_p;
+                ul_t   m_index;
+            };
+
+            friend struct worker;
+
+            inline void work(ul_t index);
+            inline bool pop(pham::thread::task_t& task);
+            inline void stop();
+
+            std::vector<boost::shared_ptr<pham::thread::queue> > m_queues;
+            boost::thread_specific_ptr<pham::thread::queue>     m_current; // NULL outside of this pool's workers.
+            boost::mutex                                         m_mutex;
+            boost::condition_variable                            m_wake;
+            ul_t                                                 m_pending; // Submitted, but not yet popped.
+            ul_t                                                 m_next;    // Where outside submissions go.
+            bool                                                 m_stopping;
+            boost::thread_group                                  m_threads;
+        };
+
+        // A process-wide pool, sized to the hardware and created on first use.
+        inline pool& default_pool();
+
+        class task_group : public boost::noncopyable {
+        public:
+            inline explicit task_group(pool& p);
+
+            // Waits, discarding exceptions. Call wait() to observe them.
+            inline ~task_group();
+
+            inline void run(const boost::function<void ()>& f);
+
+            // Waits for every task run so far, helping the pool while it waits.
+            // Rethrows the first exception thrown by any of them.
+            inline void wait();
+
+        private:
+            pool&                                        m_pool;
+            boost::shared_ptr<pham::thread::group_state> m_state;
+        };
+
+        template <typename T> class future {
+        public:
+            future() : m_pool(NULL), m_state() { }
+
+            // Use async() instead.
+            future(pool& p, const boost::shared_ptr<pham::thread::future_state<T> >& state)
+                : m_pool(&p), m_state(state) { }
+
+            bool valid() const {
+                return m_state.get() != NULL;
+            }
+
+            inline bool ready() const;
+
+            // Waits for the result, helping the pool while it waits.
+            // Rethrows the exception thrown by the task, if any.
+            inline T get() const;
+
+        private:
+            pool *                                            m_pool;
+            boost::shared_ptr<pham::thread::future_state<T> > m_state;
+        };
+
+        // T must be given explicitly, as in async<int>(p, f).
+        template <typename T> future<T> async(pool& p, const boost::function<T ()>& f);
+
+        // Calls body(i) for each i in [first, last). Indices are handed out in chunks of at least
+        // grain, and each chunk gets its own copy of body. Rethrows the first exception thrown by body.
+        template <typename Integer, typename Body> void parallel_for(pool& p,
+            Integer first, Integer last, const Body& body, ull_t grain = 1);
+    }
+}
+
+namespace pham {
+    namespace thread {
+        struct group_state : public boost::noncopyable {
+            group_state() : m_outstanding(0) { }
+
+            boost::mutex              m_mutex;
+            boost::condition_variable m_done;
+            nuwen::ul_t               m_outstanding;
+            boost::exception_ptr      m_error;
+        };
+
+        class group_task {
+        public:
+            group_task(const boost::shared_ptr<group_state>& state, const task_t& f) : m_state(state), m_f(f) { }
+
+            void operator()() const {
+                boost::exception_ptr error;
+
+                try {
+                    m_f();
+                } catch (...) {
+                    error = boost::current_exception();
+                }
+
+                boost::lock_guard<boost::mutex> lock(m_state->m_mutex);
+
+                if (error && !m_state->m_error) {
+                    m_state->m_error = error;
+                }
+
+                if (--m_state->m_outstanding == 0) {
+                    m_state->m_done.notify_all();
+                }
+            }
+
+        private:
+            boost::shared_ptr<group_state> m_state;
+            task_t                         m_f;
+        };
+
+        template <typename T> struct value_holder {
+            void set(const boost::function<T ()>& f) {
+                m_value = f();
+            }
+
+            T get() const {
+                return *m_value;
+            }
+
+            boost::optional<T> m_value;
+        };
+
+        template <> struct value_holder<void> {
+            void set(const boost::function<void ()>& f) {
+                f();
+            }
+
+            void get() const { }
+        };
+
+        template <typename T> struct future_state : public boost::noncopyable {
+            explicit future_state(const boost::function<T ()>& f) : m_f(f), m_done(false) { }
+
+            boost::function<T ()>     m_f;
+            boost::mutex              m_mutex;
+            boost::condition_variable m_cv;
+            bool                      m_done;
+            value_holder<T>           m_holder; // Written before m_done is set, read after.
+            boost::exception_ptr      m_error;
+        };
+
+        template <typename T> class future_task {
+        public:
+            explicit future_task(const boost::shared_ptr<future_state<T> >& state) : m_state(state) { }
+
+            void operator()() const {
+                try {
+                    m_state->m_holder.set(m_state->m_f);
+                } catch (...) {
+                    m_state->m_error = boost::current_exception();
+                }
+
+                m_state->m_f.clear(); // Release whatever the task was holding on to.
+
+                {
+                    boost::lock_guard<boost::mutex> lock(m_state->m_mutex);
+                    m_state->m_done = true;
+                }
+
+                m_state->m_cv.notify_all();
+            }
+
+        private:
+            boost::shared_ptr<future_state<T> > m_state;
+        };
+
+        template <typename Integer, typename Body> class chunk_task {
+        public:
+            chunk_task(const Integer first, const Integer last, const Body& body)
+                : m_first(first), m_last(last), m_body(body) { }
+
+            void operator()() {
+                for (Integer i = m_first; i != m_last; ++i) {
+                    m_body(i);
+                }
+            }
+
+        private:
+            Integer m_first;
+            Integer m_last;
+            Body    m_body;
+        };
+
+        inline nuwen::thread::pool *& default_pool_ptr() {
+            static nuwen::thread::pool * p = NULL;
+            return p;
+        }
+
+        inline void make_default_pool() {
+            static nuwen::thread::pool p;
+            default_pool_ptr() = &p;
+        }
+    }
+}
+
+inline nuwen::ul_t nuwen::thread::hardware_threads() {
+    const ul_t n = boost::thread::hardware_concurrency();
+
+    return n == 0 ? 1 : n;
+}
+
+inline nuwen::thread::pool::pool(const ul_t max_threads)
+    : m_queues(), m_current(pham::thread::leave_queue_alone), m_mutex(), m_wake(),
+    m_pending(0), m_next(0), m_stopping(false), m_threads() {
+
+    ul_t n = hardware_threads();
+
+    if (max_threads != 0 && max_threads < n) {
+        n = max_threads;
+    }
+
+    for (ul_t i = 0; i < n; ++i) {
+        m_queues.push_back(boost::shared_ptr<pham::thread::queue>(new pham::thread::queue(i)));
+    }
+
+    try {
+        for (ul_t i = 0; i < n; ++i) {
+            m_threads.create_thread(worker(this, i));
+        }
+    } catch (...) {
+        stop();
+        throw;
+    }
+}
+
+inline nuwen::thread::pool::~pool() {
+    stop();
+}
+
+inline nuwen::ul_t nuwen::thread::pool::size() const {
+    return static_cast<ul_t>(m_queues.size());
+}
+
+inline void nuwen::thread::pool::submit(const boost::function<void ()>& task) {
+    if (task.empty()) {
+        throw std::logic_error("LOGIC ERROR: nuwen::thread::pool::submit() - task is empty.");
+    }
+
+    pham::thread::queue * q = m_current.get();
+
+    {
+        // m_pending is incremented before the push, so that it never underflows.
+        // A worker that sees a pending task it can't find yet simply looks again.
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        ++m_pending;
+
+        if (!q) {
+            q = m_queues[m_next++ % m_queues.size()].get();
+        }
+    }
+
+    try {
+        boost::lock_guard<boost::mutex> lock(q->m_mutex);
+        q->m_tasks.push_back(task);
+    } catch (...) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        --m_pending;
+        throw;
+    }
+
+    m_wake.notify_one();
+}
+
+inline bool nuwen::thread::pool::run_pending_task() {
+    pham::thread::task_t task;
+
+    if (!pop(task)) {
+        return false;
+    }
+
+    try {
+        task();
+    } catch (...) { }
+
+    return true;
+}
+
+inline void nuwen::thread::pool::work(const ul_t index) {
+    m_current.reset(m_queues[index].get());
+
+    while (true) {
+        if (run_pending_task()) {
+            continue;
+        }
+
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+
+        if (m_pending != 0) {
+            lock.unlock();
+            boost::this_thread::yield();
+        } else if (m_stopping) {
+            return;
+        } else {
+            m_wake.wait(lock);
+        }
+    }
+}
+
+inline bool nuwen::thread::pool::pop(pham::thread::task_t& task) {
+    pham::thread::queue * const own = m_current.get();
+
+    bool found = false;
+
+    if (own) {
+        boost::lock_guard<boost::mutex> lock(own->m_mutex);
+
+        if (!own->m_tasks.empty()) {
+            task.swap(own->m_tasks.back());
+            own->m_tasks.pop_back();
+            found = true;
+        }
+    }
+
+    // Steal from the others, starting with the next worker over.
+    const vuc_s_t n = m_queues.size();
+    const vuc_s_t start = own ? own->m_index + 1 : 0;
+
+    for (vuc_s_t k = 0; !found && k < n; ++k) {
+        pham::thread::queue& q = *m_queues[(start + k) % n];
+
+        boost::lock_guard<boost::mutex> lock(q.m_mutex);
+
+        if (!q.m_tasks.empty()) {
+            task.swap(q.m_tasks.front());
+            q.m_tasks.pop_front();
+            found = true;
+        }
+    }
+
+    if (found) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        --m_pending;
+    }
+
+    return found;
+}
+
+inline void nuwen::thread::pool::stop() {
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+
+    m_wake.notify_all();
+
+    m_threads.join_all();
+}
+
+inline nuwen::thread::pool& nuwen::thread::default_pool() {
+    static boost::once_flag flag = BOOST_ONCE_INIT;
+
+    boost::call_once(pham::thread::make_default_pool, flag);
+
+    return *pham::thread::default_pool_ptr();
+}
+
+inline nuwen::thread::task_group::task_group(pool& p)
+    : m_pool(p), m_state(new pham::thread::group_state) { }
+
+inline nuwen::thread::task_group::~task_group() {
+    try {
+        wait();
+    } catch (...) { }
+}
+
+inline void nuwen::thread::task_group::run(const boost::function<void ()>& f) {
+    if (f.empty()) {
+        throw std::logic_error("LOGIC ERROR: nuwen::thread::task_group::run() - f is empty.");
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_state->m_mutex);
+        ++m_state->m_outstanding;
+    }
+
+    try {
+        m_pool.submit(pham::thread::group_task(m_state, f));
+    } catch (...) {
+        boost::lock_guard<boost::mutex> lock(m_state->m_mutex);
+        --m_state->m_outstanding;
+        throw;
+    }
+}
+
+inline void nuwen::thread::task_group::wait() {
+    while (true) {
+        {
+            boost::lock_guard<boost::mutex> lock(m_state->m_mutex);
+
+            if (m_state->m_outstanding == 0) {
+                break;
+            }
+        }
+
+        if (!m_pool.run_pending_task()) {
+            // Nothing is queued, so the rest of the group is already running elsewhere.
+            boost::unique_lock<boost::mutex> lock(m_state->m_mutex);
+
+            while (m_state->m_outstanding != 0) {
+                m_state->m_done.wait(lock);
+            }
+        }
+    }
+
+    boost::exception_ptr error;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_state->m_mutex);
+        error = m_state->m_error;
+        m_state->m_error = boost::exception_ptr();
+    }
+
+    if (error) {
+        boost::rethrow_exception(error);
+    }
+}
+
+template <typename T> inline bool nuwen::thread::future<T>::ready() const {
+    if (!m_state) {
+        throw std::logic_error("LOGIC ERROR: nuwen::thread::future<T>::ready() - Invalid future.");
+    }
+
+    boost::lock_guard<boost::mutex> lock(m_state->m_mutex);
+
+    return m_state->m_done;
+}
+
+template <typename T> inline T nuwen::thread::future<T>::get() const {
+    if (!m_state) {
+        throw std::logic_error("LOGIC ERROR: nuwen::thread::future<T>::get() - Invalid future.");
+    }
+
+    while (!ready()) {
+        if (!m_pool->run_pending_task()) {
+            boost::unique_lock<boost::mutex> lock(m_state->m_mutex);
+
+            while (!m_state->m_done) {
+                m_state->m_cv.wait(lock);
+            }
+        }
+    }
+
+    if (m_state->m_error) {
+        boost::rethrow_exception(m_state->m_error);
+    }
+
+    return m_state->m_holder.get();
+}
+
+template <typename T> inline nuwen::thread::future<T> nuwen::thread::async(pool& p, const boost::function<T ()>& f) {
+    if (f.empty()) {
+        throw std::logic_error("LOGIC ERROR: nuwen::thread::async() - f is empty.");
+    }
+
+    const boost::shared_ptr<pham::thread::future_state<T> > state(new pham::thread::future_state<T>(f));
+
+    p.submit(pham::thread::future_task<T>(state));
+
+    return future<T>(p, state);
+}
+
+template <typename Integer, typename Body> inline void nuwen::thread::parallel_for(pool& p,
+    const Integer first, const Integer last, const Body& body, const ull_t grain) {
+
+    if (grain == 0) {
+        throw std::logic_error("LOGIC ERROR: nuwen::thread::parallel_for() - grain is zero.");
+    }
+
+    if (!(first < last)) {
+        return;
+    }
+
+    const ull_t n = static_cast<ull_t>(last - first);
+
+    // A few chunks per worker gives stealing something to balance.
+    ull_t chunks = (n + grain - 1) / grain;
+
+    if (chunks > 4ULL * p.size()) {
+        chunks = 4ULL * p.size();
+    }
+
+    const ull_t chunk_size = (n + chunks - 1) / chunks;
+
+    task_group g(p);
+
+    for (Integer i = first; i != last; ) {
+        const ull_t remaining = static_cast<ull_t>(last - i);
+        const Integer next = remaining > chunk_size ? static_cast<Integer>(i + static_cast<Integer>(chunk_size)) : last;
+
+        g.run(pham::thread::chunk_task<Integer, Body>(i, next, body));
+
+        i = next;
+    }
+
+    g.wait();
+}
+
+#endif // Idempotency
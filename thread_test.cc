@@ -0,0 +1,139 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#include "test.hh"
+#include "thread.hh"
+#include "typedef.hh"
+
+#include "external_begin.hh"
+    #include <numeric>
+    #include <stdexcept>
+    #include <vector>
+#include "external_end.hh"
+
+using namespace std;
+using namespace nuwen;
+using namespace nuwen::thread;
+
+class square {
+public:
+    explicit square(vull_t& v) : m_v(v) { }
+
+    void operator()(const vull_s_t i) const {
+        m_v[i] = static_cast<ull_t>(i) * i;
+    }
+
+private:
+    vull_t& m_v;
+};
+
+class fail_at {
+public:
+    explicit fail_at(const int n) : m_n(n) { }
+
+    void operator()(const int i) const {
+        if (i == m_n) {
+            throw runtime_error("RUNTIME ERROR: fail_at::operator()() - Failing on purpose.");
+        }
+    }
+
+private:
+    int m_n;
+};
+
+struct nop {
+    void operator()() const { }
+};
+
+struct thrower {
+    void operator()() const {
+        throw runtime_error("RUNTIME ERROR: thrower::operator()() - Throwing on purpose.");
+    }
+};
+
+class fib {
+public:
+    fib(pool& p, const int n) : m_p(p), m_n(n) { }
+
+    ull_t operator()() const {
+        if (m_n < 2) {
+            return static_cast<ull_t>(m_n);
+        }
+
+        // Waiting inside a task must help the pool, or a small pool would deadlock here.
+        const future<ull_t> a = async<ull_t>(m_p, fib(m_p, m_n - 1));
+
+        return fib(m_p, m_n - 2)() + a.get();
+    }
+
+private:
+    pool& m_p;
+    int   m_n;
+};
+
+ull_t sum_of_squares(pool& p, const vull_s_t n) {
+    vull_t v(n);
+
+    parallel_for(p, static_cast<vull_s_t>(0), n, square(v), 1000);
+
+    return accumulate(v.begin(), v.end(), static_cast<ull_t>(0));
+}
+
+bool test_parallel_for_exception(pool& p) {
+    try {
+        parallel_for(p, 0, 1000, fail_at(567));
+    } catch (const runtime_error&) {
+        return true;
+    }
+
+    return false;
+}
+
+bool test_future_exception(pool& p) {
+    const future<void> f = async<void>(p, thrower());
+
+    try {
+        f.get();
+    } catch (const runtime_error&) {
+        return f.ready();
+    }
+
+    return false;
+}
+
+bool test_task_group(pool& p) {
+    task_group g(p);
+
+    g.run(nop());
+    g.run(thrower());
+    g.run(nop());
+
+    try {
+        g.wait();
+    } catch (const runtime_error&) {
+        g.wait(); // The exception is reported once.
+        return true;
+    }
+
+    return false;
+}
+
+int main() {
+    pool p;
+    pool one(1);
+
+    NUWEN_TEST("thread1", hardware_threads() >= 1)
+    NUWEN_TEST("thread2", p.size() == hardware_threads() && one.size() == 1)
+    NUWEN_TEST("thread3", &default_pool() == &default_pool())
+    NUWEN_TEST("thread4", sum_of_squares(p, 100000) == 333328333350000ULL)
+    NUWEN_TEST("thread5", sum_of_squares(one, 100000) == 333328333350000ULL)
+    NUWEN_TEST("thread6", sum_of_squares(p, 0) == 0 && sum_of_squares(p, 1) == 0)
+    NUWEN_TEST("thread7", test_parallel_for_exception(p))
+    NUWEN_TEST("thread8", async<ull_t>(p, fib(p, 20)).get() == 6765)
+    NUWEN_TEST("thread9", async<ull_t>(one, fib(one, 20)).get() == 6765)
+    NUWEN_TEST("thread10", test_future_exception(p))
+    NUWEN_TEST("thread11", test_task_group(p))
+    NUWEN_TEST("thread12", !future<int>().valid())
+}
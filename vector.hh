@@ -26,16 +26,51 @@
     #include <vector>
     #include <boost/mpl/or.hpp>
     #include <boost/type_traits.hpp>
+    #include <boost/utility.hpp>
     #include <boost/utility/enable_if.hpp>
 #include "external_end.hh"
 
 namespace nuwen {
+    namespace view {
+        // A non-owning pointer and length. Anything that outlives the view (a vuc_t, a std::string,
+        // a socket buffer, a memory-mapped file) can be passed to the codecs without being copied.
+        class byte_view {
+        public:
+            typedef const uc_t * const_iterator;
+
+            inline byte_view();
+            inline byte_view(const uc_t * p, vuc_s_t n);
+
+            // These are intentionally implicit.
+            inline byte_view(const vuc_t& v);
+            inline byte_view(const std::string& s);
+
+            inline const uc_t * data() const;
+            inline vuc_s_t size() const;
+            inline bool empty() const;
+
+            inline const_iterator begin() const;
+            inline const_iterator end() const;
+
+            inline uc_t operator[](vuc_s_t i) const;
+
+            inline byte_view sub(vuc_s_t pos, vuc_s_t n) const;
+
+            inline vuc_t vuc() const;
+
+        private:
+            const uc_t * m_p;
+            vuc_s_t      m_n;
+        };
+    }
+
     namespace pack {
         class packed_bits {
         public:
             inline packed_bits();
             inline void push_back(bool bit);
             inline vuc_t vuc() const;
+            inline void vuc_into(vuc_t& dest) const;
 
         private:
             vuc_t m_v;
@@ -47,6 +82,7 @@ namespace nuwen {
     inline ull_t bytes_from_bits(ull_t n);
 
     inline bool bit_from_vuc(const vuc_t& v, ull_t n);
+    inline bool bit_from_vuc(view::byte_view v, ull_t n);
 
     template <typename DstCont, typename SrcCont> DstCont sequence_cast(const SrcCont& s);
 
@@ -70,6 +106,10 @@ namespace nuwen {
     inline  ul_t  ul_from_vuc(const vuc_t& v, vuc_s_t n = 0);
     inline ull_t ull_from_vuc(const vuc_t& v, vuc_s_t n = 0);
 
+    inline  us_t  us_from_vuc(view::byte_view v, vuc_s_t n = 0);
+    inline  ul_t  ul_from_vuc(view::byte_view v, vuc_s_t n = 0);
+    inline ull_t ull_from_vuc(view::byte_view v, vuc_s_t n = 0);
+
     inline  us_t  us_from_vuc(vuc_ci_t i, vuc_ci_t end);
     inline  ul_t  ul_from_vuc(vuc_ci_t i, vuc_ci_t end);
     inline ull_t ull_from_vuc(vuc_ci_t i, vuc_ci_t end);
@@ -90,12 +130,77 @@ namespace pham {
     const nuwen::sll_t tiny = static_cast<nuwen::sll_t>(1) << 62;
 
     template <typename T> T t_from_vuc(const nuwen::vuc_t& v, nuwen::vuc_s_t n);
+    template <typename T> T t_from_vuc(nuwen::view::byte_view v, nuwen::vuc_s_t n);
     template <typename T> T t_from_vuc(nuwen::vuc_ci_t i, nuwen::vuc_ci_t end);
-    template <typename T> T t_from_vuc_unchecked(nuwen::vuc_ci_t i);
+    template <typename T, typename InIt> T t_from_vuc_unchecked(InIt i);
 
     template <typename T> nuwen::vuc_t vuc_from_t(T x);
 
     inline nuwen::uc_t uc_from_hexit(char c);
+
+    // The *_into() functions append to a caller-owned vuc_t. If they throw, this restores
+    // the destination's original size, so that partial output is never left behind.
+    class append_guard : public boost::noncopyable {
+    public:
+        explicit append_guard(nuwen::vuc_t& v) : m_v(v), m_size(v.size()), m_dismissed(false) { }
+
+        nuwen::vuc_s_t original_size() const {
+            return m_size;
+        }
+
+        void dismiss() {
+            m_dismissed = true;
+        }
+
+        ~append_guard() {
+            if (!m_dismissed) {
+                m_v.resize(m_size);
+            }
+        }
+
+    private:
+        nuwen::vuc_t&        m_v;
+        const nuwen::vuc_s_t m_size;
+        bool                 m_dismissed;
+    };
+}
+
+inline nuwen::view::byte_view::byte_view() : m_p(NULL), m_n(0) { }
+
+inline nuwen::view::byte_view::byte_view(const uc_t * const p, const vuc_s_t n) : m_p(p), m_n(n) {
+    if (p == NULL && n != 0) {
+        throw std::logic_error("LOGIC ERROR: nuwen::view::byte_view::byte_view() - NULL p with nonzero n.");
+    }
+}
+
+inline nuwen::view::byte_view::byte_view(const vuc_t& v)
+    : m_p(v.empty() ? NULL : &v[0]), m_n(v.size()) { }
+
+inline nuwen::view::byte_view::byte_view(const std::string& s)
+    : m_p(reinterpret_cast<const uc_t *>(s.data())), m_n(s.size()) { }
+
+inline const nuwen::uc_t * nuwen::view::byte_view::data() const { return m_p; }
+
+inline nuwen::vuc_s_t nuwen::view::byte_view::size() const { return m_n; }
+
+inline bool nuwen::view::byte_view::empty() const { return m_n == 0; }
+
+inline nuwen::view::byte_view::const_iterator nuwen::view::byte_view::begin() const { return m_p; }
+
+inline nuwen::view::byte_view::const_iterator nuwen::view::byte_view::end() const { return m_p + m_n; }
+
+inline nuwen::uc_t nuwen::view::byte_view::operator[](const vuc_s_t i) const { return m_p[i]; }
+
+inline nuwen::view::byte_view nuwen::view::byte_view::sub(const vuc_s_t pos, const vuc_s_t n) const {
+    if (pos > m_n || n > m_n - pos) {
+        throw std::logic_error("LOGIC ERROR: nuwen::view::byte_view::sub() - Invalid pos or n.");
+    }
+
+    return byte_view(m_p + pos, n);
+}
+
+inline nuwen::vuc_t nuwen::view::byte_view::vuc() const {
+    return vuc_t(begin(), end());
 }
 
 inline nuwen::pack::packed_bits::packed_bits()
@@ -112,7 +217,21 @@ inline void nuwen::pack::packed_bits::push_back(const bool bit) {
 }
 
 inline nuwen::vuc_t nuwen::pack::packed_bits::vuc() const {
-    return m_numbits == 0 ? m_v : vec(cat(m_v)(m_bits));
+    vuc_t ret;
+
+    vuc_into(ret);
+
+    return ret;
+}
+
+inline void nuwen::pack::packed_bits::vuc_into(vuc_t& dest) const {
+    dest.reserve(dest.size() + m_v.size() + 1);
+
+    dest.insert(dest.end(), m_v.begin(), m_v.end());
+
+    if (m_numbits != 0) {
+        dest.push_back(m_bits);
+    }
 }
 
 inline nuwen::ull_t nuwen::bytes_from_bits(const ull_t n) {
@@ -127,6 +246,14 @@ inline bool nuwen::bit_from_vuc(const vuc_t& v, const ull_t n) {
     return v[static_cast<vuc_s_t>(n / 8)] >> (7 - n % 8) & 1;
 }
 
+inline bool nuwen::bit_from_vuc(const view::byte_view v, const ull_t n) {
+    if (n >= static_cast<ull_t>(v.size()) * 8) {
+        throw std::logic_error("LOGIC ERROR: nuwen::bit_from_vuc() - Invalid n.");
+    }
+
+    return v[static_cast<vuc_s_t>(n / 8)] >> (7 - n % 8) & 1;
+}
+
 template <typename DstCont, typename SrcCont> DstCont nuwen::sequence_cast(const SrcCont& s) {
     PHAM_STATIC_ASSERT(!boost::is_const<DstCont>::value);
 
@@ -204,6 +331,18 @@ inline nuwen::ull_t nuwen::ull_from_vuc(const vuc_t& v, const vuc_s_t n) {
     return pham::t_from_vuc<ull_t>(v, n);
 }
 
+inline nuwen::us_t nuwen::us_from_vuc(const view::byte_view v, const vuc_s_t n) {
+    return pham::t_from_vuc<us_t>(v, n);
+}
+
+inline nuwen::ul_t nuwen::ul_from_vuc(const view::byte_view v, const vuc_s_t n) {
+    return pham::t_from_vuc<ul_t>(v, n);
+}
+
+inline nuwen::ull_t nuwen::ull_from_vuc(const view::byte_view v, const vuc_s_t n) {
+    return pham::t_from_vuc<ull_t>(v, n);
+}
+
 inline nuwen::us_t nuwen::us_from_vuc(const vuc_ci_t i, const vuc_ci_t end) {
     return pham::t_from_vuc<us_t>(i, end);
 }
@@ -282,6 +421,14 @@ template <typename T> T pham::t_from_vuc(const nuwen::vuc_t& v, const nuwen::vuc
     return t_from_vuc_unchecked<T>(v.begin() + static_cast<nuwen::vuc_d_t>(n));
 }
 
+template <typename T> T pham::t_from_vuc(const nuwen::view::byte_view v, const nuwen::vuc_s_t n) {
+    if (n > v.size() || sizeof(T) > v.size() - n) {
+        throw std::logic_error("LOGIC ERROR: pham::t_from_vuc() - Invalid n.");
+    }
+
+    return t_from_vuc_unchecked<T>(v.begin() + n);
+}
+
 template <typename T> T pham::t_from_vuc(const nuwen::vuc_ci_t i, const nuwen::vuc_ci_t end) {
     if (i + sizeof(T) > end) {
         throw std::logic_error("LOGIC ERROR: pham::t_from_vuc() - Invalid i.");
@@ -290,7 +437,7 @@ template <typename T> T pham::t_from_vuc(const nuwen::vuc_ci_t i, const nuwen::v
     return t_from_vuc_unchecked<T>(i);
 }
 
-template <typename T> T pham::t_from_vuc_unchecked(nuwen::vuc_ci_t i) {
+template <typename T, typename InIt> T pham::t_from_vuc_unchecked(InIt i) {
     T t = 0;
 
     for (std::size_t j = 0; j < sizeof(T); ++j) {
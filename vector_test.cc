@@ -15,6 +15,7 @@
 using namespace std;
 using namespace nuwen;
 using namespace nuwen::pack;
+using namespace nuwen::view;
 
 int main() {
     {
@@ -205,4 +206,33 @@ int main() {
 
         NUWEN_TEST("vector101", vuc_from_hex(s) == v)
     }
+
+    {
+        const vuc_t v = vec(glu<uc_t>(0xDE)(0xAD)(0xBE)(0xEF)(0x17)(0x76));
+        const string s("Hello");
+
+        const byte_view bv(v);
+        const byte_view sv(s);
+
+        NUWEN_TEST("vector102", byte_view().empty() && byte_view(vuc_t()).empty() && byte_view(string()).empty())
+        NUWEN_TEST("vector103", bv.size() == 6 && bv.data() == &v[0] && bv[3] == 0xEF)
+        NUWEN_TEST("vector104", sv.size() == 5 && sv[0] == 'H' && sv.vuc() == string_cast<vuc_t>(s))
+        NUWEN_TEST("vector105", bv.vuc() == v && byte_view(&v[1], 2).vuc() == vec(glu<uc_t>(0xAD)(0xBE)))
+        NUWEN_TEST("vector106", bv.sub(2, 4).vuc() == vec(glu<uc_t>(0xBE)(0xEF)(0x17)(0x76)) && bv.sub(6, 0).empty())
+        NUWEN_TEST("vector107", ul_from_vuc(bv) == 0xDEADBEEFUL && us_from_vuc(bv, 4) == 0x1776)
+        NUWEN_TEST("vector108", ull_from_vuc(byte_view(vec(cat(v)(v))), 4) == 0x1776DEADBEEF1776ULL)
+        NUWEN_TEST("vector109", bit_from_vuc(bv, 0) == 1 && bit_from_vuc(bv, 2) == 0 && bit_from_vuc(sv, 1) == 1)
+    }
+
+    {
+        packed_bits pb;
+
+        pb.push_back(1);
+
+        vuc_t dest(1, 0x77);
+
+        pb.vuc_into(dest);
+
+        NUWEN_TEST("vector110", dest == vec(glu<uc_t>(0x77)(0x80)))
+    }
 }
@@ -14,6 +14,7 @@
 
 #include "bwt.hh"
 #include "typedef.hh"
+#include "vector.hh"
 
 #include "external_begin.hh"
     #include <stdexcept>
@@ -22,6 +23,13 @@
 namespace nuwen {
     inline vuc_t zle(const vuc_t& v);
     inline vuc_t unzle(const vuc_t& v);
+
+    inline vuc_t zle(view::byte_view v);
+    inline vuc_t unzle(view::byte_view v);
+
+    // These append to dest. v must not alias dest. If an exception is thrown, dest is left unchanged.
+    inline void   zle_into(view::byte_view v, vuc_t& dest);
+    inline void unzle_into(view::byte_view v, vuc_t& dest);
 }
 
 namespace pham {
@@ -38,15 +46,16 @@ namespace pham {
         }
     }
 
-    inline void decode_zero_run(nuwen::vuc_t& v, nuwen::ul_t& len, nuwen::ul_t& nextbit) {
+    // Output before base doesn't count towards MAX_ALLOWED_SIZE.
+    inline void decode_zero_run(nuwen::vuc_t& v, const nuwen::vuc_s_t base, nuwen::ul_t& len, nuwen::ul_t& nextbit) {
         if (nextbit != 1) {
-            const nuwen::ull_t total_size = static_cast<nuwen::ull_t>(v.size()) + (len | nextbit) - 1;
+            const nuwen::ull_t total_size = static_cast<nuwen::ull_t>(v.size() - base) + (len | nextbit) - 1;
 
             if (total_size > 9 + ukk::MAX_ALLOWED_SIZE) {
                 throw std::runtime_error("RUNTIME ERROR: pham::decode_zero_run() - Too many bytes produced.");
             }
 
-            v.resize(static_cast<nuwen::vuc_s_t>(total_size), 0x00);
+            v.resize(base + static_cast<nuwen::vuc_s_t>(total_size), 0x00);
 
             len = 0;
             nextbit = 1;
@@ -55,15 +64,39 @@ namespace pham {
 }
 
 inline nuwen::vuc_t nuwen::zle(const vuc_t& v) {
+    return zle(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::unzle(const vuc_t& v) {
+    return unzle(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::zle(const view::byte_view v) {
+    vuc_t ret;
+
+    zle_into(v, ret);
+
+    return ret;
+}
+
+inline nuwen::vuc_t nuwen::unzle(const view::byte_view v) {
+    vuc_t ret;
+
+    unzle_into(v, ret);
+
+    return ret;
+}
+
+inline void nuwen::zle_into(const view::byte_view v, vuc_t& dest) {
     if (v.size() > 9 + pham::ukk::MAX_ALLOWED_SIZE) {
-        throw std::logic_error("LOGIC ERROR: nuwen::zle() - v is too big.");
+        throw std::logic_error("LOGIC ERROR: nuwen::zle_into() - v is too big.");
     }
 
-    vuc_t ret;
+    pham::append_guard guard(dest);
 
     ul_t len = 0;
 
-    for (vuc_ci_t i = v.begin(); i != v.end(); ++i) {
+    for (view::byte_view::const_iterator i = v.begin(); i != v.end(); ++i) {
         const uc_t byte = *i;
 
         switch (byte) {
@@ -72,36 +105,36 @@ inline nuwen::vuc_t nuwen::zle(const vuc_t& v) {
                 break;
 
             case 0xFE:
-                pham::encode_zero_run(ret, len);
-                ret.push_back(0xFF);
-                ret.push_back(0x00);
+                pham::encode_zero_run(dest, len);
+                dest.push_back(0xFF);
+                dest.push_back(0x00);
                 break;
 
             case 0xFF:
-                pham::encode_zero_run(ret, len);
-                ret.push_back(0xFF);
-                ret.push_back(0x01);
+                pham::encode_zero_run(dest, len);
+                dest.push_back(0xFF);
+                dest.push_back(0x01);
                 break;
 
             default:
-                pham::encode_zero_run(ret, len);
-                ret.push_back(static_cast<uc_t>(byte + 1));
+                pham::encode_zero_run(dest, len);
+                dest.push_back(static_cast<uc_t>(byte + 1));
                 break;
         }
     }
 
-    pham::encode_zero_run(ret, len);
+    pham::encode_zero_run(dest, len);
 
-    return ret;
+    guard.dismiss();
 }
 
-inline nuwen::vuc_t nuwen::unzle(const vuc_t& v) {
-    vuc_t ret;
+inline void nuwen::unzle_into(const view::byte_view v, vuc_t& dest) {
+    pham::append_guard guard(dest);
 
     ul_t len = 0;
     ul_t nextbit = 1;
 
-    for (vuc_ci_t i = v.begin(); i != v.end(); ++i) {
+    for (view::byte_view::const_iterator i = v.begin(); i != v.end(); ++i) {
         const uc_t byte = *i;
 
         switch (byte) {
@@ -109,7 +142,7 @@ inline nuwen::vuc_t nuwen::unzle(const vuc_t& v) {
                 nextbit <<= 1;
 
                 if (nextbit == 0) {
-                    throw std::runtime_error("RUNTIME ERROR: nuwen::unzle() - A 0x00 byte overflowed nextbit.");
+                    throw std::runtime_error("RUNTIME ERROR: nuwen::unzle_into() - A 0x00 byte overflowed nextbit.");
                 }
 
                 break;
@@ -119,42 +152,42 @@ inline nuwen::vuc_t nuwen::unzle(const vuc_t& v) {
                 nextbit <<= 1;
 
                 if (nextbit == 0) {
-                    throw std::runtime_error("RUNTIME ERROR: nuwen::unzle() - A 0x01 byte overflowed nextbit.");
+                    throw std::runtime_error("RUNTIME ERROR: nuwen::unzle_into() - A 0x01 byte overflowed nextbit.");
                 }
 
                 break;
 
             case 0xFF:
-                pham::decode_zero_run(ret, len, nextbit);
+                pham::decode_zero_run(dest, guard.original_size(), len, nextbit);
 
                 if (++i == v.end()) {
-                    throw std::runtime_error("RUNTIME ERROR: nuwen::unzle() - A 0xFF byte was followed by nothing.");
+                    throw std::runtime_error("RUNTIME ERROR: nuwen::unzle_into() - A 0xFF byte was followed by nothing.");
                 }
 
                 switch (*i) {
                     case 0x00:
-                        ret.push_back(0xFE);
+                        dest.push_back(0xFE);
                         break;
                     case 0x01:
-                        ret.push_back(0xFF);
+                        dest.push_back(0xFF);
                         break;
                     default:
-                        throw std::runtime_error("RUNTIME ERROR: nuwen::unzle() - A 0xFF byte was followed by an invalid byte.");
+                        throw std::runtime_error("RUNTIME ERROR: nuwen::unzle_into() - A 0xFF byte was followed by an invalid byte.");
                 }
 
                 break;
 
             default:
-                pham::decode_zero_run(ret, len, nextbit);
+                pham::decode_zero_run(dest, guard.original_size(), len, nextbit);
 
-                ret.push_back(static_cast<uc_t>(byte - 1));
+                dest.push_back(static_cast<uc_t>(byte - 1));
                 break;
         }
     }
 
-    pham::decode_zero_run(ret, len, nextbit);
+    pham::decode_zero_run(dest, guard.original_size(), len, nextbit);
 
-    return ret;
+    guard.dismiss();
 }
 
 #endif // Idempotency
@@ -12,11 +12,15 @@
     #pragma once
 #endif
 
-#include "gluon.hh"
 #include "typedef.hh"
+#include "vector.hh"
 
 #include "external_begin.hh"
+    #include <algorithm>
+    #include <queue>
     #include <stdexcept>
+    #include <vector>
+    #include <boost/scoped_ptr.hpp>
     #include <boost/utility.hpp>
     #include <zlib.h>
 #include "external_end.hh"
@@ -24,25 +28,78 @@
 namespace nuwen {
     inline vuc_t   zlib(const vuc_t& v, int level = Z_BEST_COMPRESSION, int strategy = Z_DEFAULT_STRATEGY);
     inline vuc_t unzlib(const vuc_t& v);
+
+    inline vuc_t   zlib(view::byte_view v, int level = Z_BEST_COMPRESSION, int strategy = Z_DEFAULT_STRATEGY);
+    inline vuc_t unzlib(view::byte_view v);
+
+    // These append to dest, so dest.clear() followed by a call reuses dest's capacity.
+    // v must not alias dest. If an exception is thrown, dest is left unchanged.
+    inline void   zlib_into(view::byte_view v, vuc_t& dest, int level = Z_BEST_COMPRESSION, int strategy = Z_DEFAULT_STRATEGY);
+    inline void unzlib_into(view::byte_view v, vuc_t& dest);
+
+    // expected is the decompressed size, if known. Output goes directly into a single allocation
+    // of that size. If expected is wrong, decompression still succeeds, but may reallocate.
+    inline vuc_t unzlib(view::byte_view v, vuc_s_t expected);
+    inline void  unzlib_into(view::byte_view v, vuc_t& dest, vuc_s_t expected);
+
+    // The framed format is the big-endian 8-byte decompressed size, followed by the zlib stream.
+    inline vuc_t   zlib_framed(view::byte_view v, int level = Z_BEST_COMPRESSION, int strategy = Z_DEFAULT_STRATEGY);
+    inline vuc_t unzlib_framed(view::byte_view v);
+
+    // A preset dictionary. Compressed data names it with its Adler-32 checksum, as in RFC 1950.
+    // Deflate can only look back 32 KB, so longer dictionaries are rejected.
+    class zlib_dictionary {
+    public:
+        inline explicit zlib_dictionary(view::byte_view bytes);
+
+        inline const vuc_t& bytes() const;
+        inline ul_t id() const;
+
+    private:
+        vuc_t m_bytes;
+        ul_t  m_id;
+    };
+
+    // Builds a dictionary of at most max_size bytes out of the substrings that the most samples share.
+    inline zlib_dictionary train_zlib_dictionary(const std::vector<vuc_t>& samples, vuc_s_t max_size = 32768);
+
+    // Priming deflate with a dictionary takes time proportional to its size.
+    inline vuc_t zlib(view::byte_view v, const zlib_dictionary& d,
+        int level = Z_BEST_COMPRESSION, int strategy = Z_DEFAULT_STRATEGY);
+
+    inline void zlib_into(view::byte_view v, vuc_t& dest, const zlib_dictionary& d,
+        int level = Z_BEST_COMPRESSION, int strategy = Z_DEFAULT_STRATEGY);
+
+    // These pick whichever dictionary v names, and throw if they weren't given it.
+    // They also accept data that was compressed without a dictionary.
+    inline vuc_t unzlib(view::byte_view v, const zlib_dictionary& d);
+    inline vuc_t unzlib(view::byte_view v, const std::vector<zlib_dictionary>& dictionaries);
+
+    inline void unzlib_into(view::byte_view v, vuc_t& dest, const zlib_dictionary& d);
+    inline void unzlib_into(view::byte_view v, vuc_t& dest, const std::vector<zlib_dictionary>& dictionaries);
+
+    // Returns the ID of the dictionary that v needs, or 0 if it needs none.
+    inline ul_t zlib_dictionary_id(view::byte_view v);
 }
 
 namespace pham {
     namespace zlib {
         struct stream : public boost::noncopyable {
-            stream(const nuwen::uc_t * const in_ptr, const nuwen::vuc_s_t in_len,
-                nuwen::uc_t * const out_ptr, const nuwen::vuc_s_t out_len, const int level, const int strategy) {
+            // Negative window_bits produce raw deflate data, without the zlib header and trailer.
+            stream(const nuwen::uc_t * const in_ptr, const nuwen::vuc_s_t in_len, nuwen::uc_t * const out_ptr,
+                const nuwen::vuc_s_t out_len, const int level, const int strategy, const int window_bits = 15) {
 
                 init_common(in_ptr, in_len, out_ptr, out_len);
 
-                if (deflateInit2(&m_stream, level, Z_DEFLATED, 15, 9, strategy) != Z_OK) {
+                if (deflateInit2(&m_stream, level, Z_DEFLATED, window_bits, 9, strategy) != Z_OK) {
                     throw std::runtime_error("RUNTIME ERROR: pham::zlib::stream::stream() - deflateInit2() failed.");
                 }
 
                 m_end = deflateEnd;
             }
 
-            explicit stream(const nuwen::vuc_t& compressed) {
-                init_common(&compressed[0], compressed.size(), NULL, 0);
+            explicit stream(const nuwen::view::byte_view compressed) {
+                init_common(compressed.data(), compressed.size(), NULL, 0);
 
                 if (inflateInit(&m_stream) != Z_OK) {
                     throw std::runtime_error("RUNTIME ERROR: pham::zlib::stream::stream() - inflateInit() failed.");
@@ -77,64 +134,800 @@ namespace pham {
             z_stream m_stream;
             int (*m_end)(z_stream *);
         };
+
+        // avail_in and avail_out are 32-bit, so longer input is handed over in pieces.
+        const nuwen::vuc_s_t MAX_PIECE_SIZE = 1073741824;
+
+        const nuwen::vuc_s_t WINDOW_SIZE = 32768;
+
+        // Deflate can't do better than about 1032:1, so a size hint beyond this is wrong.
+        inline nuwen::ull_t max_decompressed_size(const nuwen::vuc_s_t compressed_size) {
+            return 1032ULL * compressed_size + 4096;
+        }
+
+        // Output goes directly into dest, in blocks that start small, so that small messages
+        // don't pay for zero-filling a large block, and grow with the output up to BLOCK_SIZE.
+        inline nuwen::vuc_s_t block_size(const nuwen::vuc_s_t produced, const nuwen::vuc_s_t pending) {
+            const nuwen::vuc_s_t MIN_BLOCK_SIZE = 4096;
+            const nuwen::vuc_s_t BLOCK_SIZE = 1048576;
+
+            return std::min(BLOCK_SIZE, std::max(MIN_BLOCK_SIZE, produced + pending));
+        }
+
+        // The two-byte zlib header that deflate() would write, as in RFC 1950.
+        inline nuwen::us_t header(const int level, const int strategy) {
+            int flevel = 3;
+
+            if (strategy >= Z_HUFFMAN_ONLY || (level >= 0 && level < 2)) {
+                flevel = 0;
+            } else if (level >= 0 && level < 6) {
+                flevel = 1;
+            } else if (level == 6 || level == Z_DEFAULT_COMPRESSION) {
+                flevel = 2;
+            }
+
+            const nuwen::us_t h = static_cast<nuwen::us_t>((Z_DEFLATED + (7 << 4)) << 8 | flevel << 6);
+
+            return static_cast<nuwen::us_t>(h + 31 - h % 31);
+        }
+
+        inline void set_dictionary(stream& s, const nuwen::zlib_dictionary& d) {
+            if (deflateSetDictionary(&s.m_stream, &d.bytes()[0], static_cast<uInt>(d.bytes().size())) != Z_OK) {
+                throw std::runtime_error("RUNTIME ERROR: pham::zlib::set_dictionary() - deflateSetDictionary() failed.");
+            }
+        }
+
+        // These append to dest, using a stream that has just been initialized or reset.
+        inline void deflate_into(stream& s, const nuwen::view::byte_view v, nuwen::vuc_t& dest) {
+            using namespace nuwen;
+
+            const uc_t dummy = 0;
+
+            append_guard guard(dest);
+
+            const vuc_s_t used = dest.size();
+
+            // This leaves room for a dictionary ID in the header.
+            dest.resize(used + v.size() + v.size() / 1000 + 16);
+
+            // Input and output are handed over in pieces as deflate() uses them up.
+            const uc_t * in = v.empty() ? &dummy : v.data();
+            vuc_s_t in_left = v.size();
+
+            uc_t * const out = &dest[used];
+            vuc_s_t out_left = dest.size() - used;
+
+            s.m_stream.avail_in  = 0;
+            s.m_stream.avail_out = 0;
+
+            while (true) {
+                if (s.m_stream.avail_in == 0) {
+                    const vuc_s_t piece = std::min(in_left, MAX_PIECE_SIZE);
+
+                    s.m_stream.next_in  = const_cast<uc_t *>(in);
+                    s.m_stream.avail_in = static_cast<uInt>(piece);
+
+                    in += piece;
+                    in_left -= piece;
+                }
+
+                if (s.m_stream.avail_out == 0) {
+                    const vuc_s_t piece = std::min(out_left, MAX_PIECE_SIZE);
+
+                    s.m_stream.next_out  = out + (dest.size() - used - out_left);
+                    s.m_stream.avail_out = static_cast<uInt>(piece);
+
+                    out_left -= piece;
+                }
+
+                const int error = deflate(&s.m_stream, in_left == 0 ? Z_FINISH : Z_NO_FLUSH);
+
+                if (error == Z_STREAM_END) {
+                    break;
+                }
+
+                if (error != Z_OK) {
+                    throw std::runtime_error("RUNTIME ERROR: pham::zlib::deflate_into() - deflate() failed.");
+                }
+            }
+
+            dest.resize(used + static_cast<vuc_s_t>(s.m_stream.next_out - out));
+
+            guard.dismiss();
+        }
+
+        // If v names a dictionary, it's looked up in the count dictionaries beginning at dictionaries.
+        inline void inflate_into(stream& s, const nuwen::view::byte_view v, nuwen::vuc_t& dest, const nuwen::vuc_s_t expected,
+            const nuwen::zlib_dictionary * const dictionaries = NULL, const nuwen::vuc_s_t count = 0) {
+
+            using namespace nuwen;
+
+            if (v.empty()) {
+                throw std::logic_error("LOGIC ERROR: pham::zlib::inflate_into() - v is empty.");
+            }
+
+            append_guard guard(dest);
+
+            // Input is handed over in pieces as inflate() uses it up.
+            const uc_t * in = v.data();
+            vuc_s_t in_left = v.size();
+
+            s.m_stream.avail_in = 0;
+
+            // One more byte than expected lets the first inflate() see the end of the stream.
+            const ull_t first = 1 + std::min(static_cast<ull_t>(expected),
+                std::min(max_decompressed_size(v.size()), static_cast<ull_t>(MAX_PIECE_SIZE)));
+
+            while (true) {
+                if (s.m_stream.avail_in == 0) {
+                    const vuc_s_t piece = std::min(in_left, MAX_PIECE_SIZE);
+
+                    s.m_stream.next_in  = const_cast<uc_t *>(in);
+                    s.m_stream.avail_in = static_cast<uInt>(piece);
+
+                    in += piece;
+                    in_left -= piece;
+                }
+
+                const vuc_s_t used = dest.size();
+
+                const vuc_s_t n = used == guard.original_size() && expected != 0 ? static_cast<vuc_s_t>(first)
+                    : block_size(used - guard.original_size(), v.size());
+
+                dest.resize(used + n);
+
+                s.m_stream.next_out = &dest[used];
+                s.m_stream.avail_out = static_cast<uInt>(n);
+
+                const int error = inflate(&s.m_stream, Z_SYNC_FLUSH);
+
+                dest.resize(used + n - s.m_stream.avail_out);
+
+                if (error == Z_OK) {
+                    if (s.m_stream.avail_out != 0 && in_left == 0) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::zlib::inflate_into() - Compressed data ended prematurely.");
+                    }
+                } else if (error == Z_STREAM_END) {
+                    if (s.m_stream.avail_in != 0 || in_left != 0) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::zlib::inflate_into() - Some bytes were not consumed.");
+                    }
+
+                    guard.dismiss();
+
+                    return;
+                } else if (error == Z_NEED_DICT) {
+                    const zlib_dictionary * d = dictionaries;
+
+                    while (d != dictionaries + count && d->id() != s.m_stream.adler) {
+                        ++d;
+                    }
+
+                    if (d == dictionaries + count) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::zlib::inflate_into() - Unknown dictionary.");
+                    }
+
+                    if (inflateSetDictionary(&s.m_stream, &d->bytes()[0], static_cast<uInt>(d->bytes().size())) != Z_OK) {
+                        throw std::runtime_error("RUNTIME ERROR: pham::zlib::inflate_into() - inflateSetDictionary() failed.");
+                    }
+                } else {
+                    throw std::runtime_error("RUNTIME ERROR: pham::zlib::inflate_into() - inflate() failed.");
+                }
+            }
+        }
+
+        // train_zlib_dictionary() scores a substring by its DMER_SIZE-byte pieces, where each piece
+        // is worth the number of samples containing it. Candidates are SEGMENT_SIZE-byte substrings.
+        const nuwen::vuc_s_t DMER_SIZE = 6;
+        const nuwen::vuc_s_t SEGMENT_SIZE = 64;
+
+        inline nuwen::ull_t dmer(const nuwen::uc_t * const p) {
+            nuwen::ull_t ret = 0;
+
+            for (nuwen::vuc_s_t i = 0; i < DMER_SIZE; ++i) {
+                ret = ret << 8 | p[i];
+            }
+
+            return ret;
+        }
+
+        struct segment {
+            nuwen::ull_t   score;
+            nuwen::vuc_s_t sample;
+            nuwen::vuc_s_t pos;
+            nuwen::vuc_s_t len;
+
+            // Ties go to earlier segments, so that training is deterministic.
+            bool operator<(const segment& other) const {
+                if (score != other.score) {
+                    return score < other.score;
+                }
+
+                return sample != other.sample ? sample > other.sample : pos > other.pos;
+            }
+        };
+
+        class dmer_counts {
+        public:
+            explicit dmer_counts(const std::vector<nuwen::vuc_t>& samples) : m_keys(), m_counts() {
+                using namespace std;
+                using namespace nuwen;
+
+                vull_t all;
+
+                for (vector<vuc_t>::const_iterator i = samples.begin(); i != samples.end(); ++i) {
+                    const vull_s_t first = all.size();
+
+                    for (vuc_s_t k = 0; k + DMER_SIZE <= i->size(); ++k) {
+                        all.push_back(dmer(&(*i)[k]));
+                    }
+
+                    // Each sample counts once per piece.
+                    sort(all.begin() + first, all.end());
+                    all.erase(unique(all.begin() + first, all.end()), all.end());
+                }
+
+                sort(all.begin(), all.end());
+
+                const vull_ci_t end = all.end();
+
+                for (vull_ci_t i = all.begin(); i != end; ) {
+                    const vull_ci_t k = upper_bound(i, end, *i);
+
+                    // A piece in just one sample doesn't help the others.
+                    if (k - i > 1) {
+                        m_keys.push_back(*i);
+                        m_counts.push_back(static_cast<nuwen::ull_t>(k - i));
+                    }
+
+                    i = k;
+                }
+            }
+
+            // Sums the counts of the distinct pieces in p[0, len), optionally zeroing them.
+            nuwen::ull_t score(const nuwen::uc_t * const p, const nuwen::vuc_s_t len, const bool take) {
+                using namespace std;
+                using namespace nuwen;
+
+                vull_t indices;
+
+                for (vuc_s_t k = 0; k + DMER_SIZE <= len; ++k) {
+                    const ull_t key = dmer(p + k);
+
+                    const vull_ci_t i = lower_bound(m_keys.begin(), m_keys.end(), key);
+
+                    if (i != m_keys.end() && *i == key) {
+                        indices.push_back(static_cast<ull_t>(i - m_keys.begin()));
+                    }
+                }
+
+                sort(indices.begin(), indices.end());
+                indices.erase(unique(indices.begin(), indices.end()), indices.end());
+
+                ull_t ret = 0;
+
+                for (vull_ci_t i = indices.begin(); i != indices.end(); ++i) {
+                    ret += m_counts[static_cast<vull_s_t>(*i)];
+
+                    if (take) {
+                        m_counts[static_cast<vull_s_t>(*i)] = 0;
+                    }
+                }
+
+                return ret;
+            }
+
+        private:
+            nuwen::vull_t m_keys;
+            nuwen::vull_t m_counts;
+        };
+    }
+}
+
+namespace nuwen {
+    namespace stream {
+        // Accepts input in pieces, emitting standard zlib output in pieces.
+        class zlib_compressor : public boost::noncopyable {
+        public:
+            inline explicit zlib_compressor(int level = Z_BEST_COMPRESSION, int strategy = Z_DEFAULT_STRATEGY);
+
+            // These append whatever output is ready to dest. If one throws,
+            // dest is left unchanged, but the compressor can only be destroyed.
+            inline void compress(view::byte_view v, vuc_t& dest);
+
+            // Afterwards, everything compressed so far can be decompressed from the output so far.
+            inline void flush(vuc_t& dest);
+
+            // Ends the stream. Afterwards, compress(), flush(), and finish() throw.
+            inline void finish(vuc_t& dest);
+
+            inline bool finished() const;
+
+        private:
+            inline void run(view::byte_view v, int flush, vuc_t& dest);
+
+            pham::zlib::stream m_s;
+            bool               m_finished;
+        };
+
+        // Keeps its deflate and inflate streams, recycling them with deflateReset() and inflateReset().
+        // For high rates of small messages, this avoids initializing about 256 KB of zlib state per call.
+        // A context isn't thread-safe. thread_zlib_context() in zlib_thread.hh provides one per thread.
+        class zlib_context : public boost::noncopyable {
+        public:
+            inline explicit zlib_context(int level = Z_BEST_COMPRESSION, int strategy = Z_DEFAULT_STRATEGY);
+
+            inline vuc_t   zlib(view::byte_view v);
+            inline vuc_t unzlib(view::byte_view v, vuc_s_t expected = 0);
+
+            inline void   zlib_into(view::byte_view v, vuc_t& dest);
+            inline void unzlib_into(view::byte_view v, vuc_t& dest, vuc_s_t expected = 0);
+
+        private:
+            inline pham::zlib::stream& deflater();
+            inline pham::zlib::stream& inflater();
+
+            const int                             m_level;
+            const int                             m_strategy;
+            boost::scoped_ptr<pham::zlib::stream> m_deflater; // Created on first use.
+            boost::scoped_ptr<pham::zlib::stream> m_inflater; // Created on first use.
+        };
+
+        class zlib_decompressor : public boost::noncopyable {
+        public:
+            inline zlib_decompressor();
+
+            // Appends whatever output is ready to dest. Throws if v continues past the end of the stream.
+            // If this throws, dest is left unchanged, but the decompressor can only be destroyed.
+            inline void decompress(view::byte_view v, vuc_t& dest);
+
+            // Whether the end of the stream has been seen.
+            inline bool finished() const;
+
+            // Throws if the end of the stream hasn't been seen.
+            inline void finish() const;
+
+        private:
+            pham::zlib::stream m_s;
+            bool               m_finished;
+        };
     }
 }
 
 inline nuwen::vuc_t nuwen::zlib(const vuc_t& v, const int level, const int strategy) {
-    const uc_t dummy = 0;
+    return zlib(view::byte_view(v), level, strategy);
+}
+
+inline nuwen::vuc_t nuwen::unzlib(const vuc_t& v) {
+    return unzlib(view::byte_view(v));
+}
+
+inline nuwen::vuc_t nuwen::zlib(const view::byte_view v, const int level, const int strategy) {
+    vuc_t dest;
+
+    zlib_into(v, dest, level, strategy);
+
+    return dest;
+}
+
+inline nuwen::vuc_t nuwen::unzlib(const view::byte_view v) {
+    vuc_t dest;
+
+    unzlib_into(v, dest);
+
+    return dest;
+}
+
+inline void nuwen::zlib_into(const view::byte_view v, vuc_t& dest, const int level, const int strategy) {
+    pham::zlib::stream s(NULL, 0, NULL, 0, level, strategy);
+
+    pham::zlib::deflate_into(s, v, dest);
+}
+
+inline void nuwen::unzlib_into(const view::byte_view v, vuc_t& dest) {
+    unzlib_into(v, dest, 0);
+}
+
+inline nuwen::vuc_t nuwen::unzlib(const view::byte_view v, const vuc_s_t expected) {
+    vuc_t dest;
+
+    unzlib_into(v, dest, expected);
+
+    return dest;
+}
+
+inline void nuwen::unzlib_into(const view::byte_view v, vuc_t& dest, const vuc_s_t expected) {
+    pham::zlib::stream s(v);
+
+    pham::zlib::inflate_into(s, v, dest, expected);
+}
+
+inline nuwen::vuc_t nuwen::zlib_framed(const view::byte_view v, const int level, const int strategy) {
+    vuc_t dest = vuc_from_ull(v.size());
+
+    zlib_into(v, dest, level, strategy);
+
+    return dest;
+}
 
-    vuc_t dest(v.size() + v.size() / 1000 + 12);
+inline nuwen::vuc_t nuwen::unzlib_framed(const view::byte_view v) {
+    if (v.size() < 8) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::unzlib_framed() - Insufficient data to decompress.");
+    }
+
+    const ull_t size = ull_from_vuc(v);
 
-    pham::zlib::stream s(v.empty() ? &dummy : &v[0], v.size(), &dest[0], dest.size(), level, strategy);
+    const view::byte_view compressed = v.sub(8, v.size() - 8);
 
-    if (deflate(&s.m_stream, Z_FINISH) != Z_STREAM_END) {
-        throw std::runtime_error("RUNTIME ERROR: nuwen::zlib() - deflate() failed.");
+    if (size > pham::zlib::max_decompressed_size(compressed.size())) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::unzlib_framed() - Invalid size.");
     }
 
-    dest.resize(s.m_stream.total_out);
+    const vuc_t dest = unzlib(compressed, static_cast<vuc_s_t>(size));
+
+    if (dest.size() != size) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::unzlib_framed() - Wrong size.");
+    }
 
     return dest;
 }
 
-inline nuwen::vuc_t nuwen::unzlib(const vuc_t& v) {
-    if (v.empty()) {
-        throw std::logic_error("LOGIC ERROR: nuwen::unzlib() - v is empty.");
+inline nuwen::zlib_dictionary::zlib_dictionary(const view::byte_view bytes)
+    : m_bytes(bytes.vuc()), m_id(0) {
+
+    if (bytes.empty() || bytes.size() > pham::zlib::WINDOW_SIZE) {
+        throw std::logic_error("LOGIC ERROR: nuwen::zlib_dictionary::zlib_dictionary() - Invalid size.");
     }
 
-    pham::zlib::stream s(v);
+    m_id = static_cast<ul_t>(adler32(adler32(0, NULL, 0), &m_bytes[0], static_cast<uInt>(m_bytes.size())));
+}
 
-    const vuc_s_t BLOCK_SIZE = 1048576;
+inline const nuwen::vuc_t& nuwen::zlib_dictionary::bytes() const {
+    return m_bytes;
+}
+
+inline nuwen::ul_t nuwen::zlib_dictionary::id() const {
+    return m_id;
+}
 
-    vuc_t temp(BLOCK_SIZE);
+inline nuwen::zlib_dictionary nuwen::train_zlib_dictionary(const std::vector<vuc_t>& samples, const vuc_s_t max_size) {
+    using namespace std;
+    using pham::zlib::segment;
+    using pham::zlib::DMER_SIZE;
+    using pham::zlib::SEGMENT_SIZE;
+
+    if (max_size == 0 || max_size > pham::zlib::WINDOW_SIZE) {
+        throw logic_error("LOGIC ERROR: nuwen::train_zlib_dictionary() - Invalid max_size.");
+    }
+
+    vuc_s_t total = 0;
+
+    for (vector<vuc_t>::const_iterator i = samples.begin(); i != samples.end(); ++i) {
+        total += i->size();
+    }
+
+    if (total == 0) {
+        throw logic_error("LOGIC ERROR: nuwen::train_zlib_dictionary() - The samples are empty.");
+    }
+
+    pham::zlib::dmer_counts counts(samples);
+
+    priority_queue<segment> q;
+
+    for (vuc_s_t i = 0; i < samples.size(); ++i) {
+        for (vuc_s_t pos = 0; pos + DMER_SIZE <= samples[i].size(); pos += SEGMENT_SIZE) {
+            segment s;
+
+            s.sample = i;
+            s.pos    = pos;
+            s.len    = min(SEGMENT_SIZE, samples[i].size() - pos);
+            s.score  = counts.score(&samples[i][pos], s.len, false);
+
+            if (s.score != 0) {
+                q.push(s);
+            }
+        }
+    }
+
+    // Taking a segment makes the others that share its pieces worth less, but never more.
+    // So a segment whose rescored value still beats the next best one's stale score is the best.
+    vector<segment> chosen;
+    vuc_s_t size = 0;
+
+    while (!q.empty() && size < max_size) {
+        segment s = q.top();
+        q.pop();
+
+        const uc_t * const p = &samples[s.sample][s.pos];
+
+        const ull_t score = counts.score(p, s.len, false);
+
+        if (score == 0) {
+            continue;
+        }
 
+        if (score < s.score && !q.empty() && score < q.top().score) {
+            s.score = score;
+            q.push(s);
+            continue;
+        }
+
+        (void) counts.score(p, s.len, true);
+
+        chosen.push_back(s);
+        size += s.len;
+    }
+
+    // Deflate reaches the end of the dictionary with the shortest distances, so the best segments go last.
+    vuc_t dict;
+
+    for (vector<segment>::const_reverse_iterator i = chosen.rbegin(); i != chosen.rend(); ++i) {
+        const vuc_t& sample = samples[i->sample];
+
+        dict.insert(dict.end(), sample.begin() + i->pos, sample.begin() + i->pos + i->len);
+    }
+
+    // Without shared substrings, the samples themselves are as good a guess as any.
+    if (dict.empty()) {
+        for (vector<vuc_t>::const_iterator i = samples.begin(); i != samples.end(); ++i) {
+            dict.insert(dict.end(), i->begin(), i->end());
+        }
+    }
+
+    const vuc_s_t n = min(dict.size(), max_size);
+
+    return zlib_dictionary(view::byte_view(dict).sub(dict.size() - n, n));
+}
+
+inline nuwen::vuc_t nuwen::zlib(const view::byte_view v, const zlib_dictionary& d, const int level, const int strategy) {
+    vuc_t dest;
+
+    zlib_into(v, dest, d, level, strategy);
+
+    return dest;
+}
+
+inline void nuwen::zlib_into(const view::byte_view v, vuc_t& dest, const zlib_dictionary& d,
+    const int level, const int strategy) {
+
+    pham::zlib::stream s(NULL, 0, NULL, 0, level, strategy);
+
+    pham::zlib::set_dictionary(s, d);
+
+    pham::zlib::deflate_into(s, v, dest);
+}
+
+inline nuwen::vuc_t nuwen::unzlib(const view::byte_view v, const zlib_dictionary& d) {
+    vuc_t dest;
+
+    unzlib_into(v, dest, d);
+
+    return dest;
+}
+
+inline nuwen::vuc_t nuwen::unzlib(const view::byte_view v, const std::vector<zlib_dictionary>& dictionaries) {
     vuc_t dest;
 
-    while (true) {
-        s.m_stream.next_out = &temp[0];
-        s.m_stream.avail_out = BLOCK_SIZE;
+    unzlib_into(v, dest, dictionaries);
 
-        const int error = inflate(&s.m_stream, Z_SYNC_FLUSH);
+    return dest;
+}
+
+inline void nuwen::unzlib_into(const view::byte_view v, vuc_t& dest, const zlib_dictionary& d) {
+    pham::zlib::stream s(v);
+
+    pham::zlib::inflate_into(s, v, dest, 0, &d, 1);
+}
+
+inline void nuwen::unzlib_into(const view::byte_view v, vuc_t& dest, const std::vector<zlib_dictionary>& dictionaries) {
+    pham::zlib::stream s(v);
+
+    pham::zlib::inflate_into(s, v, dest, 0, dictionaries.empty() ? NULL : &dictionaries[0], dictionaries.size());
+}
 
-        if (error == Z_OK) {
-            if (s.m_stream.avail_out != 0) {
-                throw std::runtime_error("RUNTIME ERROR: nuwen::unzlib() - Compressed data ended prematurely.");
+inline nuwen::ul_t nuwen::zlib_dictionary_id(const view::byte_view v) {
+    // The header is CMF and FLG, followed by DICTID when FLG's FDICT bit is set.
+    if (v.size() < 6 || (v[0] & 0x0F) != Z_DEFLATED || (v[0] << 8 | v[1]) % 31 != 0 || (v[1] & 0x20) == 0) {
+        return 0;
+    }
+
+    return ul_from_vuc(v, 2);
+}
+
+inline nuwen::stream::zlib_compressor::zlib_compressor(const int level, const int strategy)
+    : m_s(NULL, 0, NULL, 0, level, strategy), m_finished(false) { }
+
+inline void nuwen::stream::zlib_compressor::compress(const view::byte_view v, vuc_t& dest) {
+    run(v, Z_NO_FLUSH, dest);
+}
+
+inline void nuwen::stream::zlib_compressor::flush(vuc_t& dest) {
+    run(view::byte_view(), Z_SYNC_FLUSH, dest);
+}
+
+inline void nuwen::stream::zlib_compressor::finish(vuc_t& dest) {
+    run(view::byte_view(), Z_FINISH, dest);
+
+    m_finished = true;
+}
+
+inline bool nuwen::stream::zlib_compressor::finished() const {
+    return m_finished;
+}
+
+inline void nuwen::stream::zlib_compressor::run(const view::byte_view v, const int flush, vuc_t& dest) {
+    using namespace std;
+    using pham::zlib::MAX_PIECE_SIZE;
+
+    if (m_finished) {
+        throw logic_error("LOGIC ERROR: nuwen::stream::zlib_compressor::run() - The stream is finished.");
+    }
+
+    pham::append_guard guard(dest);
+
+    z_stream& z = m_s.m_stream;
+
+    const uc_t * p = v.data();
+    vuc_s_t left = v.size();
+
+    do {
+        const vuc_s_t piece = min(left, MAX_PIECE_SIZE);
+
+        z.next_in = const_cast<uc_t *>(p);
+        z.avail_in = static_cast<uInt>(piece);
+
+        const int f = piece == left ? flush : Z_NO_FLUSH;
+
+        while (true) {
+            const vuc_s_t used = dest.size();
+            const vuc_s_t n = pham::zlib::block_size(used - guard.original_size(), z.avail_in);
+
+            dest.resize(used + n);
+
+            z.next_out = &dest[used];
+            z.avail_out = static_cast<uInt>(n);
+
+            const int error = deflate(&z, f);
+
+            dest.resize(used + n - z.avail_out);
+
+            if (error == Z_STREAM_END) {
+                break;
+            }
+
+            // Z_BUF_ERROR means that there was nothing to do, which is harmless.
+            if (error != Z_OK && error != Z_BUF_ERROR) {
+                throw runtime_error("RUNTIME ERROR: nuwen::stream::zlib_compressor::run() - deflate() failed.");
             }
 
-            dest += cat(temp);
-        } else if (error == Z_STREAM_END) {
-            if (s.m_stream.avail_in != 0) {
-                throw std::runtime_error("RUNTIME ERROR: nuwen::unzlib() - Some bytes were not consumed.");
+            // With room left over, deflate() has consumed everything and finished flushing.
+            if (z.avail_out != 0 && f != Z_FINISH) {
+                break;
             }
+        }
+
+        p += piece;
+        left -= piece;
+    } while (left != 0);
+
+    guard.dismiss();
+}
+
+inline nuwen::stream::zlib_decompressor::zlib_decompressor()
+    : m_s(view::byte_view()), m_finished(false) { }
+
+inline void nuwen::stream::zlib_decompressor::decompress(const view::byte_view v, vuc_t& dest) {
+    using namespace std;
+    using pham::zlib::MAX_PIECE_SIZE;
+
+    pham::append_guard guard(dest);
+
+    z_stream& z = m_s.m_stream;
+
+    const uc_t * p = v.data();
+    vuc_s_t left = v.size();
+
+    while (left != 0 && !m_finished) {
+        const vuc_s_t piece = min(left, MAX_PIECE_SIZE);
+
+        z.next_in = const_cast<uc_t *>(p);
+        z.avail_in = static_cast<uInt>(piece);
+
+        while (true) {
+            const vuc_s_t used = dest.size();
+            const vuc_s_t n = pham::zlib::block_size(used - guard.original_size(), z.avail_in);
 
-            temp.resize(BLOCK_SIZE - s.m_stream.avail_out);
+            dest.resize(used + n);
 
-            dest += cat(temp);
+            z.next_out = &dest[used];
+            z.avail_out = static_cast<uInt>(n);
 
-            return dest;
-        } else {
-            throw std::runtime_error("RUNTIME ERROR: nuwen::unzlib() - inflate() failed.");
+            const int error = inflate(&z, Z_NO_FLUSH);
+
+            dest.resize(used + n - z.avail_out);
+
+            if (error == Z_STREAM_END) {
+                m_finished = true;
+                break;
+            }
+
+            // Z_BUF_ERROR means that more input is needed.
+            if (error == Z_BUF_ERROR || (error == Z_OK && z.avail_in == 0 && z.avail_out != 0)) {
+                break;
+            }
+
+            if (error != Z_OK) {
+                throw runtime_error("RUNTIME ERROR: nuwen::stream::zlib_decompressor::decompress() - inflate() failed.");
+            }
         }
+
+        const vuc_s_t consumed = piece - z.avail_in;
+
+        p += consumed;
+        left -= consumed;
+    }
+
+    if (left != 0) {
+        throw runtime_error("RUNTIME ERROR: nuwen::stream::zlib_decompressor::decompress() - Some bytes were not consumed.");
+    }
+
+    guard.dismiss();
+}
+
+inline bool nuwen::stream::zlib_decompressor::finished() const {
+    return m_finished;
+}
+
+inline void nuwen::stream::zlib_decompressor::finish() const {
+    if (!m_finished) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::stream::zlib_decompressor::finish() - Compressed data ended prematurely.");
+    }
+}
+
+inline nuwen::stream::zlib_context::zlib_context(const int level, const int strategy)
+    : m_level(level), m_strategy(strategy), m_deflater(), m_inflater() { }
+
+inline nuwen::vuc_t nuwen::stream::zlib_context::zlib(const view::byte_view v) {
+    vuc_t dest;
+
+    zlib_into(v, dest);
+
+    return dest;
+}
+
+inline nuwen::vuc_t nuwen::stream::zlib_context::unzlib(const view::byte_view v, const vuc_s_t expected) {
+    vuc_t dest;
+
+    unzlib_into(v, dest, expected);
+
+    return dest;
+}
+
+inline void nuwen::stream::zlib_context::zlib_into(const view::byte_view v, vuc_t& dest) {
+    pham::zlib::deflate_into(deflater(), v, dest);
+}
+
+inline void nuwen::stream::zlib_context::unzlib_into(const view::byte_view v, vuc_t& dest, const vuc_s_t expected) {
+    pham::zlib::inflate_into(inflater(), v, dest, expected);
+}
+
+inline pham::zlib::stream& nuwen::stream::zlib_context::deflater() {
+    if (!m_deflater) {
+        m_deflater.reset(new pham::zlib::stream(NULL, 0, NULL, 0, m_level, m_strategy));
+    } else if (deflateReset(&m_deflater->m_stream) != Z_OK) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::stream::zlib_context::deflater() - deflateReset() failed.");
     }
+
+    return *m_deflater;
+}
+
+inline pham::zlib::stream& nuwen::stream::zlib_context::inflater() {
+    if (!m_inflater) {
+        m_inflater.reset(new pham::zlib::stream(view::byte_view()));
+    } else if (inflateReset(&m_inflater->m_stream) != Z_OK) {
+        throw std::runtime_error("RUNTIME ERROR: nuwen::stream::zlib_context::inflater() - inflateReset() failed.");
+    }
+
+    return *m_inflater;
 }
 
 #endif // Idempotency
@@ -5,15 +5,21 @@
 
 #include "clock.hh"
 #include "file.hh"
+#include "gluon.hh"
+#include "serial.hh"
 #include "test.hh"
 #include "typedef.hh"
 #include "vector.hh"
 #include "zlib.hh"
 
 #include "external_begin.hh"
+    #include <algorithm>
     #include <iostream>
+    #include <map>
     #include <ostream>
+    #include <stdexcept>
     #include <string>
+    #include <vector>
 #include "external_end.hh"
 
 using namespace std;
@@ -33,6 +39,171 @@ bool test_basic() {
     return test_helper(vuc_from_hex("48656C6C6F2C20776F726C6421"), vuc_from_hex("78DAF348CDC9C9D75128CF2FCA49510400205E048A"));
 }
 
+bool test_into() {
+    const vuc_t orig = vuc_from_hex("48656C6C6F2C20776F726C6421");
+    const vuc_t prefix = vuc_from_hex("CAFE");
+
+    vuc_t compressed(prefix);
+    zlib_into(orig, compressed);
+
+    vuc_t decompressed(prefix);
+    unzlib_into(view::byte_view(compressed).sub(2, compressed.size() - 2), decompressed);
+
+    vuc_t failed(prefix);
+
+    try {
+        unzlib_into(vuc_from_hex("78DA"), failed);
+        return false;
+    } catch (const runtime_error&) { }
+
+    return compressed == vec(cat(prefix)(zlib(orig))) && decompressed == vec(cat(prefix)(orig)) && failed == prefix;
+}
+
+bool test_stream(const vuc_t& orig) {
+    stream::zlib_compressor c;
+
+    vuc_t compressed;
+
+    for (vuc_s_t i = 0; i < orig.size(); i += 1000) {
+        c.compress(view::byte_view(orig).sub(i, min<vuc_s_t>(1000, orig.size() - i)), compressed);
+
+        if (i == 5000) {
+            c.flush(compressed);
+        }
+    }
+
+    c.finish(compressed);
+
+    stream::zlib_decompressor d;
+
+    vuc_t decompressed;
+
+    for (vuc_s_t i = 0; i < compressed.size(); i += 7) {
+        d.decompress(view::byte_view(compressed).sub(i, min<vuc_s_t>(7, compressed.size() - i)), decompressed);
+    }
+
+    d.finish();
+
+    return c.finished() && decompressed == orig && unzlib(compressed) == orig;
+}
+
+bool test_stream_errors() {
+    const vuc_t compressed = zlib(vuc_from_hex("48656C6C6F2C20776F726C6421"));
+
+    stream::zlib_decompressor d;
+
+    vuc_t decompressed;
+
+    d.decompress(view::byte_view(compressed).sub(0, compressed.size() - 1), decompressed);
+
+    bool premature = false;
+
+    try {
+        d.finish();
+    } catch (const runtime_error&) {
+        premature = true;
+    }
+
+    d.decompress(view::byte_view(compressed).sub(compressed.size() - 1, 1), decompressed);
+    d.finish();
+
+    try {
+        d.decompress(compressed, decompressed);
+        return false;
+    } catch (const runtime_error&) { }
+
+    return premature && decompressed == vuc_from_hex("48656C6C6F2C20776F726C6421");
+}
+
+bool test_expected(const vuc_t& orig) {
+    const vuc_t compressed = zlib(orig);
+
+    const vuc_t exact = unzlib(compressed, orig.size());
+
+    const vuc_t framed = zlib_framed(orig);
+
+    vuc_t corrupted(framed);
+    ++corrupted[7];
+
+    try {
+        (void) unzlib_framed(corrupted);
+        return false;
+    } catch (const runtime_error&) { }
+
+    return exact == orig && exact.capacity() <= orig.size() + 1
+        && unzlib(compressed, orig.size() / 3) == orig
+        && unzlib(compressed, orig.size() * 3) == orig
+        && unzlib_framed(framed) == orig;
+}
+
+// orig must contain at least 16 bytes.
+vuc_t make_record(const vuc_t& orig, const vuc_s_t i) {
+    map<string, string> m;
+
+    const vuc_s_t offset = i % (orig.size() - 15);
+
+    m["session"] = string(orig.begin() + offset, orig.begin() + offset + 16);
+    m["status"] = i % 2 == 0 ? "active" : "suspended";
+    m["user_agent"] = "Mozilla/5.0 (X11; Linux x86_64)";
+
+    ser::serial s;
+
+    s << m << static_cast<ul_t>(i);
+
+    return s.vuc();
+}
+
+bool test_dictionary(const vuc_t& orig) {
+    if (orig.size() < 16) {
+        cout << "The file is too small to make records from." << endl;
+        return true;
+    }
+
+    vector<vuc_t> samples;
+
+    for (vuc_s_t i = 0; i < 200; ++i) {
+        samples.push_back(make_record(orig, i * 37));
+    }
+
+    const zlib_dictionary d = train_zlib_dictionary(samples, 4096);
+
+    vector<zlib_dictionary> both(1, zlib_dictionary(vuc_from_hex("CAFE")));
+    both.push_back(d);
+
+    vuc_s_t plain_size = 0;
+    vuc_s_t primed_size = 0;
+
+    for (vuc_s_t i = 50000; i < 60000; i += 41) {
+        const vuc_t r = make_record(orig, i);
+        const vuc_t plain = zlib(r);
+        const vuc_t primed = zlib(r, d);
+
+        if (unzlib(primed, d) != r || unzlib(primed, both) != r || unzlib(plain, d) != r
+            || zlib_dictionary_id(primed) != d.id() || zlib_dictionary_id(plain) != 0) {
+
+            return false;
+        }
+
+        plain_size += plain.size();
+        primed_size += primed.size();
+    }
+
+    try {
+        (void) unzlib(zlib(samples[0], d));
+        return false;
+    } catch (const runtime_error&) { }
+
+    try {
+        (void) train_zlib_dictionary(vector<vuc_t>(3));
+        return false;
+    } catch (const logic_error&) { }
+
+    cout << "Dictionary: " << d.bytes().size() << " bytes, records: " << plain_size << " -> " << primed_size << " bytes" << endl;
+
+    return d.bytes().size() <= 4096 && primed_size * 2 < plain_size
+        && train_zlib_dictionary(vector<vuc_t>(1, vuc_from_hex("CAFE"))).bytes() == vuc_from_hex("CAFE");
+}
+
 bool test_extended(const string& filename) {
     const vuc_t orig = read_file(filename);
 
@@ -64,6 +235,12 @@ int main(int argc, char * argv[]) {
         NUWEN_TEST("zlib1", test_empty())
         NUWEN_TEST("zlib2", test_basic())
         NUWEN_TEST("zlib3", test_extended(argv[1]))
+        NUWEN_TEST("zlib4", test_into())
+        NUWEN_TEST("zlib5", test_stream(vuc_t()) && test_stream(vuc_t(30000, 'x')))
+        NUWEN_TEST("zlib6", test_stream_errors())
+        NUWEN_TEST("zlib7", test_stream(read_file(argv[1])))
+        NUWEN_TEST("zlib8", test_expected(vuc_t(1, 'x')) && test_expected(read_file(argv[1])))
+        NUWEN_TEST("zlib9", test_dictionary(read_file(argv[1])))
     } else {
         cout << "USAGE: zlib_test <filename>" << endl;
     }
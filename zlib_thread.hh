@@ -0,0 +1,195 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#ifndef PHAM_ZLIB_THREAD_HH
+#define PHAM_ZLIB_THREAD_HH
+
+#include "compiler.hh"
+
+#ifdef NUWEN_PLATFORM_MSVC
+    #pragma once
+#endif
+
+#include "thread.hh"
+#include "typedef.hh"
+#include "vector.hh"
+#include "zlib.hh"
+
+#include "external_begin.hh"
+    #include <algorithm>
+    #include <stdexcept>
+    #include <vector>
+    #include <boost/thread/once.hpp>
+    #include <boost/thread/tss.hpp>
+    #include <zlib.h>
+#include "external_end.hh"
+
+// These require Boost.Thread. zlib.hh alone doesn't.
+
+namespace nuwen {
+    // Splits v into chunks of chunk_size bytes, which are deflated concurrently on p, each primed with
+    // the preceding 32 KB of v. The result is a single standard zlib stream, slightly larger than zlib()'s.
+    inline vuc_t zlib_parallel(view::byte_view v, thread::pool& p, int level = Z_BEST_COMPRESSION,
+        int strategy = Z_DEFAULT_STRATEGY, vuc_s_t chunk_size = 131072);
+
+    inline void zlib_parallel_into(view::byte_view v, vuc_t& dest, thread::pool& p, int level = Z_BEST_COMPRESSION,
+        int strategy = Z_DEFAULT_STRATEGY, vuc_s_t chunk_size = 131072);
+
+    namespace stream {
+        // Created on first use in each thread, with the default level and strategy.
+        inline zlib_context& thread_zlib_context();
+    }
+}
+
+namespace pham {
+    namespace zlib {
+        // Deflates one chunk as raw data, primed with the preceding window. Every chunk but the
+        // last ends with a sync flush, so that the chunks' outputs can simply be concatenated.
+        class chunk_deflater {
+        public:
+            chunk_deflater(const nuwen::view::byte_view v, const nuwen::vuc_s_t begin, const nuwen::vuc_s_t end,
+                const int level, const int strategy, nuwen::vuc_t& out, uLong& adler)
+                : m_v(v), m_begin(begin), m_end(end), m_level(level), m_strategy(strategy), m_out(&out), m_adler(&adler) { }
+
+            void operator()() const {
+                using namespace nuwen;
+
+                const uc_t dummy = 0;
+
+                const vuc_s_t n = m_end - m_begin;
+                const uc_t * const src = n == 0 ? &dummy : m_v.data() + m_begin;
+                const bool last = m_end == m_v.size();
+
+                stream s(src, n, NULL, 0, m_level, m_strategy, -15);
+
+                const vuc_s_t dict_begin = m_begin > WINDOW_SIZE ? m_begin - WINDOW_SIZE : 0;
+
+                if (m_begin != 0 && deflateSetDictionary(&s.m_stream, m_v.data() + dict_begin,
+                    static_cast<uInt>(m_begin - dict_begin)) != Z_OK) {
+
+                    throw std::runtime_error("RUNTIME ERROR: pham::zlib::chunk_deflater::operator()() - "
+                        "deflateSetDictionary() failed.");
+                }
+
+                // A sync flush adds an empty stored block and up to a byte of padding.
+                m_out->resize(deflateBound(&s.m_stream, static_cast<uLong>(n)) + 16);
+
+                s.m_stream.next_out = &(*m_out)[0];
+                s.m_stream.avail_out = static_cast<uInt>(m_out->size());
+
+                const int error = deflate(&s.m_stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+
+                if (error != (last ? Z_STREAM_END : Z_OK) || s.m_stream.avail_in != 0 || s.m_stream.avail_out == 0) {
+                    throw std::runtime_error("RUNTIME ERROR: pham::zlib::chunk_deflater::operator()() - deflate() failed.");
+                }
+
+                m_out->resize(s.m_stream.total_out);
+
+                *m_adler = adler32(adler32(0, NULL, 0), src, static_cast<uInt>(n));
+            }
+
+        private:
+            nuwen::view::byte_view m_v;
+            nuwen::vuc_s_t         m_begin;
+            nuwen::vuc_s_t         m_end;
+            int                    m_level;
+            int                    m_strategy;
+            nuwen::vuc_t *         m_out;
+            uLong *                m_adler;
+        };
+
+        inline boost::thread_specific_ptr<nuwen::stream::zlib_context>& thread_contexts() {
+            static boost::thread_specific_ptr<nuwen::stream::zlib_context> p;
+            return p;
+        }
+
+        inline void make_thread_contexts() {
+            (void) thread_contexts();
+        }
+    }
+}
+
+inline nuwen::vuc_t nuwen::zlib_parallel(const view::byte_view v, thread::pool& p,
+    const int level, const int strategy, const vuc_s_t chunk_size) {
+
+    vuc_t dest;
+
+    zlib_parallel_into(v, dest, p, level, strategy, chunk_size);
+
+    return dest;
+}
+
+inline void nuwen::zlib_parallel_into(const view::byte_view v, vuc_t& dest, thread::pool& p,
+    const int level, const int strategy, const vuc_s_t chunk_size) {
+
+    using namespace std;
+
+    if (chunk_size == 0 || chunk_size > pham::zlib::MAX_PIECE_SIZE) {
+        throw logic_error("LOGIC ERROR: nuwen::zlib_parallel_into() - Invalid chunk_size.");
+    }
+
+    const vuc_s_t chunks = v.empty() ? 1 : (v.size() - 1) / chunk_size + 1;
+
+    vector<vuc_t> outs(chunks);
+    vector<uLong> adlers(chunks);
+
+    {
+        thread::task_group g(p);
+
+        for (vuc_s_t i = 0; i < chunks; ++i) {
+            g.run(pham::zlib::chunk_deflater(v, i * chunk_size, min(v.size(), (i + 1) * chunk_size),
+                level, strategy, outs[i], adlers[i]));
+        }
+
+        g.wait();
+    }
+
+    uLong adler = adler32(0, NULL, 0);
+
+    vuc_s_t total = 6;
+
+    for (vuc_s_t i = 0; i < chunks; ++i) {
+        const vuc_s_t n = min(v.size() - i * chunk_size, chunk_size);
+
+        adler = adler32_combine(adler, adlers[i], static_cast<z_off_t>(n));
+
+        total += outs[i].size();
+    }
+
+    pham::append_guard guard(dest);
+
+    dest.reserve(dest.size() + total);
+
+    const us_t h = pham::zlib::header(level, strategy);
+
+    dest.push_back(static_cast<uc_t>(h >> 8));
+    dest.push_back(static_cast<uc_t>(h & 0xFF));
+
+    for (vuc_s_t i = 0; i < chunks; ++i) {
+        dest.insert(dest.end(), outs[i].begin(), outs[i].end());
+    }
+
+    const vuc_t trailer = vuc_from_ul(static_cast<ul_t>(adler));
+
+    dest.insert(dest.end(), trailer.begin(), trailer.end());
+
+    guard.dismiss();
+}
+
+inline nuwen::stream::zlib_context& nuwen::stream::thread_zlib_context() {
+    static boost::once_flag flag = BOOST_ONCE_INIT;
+
+    boost::call_once(pham::zlib::make_thread_contexts, flag);
+
+    boost::thread_specific_ptr<zlib_context>& p = pham::zlib::thread_contexts();
+
+    if (!p.get()) {
+        p.reset(new zlib_context);
+    }
+
+    return *p;
+}
+
+#endif // Idempotency
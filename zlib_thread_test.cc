@@ -0,0 +1,71 @@
+// Copyright Stephan T. Lavavej, http://nuwen.net .
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at
+// http://boost.org/LICENSE_1_0.txt .
+
+#include "file.hh"
+#include "test.hh"
+#include "thread.hh"
+#include "typedef.hh"
+#include "vector.hh"
+#include "zlib.hh"
+#include "zlib_thread.hh"
+
+#include "external_begin.hh"
+    #include <algorithm>
+    #include <iostream>
+    #include <ostream>
+    #include <stdexcept>
+#include "external_end.hh"
+
+using namespace std;
+using namespace nuwen;
+using namespace nuwen::file;
+
+bool test_parallel(const vuc_t& orig) {
+    thread::pool& p = thread::default_pool();
+
+    const vuc_t small(orig.begin(), orig.begin() + min<vuc_s_t>(orig.size(), 1000));
+
+    return zlib_parallel(vuc_t(), p) == zlib(vuc_t())
+        && zlib_parallel(small, p) == zlib(small)
+        && unzlib(zlib_parallel(orig, p)) == orig
+        && unzlib(zlib_parallel(orig, p, 6, Z_DEFAULT_STRATEGY, 4096)) == orig
+        && unzlib(zlib_parallel(small, p, 1, Z_DEFAULT_STRATEGY, 1)) == small;
+}
+
+bool test_context(const vuc_t& orig) {
+    stream::zlib_context& c = stream::thread_zlib_context();
+
+    if (&c != &stream::thread_zlib_context()) {
+        return false;
+    }
+
+    try {
+        (void) c.unzlib(vuc_from_hex("78DA"));
+        return false;
+    } catch (const runtime_error&) { }
+
+    for (vuc_s_t i = 0; i < orig.size() && i < 100000; i += 997) {
+        const vuc_t v(orig.begin() + i, orig.begin() + min<vuc_s_t>(orig.size(), i + 3000));
+
+        const vuc_t compressed = c.zlib(v);
+
+        if (compressed != zlib(v) || c.unzlib(compressed) != v || c.unzlib(compressed, v.size()) != v) {
+            return false;
+        }
+    }
+
+    stream::zlib_context fast(1);
+
+    return fast.zlib(orig) == zlib(orig, 1) && fast.unzlib(fast.zlib(orig)) == orig;
+}
+
+int main(int argc, char * argv[]) {
+    if (argc == 2) {
+        NUWEN_TEST("zlib_thread1", test_parallel(read_file(argv[1])))
+        NUWEN_TEST("zlib_thread2", test_context(read_file(argv[1])))
+    } else {
+        cout << "USAGE: zlib_thread_test <filename>" << endl;
+    }
+}